@@ -6,6 +6,7 @@
 #include "argparse.h"
 #include "libblast.h"
 #include "n64graphics.h"
+#include "romimage.h"
 #include "utils.h"
 
 #define F3D2OBJ_VERSION "0.1"
@@ -171,17 +172,17 @@ static void generate_material_file(arg_config *config, char *mtl_filename,
   rgba *rgba_img;
   ia *ia_img;
   unsigned char *img_raw = NULL;
+  rom_image rom_file;
   unsigned char *rom = NULL;
-  long rom_size;
   unsigned int segment;
   unsigned int offset;
   int i;
   if (config->blast_corps_rom != NULL) {
-    rom_size = read_file(config->blast_corps_rom, &rom);
-    if (rom_size < 0) {
-      perror("Error opening ROM file");
+    if (rom_open(&rom_file, config->blast_corps_rom) < 0) {
+      ERROR("Error opening ROM file \"%s\"\n", config->blast_corps_rom);
       exit(EXIT_FAILURE);
     }
+    rom = rom_range(&rom_file, 0, rom_file.size);
     img_raw = malloc(4 * 256 * 256);
   }
   fmtl = fopen(mtl_filename, "w");
@@ -293,7 +294,7 @@ static void generate_material_file(arg_config *config, char *mtl_filename,
     }
   }
   if (rom != NULL) {
-    free(rom);
+    rom_close(&rom_file);
     free(img_raw);
   }
 }
@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,6 +10,7 @@
 
 #include "argparse.h"
 #include "mipsdisasm.h"
+#include "romimage.h"
 #include "utils.h"
 
 #define MIPSDISASM_VERSION "0.2+"
@@ -17,7 +19,6 @@
 typedef struct {
   char name[60];
   unsigned int vaddr;
-  char prefix[FILENAME_MAX];
 } asm_label;
 
 typedef struct {
@@ -26,27 +27,52 @@ typedef struct {
   int count;
 } label_buf;
 
+// maximum operands retained per instruction; N64 instructions use at most 3
+#define MAX_OPERANDS 3
+
+// operand fields retained from capstone detail
+// memory operands store their base in reg[] and displacement in imm
 typedef struct {
-  // copied from cs_insn structure
-  unsigned int id;
-  uint8_t bytes[4];
-  char op_str[32];
-  char mnemonic[16];
-  cs_mips_op operands[8];
+  int32_t imm; // immediate, branch target, or memory displacement
+  uint8_t reg[MAX_OPERANDS];
+  uint8_t type[MAX_OPERANDS];
   uint8_t op_count;
-  // n64split-specific data
-  int is_jump;
-  int linked_insn;
-  union {
-    unsigned int linked_value;
-    float linked_float;
-  };
-  int newline;
-} disasm_data;
+} insn_operands;
+
+_Static_assert(MIPS_REG_ENDING <= 0x100, "MIPS register ids must fit in uint8_t");
+_Static_assert(MIPS_INS_ENDING <= 0x10000, "MIPS instruction ids must fit in uint16_t");
+
+// per-instruction flags
+#define INSN_JUMP    0x01 // branch, jump, or call
+#define INSN_NEWLINE 0x02 // emit blank line before (function boundary)
+
+// exported as is in disasm_ir_record
+_Static_assert(INSN_JUMP == DISASM_IR_JUMP && INSN_NEWLINE == DISASM_IR_NEWLINE,
+               "block flags must match exported flags");
+_Static_assert(MAX_OPERANDS == 3 && sizeof(disasm_ir_record) == 36,
+               "disasm_ir_record layout changed");
+
+// global label generated by pass 1, recorded so cached blocks can replay it
+typedef enum {
+  REF_FUNC, // func_XXXXXXXX
+  REF_DATA, // D_XXXXXXXX
+} global_ref_kind;
+
+typedef struct {
+  unsigned int vaddr;
+  uint32_t kind;
+} global_ref;
 
 typedef struct _asm_block {
   label_buf locals;
-  disasm_data *instructions;
+  // decoded instructions as parallel arrays, indexed by (vaddr - block vaddr) / 4
+  // mnemonic and operand text are regenerated from the raw word in pass 2
+  uint32_t *words;            // raw instruction word
+  uint16_t *ids;              // capstone instruction id, rewritten for pseudos
+  insn_operands *operands;
+  uint8_t *flags;             // INSN_* flags
+  int *linked_insn;           // index of linked LUI/low instruction, or -1
+  unsigned int *linked_value; // linked address, or float bits for LI
   int instruction_count;
   unsigned int offset;
   unsigned int length;
@@ -56,12 +82,28 @@ typedef struct _asm_block {
 // hidden disassembler state struct
 typedef struct _disasm_state {
   label_buf globals;
+  // vaddrs that have a global label, see globals_contains()
+  uint64_t *global_set; // open addressed, vaddr | GLOBAL_SET_USED, 0 if empty
+  int global_set_size;
+  int global_set_count;
+  int globals_sorted; // globals unchanged since the last labels_sort()
 
   asm_block *blocks;
   int block_alloc;
   int block_count;
+  int *block_index; // see block_lookup()
+  int block_index_size;
 
-  csh handle;
+  // pass 1 cache, NULL if disabled
+  char *cache_dir;
+  global_ref *refs; // global labels referenced by the block being decoded
+  int ref_alloc;
+  int ref_count;
+
+  csh handle;      // pass 1 decoder, with operand detail
+  csh text_handle; // pass 2 text decoder, no detail
+  cs_insn *text_insn;
+  const char *reg_names[MIPS_REG_ENDING];
 
   asm_syntax syntax;
   int merge_pseudo;
@@ -119,58 +161,342 @@ static int labels_find(const label_buf *buf, unsigned int vaddr) {
   return -1;
 }
 
-// try to find a matching LUI for a given register
-static void link_with_lui(disasm_state *state, int block_id, int offset,
-                          unsigned int reg, unsigned int mem_imm) {
-  asm_block *block = &state->blocks[block_id];
-#define MAX_LOOKBACK 128
-  disasm_data *insn = block->instructions;
-  // don't attempt to compute addresses for zero offset
-  if (mem_imm != 0x0) {
-    // end search after some sane max number of instructions
-    int end_search = MAX(0, offset - MAX_LOOKBACK);
-    for (int search = offset - 1; search >= end_search; search--) {
-      // use an `if` instead of `case` block to allow breaking out of the `for`
-      // loop
-      if (insn[search].id == MIPS_INS_LUI) {
-        unsigned int rd = insn[search].operands[0].reg;
-        if (reg == rd) {
-          unsigned int lui_imm = (unsigned int)insn[search].operands[1].imm;
-          unsigned int addr = ((lui_imm << 16) + mem_imm);
-          insn[search].linked_insn = offset;
-          insn[search].linked_value = addr;
-          insn[offset].linked_insn = search;
-          insn[offset].linked_value = addr;
-          // if not ORI, create global data label if one does not exist
-          if (insn[offset].id != MIPS_INS_ORI) {
-            int label = labels_find(&state->globals, addr);
-            if (label < 0) {
-              char label_name[32];
-              sprintf(label_name, "D_%08X", addr);
-              labels_add(&state->globals, label_name, addr);
-            }
-          }
-          break;
-        }
-      } else if (insn[search].id == MIPS_INS_LW ||
-                 insn[search].id == MIPS_INS_LD ||
-                 insn[search].id == MIPS_INS_ADDIU ||
-                 insn[search].id == MIPS_INS_ADDU ||
-                 insn[search].id == MIPS_INS_ADD ||
-                 insn[search].id == MIPS_INS_SUB ||
-                 insn[search].id == MIPS_INS_SUBU) {
-        unsigned int rd = insn[search].operands[0].reg;
-        if (reg == rd) {
-          // ignore: reg is pointer, offset is probably struct data member
-          break;
-        }
-      } else if (insn[search].id == MIPS_INS_JR &&
-                 insn[search].operands[0].reg == MIPS_REG_RA) {
-        // stop looking when previous `jr ra` is hit
-        break;
+// index of first label at or after vaddr in a buffer sorted by labels_sort()
+static int labels_lower_bound(const label_buf *buf, unsigned int vaddr) {
+  int lo = 0;
+  int hi = buf->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (buf->labels[mid].vaddr < vaddr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// find first label at vaddr in a buffer already sorted by labels_sort()
+// returns index in buf->labels if found, -1 otherwise
+static int labels_find_sorted(const label_buf *buf, unsigned int vaddr) {
+  int idx = labels_lower_bound(buf, vaddr);
+  if (idx < buf->count && buf->labels[idx].vaddr == vaddr) {
+    return idx;
+  }
+  return -1;
+}
+
+// block index: open addressed table of block offsets, entries are block + 1
+static unsigned int block_hash(unsigned int offset, unsigned int mask) {
+  return ((offset >> 2) * 0x9E3779B1u) & mask;
+}
+
+static void block_index_insert(disasm_state *state, int block) {
+  unsigned int mask = state->block_index_size - 1;
+  unsigned int offset = state->blocks[block].offset;
+  unsigned int h = block_hash(offset, mask);
+  while (state->block_index[h]) {
+    // keep the first block added at an offset
+    if (state->blocks[state->block_index[h] - 1].offset == offset) {
+      return;
+    }
+    h = (h + 1) & mask;
+  }
+  state->block_index[h] = block + 1;
+}
+
+// add the newest block to the index, growing it to stay at most half full
+static void block_index_add(disasm_state *state) {
+  if (2 * state->block_count > state->block_index_size) {
+    free(state->block_index);
+    state->block_index_size = MAX(2 * state->block_index_size, 64);
+    state->block_index =
+        calloc(state->block_index_size, sizeof(*state->block_index));
+    for (int i = 0; i < state->block_count; i++) {
+      block_index_insert(state, i);
+    }
+  } else {
+    block_index_insert(state, state->block_count - 1);
+  }
+}
+
+static asm_block *block_lookup(const disasm_state *state, unsigned int offset) {
+  if (state->block_index_size == 0) {
+    return NULL;
+  }
+  unsigned int mask = state->block_index_size - 1;
+  unsigned int h = block_hash(offset, mask);
+  while (state->block_index[h]) {
+    asm_block *block = &state->blocks[state->block_index[h] - 1];
+    if (block->offset == offset) {
+      return block;
+    }
+    h = (h + 1) & mask;
+  }
+  return NULL;
+}
+
+#define GLOBAL_SET_USED (1ULL << 32)
+
+static void global_set_insert(disasm_state *state, unsigned int vaddr) {
+  unsigned int mask = state->global_set_size - 1;
+  unsigned int h = block_hash(vaddr, mask);
+  while (state->global_set[h]) {
+    if ((uint32_t)state->global_set[h] == vaddr) {
+      return;
+    }
+    h = (h + 1) & mask;
+  }
+  state->global_set[h] = vaddr | GLOBAL_SET_USED;
+  state->global_set_count++;
+}
+
+static int globals_contains(const disasm_state *state, unsigned int vaddr) {
+  if (state->global_set_size == 0) {
+    return 0;
+  }
+  unsigned int mask = state->global_set_size - 1;
+  unsigned int h = block_hash(vaddr, mask);
+  while (state->global_set[h]) {
+    if ((uint32_t)state->global_set[h] == vaddr) {
+      return 1;
+    }
+    h = (h + 1) & mask;
+  }
+  return 0;
+}
+
+// add a global label, keeping the vaddr set at most half full
+static void globals_add(disasm_state *state, const char *name,
+                        unsigned int vaddr) {
+  labels_add(&state->globals, name, vaddr);
+  state->globals_sorted = 0;
+  if (2 * (state->global_set_count + 1) > state->global_set_size) {
+    uint64_t *old_set = state->global_set;
+    int old_size = state->global_set_size;
+    state->global_set_size = MAX(2 * old_size, 256);
+    state->global_set =
+        calloc(state->global_set_size, sizeof(*state->global_set));
+    state->global_set_count = 0;
+    for (int i = 0; i < old_size; i++) {
+      if (old_set[i]) {
+        global_set_insert(state, (uint32_t)old_set[i]);
       }
     }
+    free(old_set);
+  }
+  global_set_insert(state, vaddr);
+}
+
+static void globals_sort(disasm_state *state) {
+  if (!state->globals_sorted) {
+    labels_sort(&state->globals);
+    state->globals_sorted = 1;
+  }
+}
+
+// reference a global label at vaddr, generating one if none exists
+static void globals_reference(disasm_state *state, global_ref_kind kind,
+                              unsigned int vaddr) {
+  if (state->cache_dir) {
+    if (state->ref_count >= state->ref_alloc) {
+      state->ref_alloc = MAX(2 * state->ref_alloc, 128);
+      state->refs =
+          realloc(state->refs, sizeof(*state->refs) * state->ref_alloc);
+    }
+    state->refs[state->ref_count].vaddr = vaddr;
+    state->refs[state->ref_count].kind = kind;
+    state->ref_count++;
+  }
+  if (!globals_contains(state, vaddr)) {
+    char label_name[32];
+    sprintf(label_name, kind == REF_FUNC ? "func_%08X" : "D_%08X", vaddr);
+    globals_add(state, label_name, vaddr);
+  }
+}
+
+// add a local branch label at vaddr if one does not exist
+static void locals_add(const disasm_state *state, asm_block *block,
+                       unsigned int vaddr) {
+  char label_name[32];
+  switch (state->syntax) {
+  case ASM_GAS:
+    sprintf(label_name, ".L%08X", vaddr);
+    break;
+  case ASM_ARMIPS:
+    sprintf(label_name, "@L%08X", vaddr);
+    break;
+  }
+  labels_add(&block->locals, label_name, vaddr);
+}
+
+static void locals_reference(const disasm_state *state, asm_block *block,
+                             unsigned int vaddr) {
+  if (labels_find(&block->locals, vaddr) < 0) {
+    locals_add(state, block, vaddr);
+  }
+}
+
+// forward register tracking for LUI pairing
+// each register keeps a chain of the instructions that last wrote it, so the
+// LUI (if any) a register currently holds is found without searching backwards
+typedef struct {
+  int head[0x100]; // most recent write per register, -1 if none
+  int *prev;       // previous write to the same register, per instruction
+} reg_track;
+
+static void reg_track_init(reg_track *track, int count) {
+  for (int r = 0; r < (int)DIM(track->head); r++) {
+    track->head[r] = -1;
+  }
+  track->prev = malloc(MAX(count, 1) * sizeof(*track->prev));
+}
+
+static void reg_track_write(reg_track *track, unsigned int reg, int idx) {
+  track->prev[idx] = track->head[reg];
+  track->head[reg] = idx;
+}
+
+// find the last instruction that wrote 'reg' after 'boundary'
+// LUIs since rewritten to LI no longer count as writes
+// returns instruction index or -1 if none
+static int reg_track_find(reg_track *track, const uint16_t *ids,
+                          unsigned int reg, int boundary) {
+  int idx = track->head[reg];
+  while (idx > boundary && ids[idx] == MIPS_INS_LI) {
+    idx = track->prev[idx];
+  }
+  track->head[reg] = idx;
+  return idx > boundary ? idx : -1;
+}
+
+// writes that end a LUI's lifetime when pairing %hi/%lo
+static int clobbers_hilo(unsigned int id) {
+  switch (id) {
+  case MIPS_INS_LW:
+  case MIPS_INS_LD:
+  case MIPS_INS_ADDIU:
+  case MIPS_INS_ADDU:
+  case MIPS_INS_ADD:
+  case MIPS_INS_SUB:
+  case MIPS_INS_SUBU:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// writes that end a LUI's lifetime when matching float constants
+static int clobbers_float(unsigned int id) {
+  switch (id) {
+  case MIPS_INS_LW:
+  case MIPS_INS_LD:
+  case MIPS_INS_LH:
+  case MIPS_INS_LHU:
+  case MIPS_INS_LB:
+  case MIPS_INS_LBU:
+  case MIPS_INS_ADDIU:
+  case MIPS_INS_ADD:
+  case MIPS_INS_SUB:
+  case MIPS_INS_SUBU:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// link instruction 'offset' with the LUI at 'lui' if 'lui' is one
+static void link_with_lui(disasm_state *state, asm_block *block, int offset,
+                          int lui, unsigned int mem_imm) {
+  // don't attempt to compute addresses for zero offset
+  if (mem_imm == 0x0 || lui < 0 || block->ids[lui] != MIPS_INS_LUI) {
+    return;
+  }
+  unsigned int lui_imm = (unsigned int)block->operands[lui].imm;
+  unsigned int addr = ((lui_imm << 16) + mem_imm);
+  block->linked_insn[lui] = offset;
+  block->linked_value[lui] = addr;
+  block->linked_insn[offset] = lui;
+  block->linked_value[offset] = addr;
+  // if not ORI, create global data label if one does not exist
+  if (block->ids[offset] != MIPS_INS_ORI) {
+    globals_reference(state, REF_DATA, addr);
+  }
+}
+
+// keep only the operand fields the disassembler passes consume
+static void operands_pack(insn_operands *ops, const cs_insn *insn) {
+  memset(ops, 0, sizeof(*ops));
+  if (insn->detail == NULL) {
+    return;
+  }
+  const cs_mips *mips = &insn->detail->mips;
+  ops->op_count = MIN(mips->op_count, MAX_OPERANDS);
+  for (int o = 0; o < ops->op_count; o++) {
+    ops->type[o] = (uint8_t)mips->operands[o].type;
+    switch (mips->operands[o].type) {
+    case MIPS_OP_REG:
+      ops->reg[o] = (uint8_t)mips->operands[o].reg;
+      break;
+    case MIPS_OP_IMM:
+      ops->imm = (int32_t)mips->operands[o].imm;
+      break;
+    case MIPS_OP_MEM:
+      ops->reg[o] = (uint8_t)mips->operands[o].mem.base;
+      ops->imm = (int32_t)mips->operands[o].mem.disp;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+static void block_alloc_instructions(asm_block *block, int count) {
+  size_t n = MAX(count, 1);
+  block->words = malloc(n * sizeof(*block->words));
+  block->ids = malloc(n * sizeof(*block->ids));
+  block->operands = malloc(n * sizeof(*block->operands));
+  block->flags = calloc(n, sizeof(*block->flags));
+  block->linked_insn = malloc(n * sizeof(*block->linked_insn));
+  block->linked_value = calloc(n, sizeof(*block->linked_value));
+  if (!block->words || !block->ids || !block->operands || !block->flags ||
+      !block->linked_insn || !block->linked_value) {
+    ERROR("Error: Failed to allocate memory for %d instructions\n", count);
+    exit(EXIT_FAILURE);
   }
+  block->instruction_count = count;
+}
+
+static void block_free_instructions(asm_block *block) {
+  free(block->words);
+  free(block->ids);
+  free(block->operands);
+  free(block->flags);
+  free(block->linked_insn);
+  free(block->linked_value);
+  block->words = NULL;
+  block->ids = NULL;
+  block->operands = NULL;
+  block->flags = NULL;
+  block->linked_insn = NULL;
+  block->linked_value = NULL;
+  block->instruction_count = 0;
+}
+
+// append an empty block to the state, not counted until decoded
+static asm_block *block_new(disasm_state *state, unsigned int offset,
+                            unsigned int length, unsigned int vaddr) {
+  if (state->block_count >= state->block_alloc) {
+    state->block_alloc *= 2;
+    state->blocks =
+        realloc(state->blocks, sizeof(*state->blocks) * state->block_alloc);
+  }
+  asm_block *block = &state->blocks[state->block_count];
+  labels_alloc(&block->locals);
+  block->offset = offset;
+  block->length = length;
+  block->vaddr = vaddr;
+  return block;
 }
 
 // disassemble a block of code and collect JALs and local labels
@@ -178,221 +504,84 @@ static void disassemble_block(unsigned char *data, unsigned int length,
                               unsigned int vaddr, disasm_state *state,
                               int block_id) {
   asm_block *block = &state->blocks[block_id];
+  const uint8_t *code = data;
+  size_t code_size = length;
+  uint64_t address = vaddr;
+  cs_insn *cs;
 
-  // Process in chunks to prevent memory exhaustion and trace traps
-  const unsigned int CHUNK_SIZE = 0x8000; // 32KB chunks
-  
-  unsigned int remaining = length;
-  unsigned int processed = 0;
-  block->instruction_count = 0;
-  
-  // Initialize with a reasonable initial size based on section length
-  unsigned int estimated_instructions = length / 4; // 4 bytes per instruction
-  unsigned int instruction_capacity = MIN(estimated_instructions + 256, 4096); // Cap at 4K initially
-  
-  // Safety check: don't allocate excessive memory for huge sections
-  if (instruction_capacity > 16384) { // Max 16K instructions per section initially
-    instruction_capacity = 16384;
-  }
-  
-  block->instructions = calloc(instruction_capacity, sizeof(*block->instructions));
-  
-  if (!block->instructions) {
-    ERROR("Error: Failed to allocate memory for %u instructions\n", instruction_capacity);
-    exit(EXIT_FAILURE);
-  }
+  // every word becomes one entry: capstone SKIPDATA emits undecodable words
+  // as 4-byte data, so the instruction count is known up front
+  block_alloc_instructions(block, length / 4);
+  cs = cs_malloc(state->handle);
 
-  INFO("Processing %u bytes in chunks of %u bytes\n", length, CHUNK_SIZE);
-  
-  while (remaining > 0) {
-    unsigned int chunk_size = MIN(remaining, CHUNK_SIZE);
-    unsigned int chunk_processed = 0;
-    
-    // Process this chunk in smaller sub-chunks for capstone
-    while (chunk_processed < chunk_size) {
-      cs_insn *insn;
-      unsigned int sub_chunk_size = MIN(chunk_size - chunk_processed, 0x400); // 1KB sub-chunks
-      unsigned int current_offset = processed + chunk_processed;
-      unsigned int current_vaddr = vaddr + current_offset;
-      
-      int count = cs_disasm(state->handle, &data[current_offset], sub_chunk_size,
-                           current_vaddr, 0, &insn);
-      
-      if (count <= 0) {
-        // No instructions disassembled, skip to next chunk
-        chunk_processed += 4; // Skip one instruction worth
-        continue;
-      }
-      
-      // Check if we need to resize the instruction buffer
-      if (block->instruction_count + (unsigned int)count > instruction_capacity) {
-        unsigned int new_capacity = instruction_capacity * 2;
-        
-        // Limit to prevent excessive memory usage
-        if (new_capacity > 0x40000) { // 256K instructions max
-          new_capacity = 0x40000;
-        }
-        
-      if (new_capacity > instruction_capacity) {
-        disasm_data *new_instructions = realloc(block->instructions, 
-                                              new_capacity * sizeof(*block->instructions));
-        if (!new_instructions) {
-          ERROR("Error: Failed to reallocate memory for %u instructions\n", new_capacity);
-          // Continue with what we have rather than crashing
-          int available_space = instruction_capacity - block->instruction_count;
-          if (available_space <= 0) {
-            INFO("No space left for instructions, stopping at instruction %u\n", block->instruction_count);
-            cs_free(insn, count);
-            remaining = 0; // Force exit from outer loop
-            break;
-          }
-          // Limit count to available space
-          if (count > available_space) {
-            count = available_space;
-          }
-        } else {
-          block->instructions = new_instructions;
-          instruction_capacity = new_capacity;
-        }
-      } else {
-        // Hit memory limit, truncate
-        int available_space = instruction_capacity - block->instruction_count;
-        if (available_space <= 0) {
-          INFO("Hit instruction limit, stopping at instruction %u\n", block->instruction_count);
-          cs_free(insn, count);
-          remaining = 0; // Force exit from outer loop
-          break;
-        }
-        // Limit count to available space
-        if (count > available_space) {
-          count = available_space;
-        }
-      }
-      }
-      
-      // Copy instruction data
-      for (int i = 0; i < count; i++) {
-        disasm_data *dis_insn = &block->instructions[block->instruction_count + i];
-        dis_insn->id = insn[i].id;
-        memcpy(dis_insn->bytes, insn[i].bytes, sizeof(dis_insn->bytes));
-        
-        // Safe string copy with bounds checking to prevent buffer overflows
-        strncpy(dis_insn->mnemonic, insn[i].mnemonic, sizeof(dis_insn->mnemonic) - 1);
-        dis_insn->mnemonic[sizeof(dis_insn->mnemonic) - 1] = '\0';
-        
-        strncpy(dis_insn->op_str, insn[i].op_str, sizeof(dis_insn->op_str) - 1);
-        dis_insn->op_str[sizeof(dis_insn->op_str) - 1] = '\0';
-        if (insn[i].detail != NULL && insn[i].detail->mips.op_count > 0) {
-          dis_insn->op_count = insn[i].detail->mips.op_count;
-          memcpy(dis_insn->operands, insn[i].detail->mips.operands,
-                 sizeof(dis_insn->operands));
-        } else {
-          dis_insn->op_count = 0;
-        }
-        dis_insn->is_jump =
-            cs_insn_group(state->handle, &insn[i], MIPS_GRP_BRANCH_RELATIVE) ||
-            cs_insn_group(state->handle, &insn[i], MIPS_GRP_JUMP) ||
-            insn[i].id == MIPS_INS_JAL || insn[i].id == MIPS_INS_BAL;
+  for (int i = 0; i < block->instruction_count; i++) {
+    block->words[i] = read_u32_be(&data[i * 4]);
+    block->linked_insn[i] = -1;
+    if (cs_disasm_iter(state->handle, &code, &code_size, &address, cs)) {
+      block->ids[i] = (uint16_t)cs->id;
+      operands_pack(&block->operands[i], cs);
+      if (cs_insn_group(state->handle, cs, MIPS_GRP_BRANCH_RELATIVE) ||
+          cs_insn_group(state->handle, cs, MIPS_GRP_JUMP) ||
+          cs->id == MIPS_INS_JAL || cs->id == MIPS_INS_BAL) {
+        block->flags[i] |= INSN_JUMP;
       }
-      
-      cs_free(insn, count);
-      block->instruction_count += count;
-      chunk_processed += count * 4;
-    }
-    
-    processed += chunk_size;
-    remaining -= chunk_size;
-    
-    // Show progress for large sections
-    if (length > 0x10000 && processed % 0x10000 == 0) {
-      INFO("  Processed %u/%u bytes (%.2f%%)\n", processed, length, 
-           (float)processed * 100.0f / (float)length);
+    } else {
+      // keep word indices aligned with addresses
+      block->ids[i] = MIPS_INS_INVALID;
+      memset(&block->operands[i], 0, sizeof(block->operands[i]));
+      code += 4;
+      code_size -= 4;
+      address += 4;
     }
   }
+  cs_free(cs, 1);
 
   if (block->instruction_count > 0) {
-    disasm_data *insn = block->instructions;
+    uint16_t *ids = block->ids;
+    insn_operands *ops = block->operands;
+    // register state for pseudo merging, reset at each `jr ra`
+    reg_track hilo_track;
+    reg_track float_track;
+    int last_return = -1;
+    reg_track_init(&hilo_track, block->instruction_count);
+    reg_track_init(&float_track, block->instruction_count);
     for (int i = 0; i < block->instruction_count; i++) {
-      insn[i].linked_insn = -1;
-      if (insn[i].is_jump) {
+      if (block->flags[i] & INSN_JUMP) {
         // flag for newline two instructions after `jr ra` or `j`
-        if (((insn[i].id == MIPS_INS_JR || insn[i].id == MIPS_INS_JALR) &&
-             insn[i].operands[0].reg == MIPS_REG_RA) ||
-            insn[i].id == MIPS_INS_J) {
+        if (((ids[i] == MIPS_INS_JR || ids[i] == MIPS_INS_JALR) &&
+             ops[i].reg[0] == MIPS_REG_RA) ||
+            ids[i] == MIPS_INS_J) {
           if (i + 2 < block->instruction_count) {
-            insn[i + 2].newline = 1;
+            block->flags[i + 2] |= INSN_NEWLINE;
           }
         }
 
-        if (insn[i].id == MIPS_INS_JAL || insn[i].id == MIPS_INS_BAL ||
-            insn[i].id == MIPS_INS_J) {
-          unsigned int jal_target = (unsigned int)insn[i].operands[0].imm;
+        if (ids[i] == MIPS_INS_JAL || ids[i] == MIPS_INS_BAL ||
+            ids[i] == MIPS_INS_J) {
           // create label if one does not exist
-          if (labels_find(&state->globals, jal_target) < 0) {
-            char label_name[FILENAME_MAX];
-            sprintf(label_name, "func_%08X", jal_target);
-            labels_add(&state->globals, label_name, jal_target);
-          }
+          globals_reference(state, REF_FUNC, (unsigned int)ops[i].imm);
         } else {
           // all branches and jumps
-          for (int o = 0; o < insn[i].op_count; o++) {
-            if (insn[i].operands[o].type == MIPS_OP_IMM) {
-              char label_name[32];
-              unsigned int branch_target =
-                  (unsigned int)insn[i].operands[o].imm;
-              // create label if one does not exist
-              int label = labels_find(&block->locals, branch_target);
-              if (label < 0) {
-                switch (state->syntax) {
-                case ASM_GAS:
-                  sprintf(label_name, ".L%08X", branch_target);
-                  break;
-                case ASM_ARMIPS:
-                  sprintf(label_name, "@L%08X", branch_target);
-                  break;
-                }
-                labels_add(&block->locals, label_name, branch_target);
-              }
+          for (int o = 0; o < ops[i].op_count; o++) {
+            if (ops[i].type[o] == MIPS_OP_IMM) {
+              locals_reference(state, block, (unsigned int)ops[i].imm);
             }
           }
         }
       }
 
       if (state->merge_pseudo) {
-        switch (insn[i].id) {
+        switch (ids[i]) {
         // find floating point LI
         case MIPS_INS_MTC1: {
-          unsigned int rt = insn[i].operands[0].reg;
-          for (int s = i - 1; s >= 0; s--) {
-            if (insn[s].id == MIPS_INS_LUI && insn[s].operands[0].reg == rt) {
-              float f;
-              uint32_t lui_imm = (uint32_t)(insn[s].operands[1].imm << 16);
-              memcpy(&f, &lui_imm, sizeof(f));
-              // link up the LUI with this instruction and the float
-              insn[s].linked_insn = i;
-              insn[s].linked_float = f;
-              // rewrite LUI instruction to be LI
-              insn[s].id = MIPS_INS_LI;
-              strcpy(insn[s].mnemonic, "li");
-              break;
-            } else if (insn[s].id == MIPS_INS_LW || insn[s].id == MIPS_INS_LD ||
-                       insn[s].id == MIPS_INS_LH ||
-                       insn[s].id == MIPS_INS_LHU ||
-                       insn[s].id == MIPS_INS_LB ||
-                       insn[s].id == MIPS_INS_LBU ||
-                       insn[s].id == MIPS_INS_ADDIU ||
-                       insn[s].id == MIPS_INS_ADD ||
-                       insn[s].id == MIPS_INS_SUB ||
-                       insn[s].id == MIPS_INS_SUBU) {
-              unsigned int rd = insn[s].operands[0].reg;
-              if (rt == rd) {
-                break;
-              }
-            } else if (insn[s].id == MIPS_INS_JR &&
-                       insn[s].operands[0].reg == MIPS_REG_RA) {
-              // stop looking when previous `jr ra` is hit
-              break;
-            }
+          unsigned int rt = ops[i].reg[0];
+          int s = reg_track_find(&float_track, ids, rt, last_return);
+          if (s >= 0 && ids[s] == MIPS_INS_LUI) {
+            // link up the LUI with this instruction and the float bits
+            block->linked_insn[s] = i;
+            block->linked_value[s] = (uint32_t)ops[s].imm << 16;
+            // rewrite LUI instruction to be LI
+            ids[s] = MIPS_INS_LI;
           }
           break;
         }
@@ -415,47 +604,238 @@ static void disassemble_block(unsigned char *data, unsigned int length,
         case MIPS_INS_SWC1:
         case MIPS_INS_SWC2:
         case MIPS_INS_SWC3: {
-          unsigned int mem_rs = insn[i].operands[1].mem.base;
-          unsigned int mem_imm = (unsigned int)insn[i].operands[1].mem.disp;
-          link_with_lui(state, block_id, i, mem_rs, mem_imm);
+          unsigned int mem_rs = ops[i].reg[1];
+          unsigned int mem_imm = (unsigned int)ops[i].imm;
+          link_with_lui(state, block, i,
+                        reg_track_find(&hilo_track, ids, mem_rs, last_return),
+                        mem_imm);
           break;
         }
         case MIPS_INS_ADDIU:
         case MIPS_INS_ORI: {
-          unsigned int rd = insn[i].operands[0].reg;
-          unsigned int rs = insn[i].operands[1].reg;
-          int64_t imm = insn[i].operands[2].imm;
-          if (rs == MIPS_REG_ZERO) { // becomes LI
-            insn[i].id = MIPS_INS_LI;
-            strcpy(insn[i].mnemonic, "li");
-            // TODO: is there allocation for this?
-            sprintf(insn[i].op_str, "$%s, %" PRIi64,
-                    cs_reg_name(state->handle, rd), imm);
+          unsigned int rd = ops[i].reg[0];
+          unsigned int rs = ops[i].reg[1];
+          if (rs == MIPS_REG_ZERO) { // becomes LI, text generated in pass 2
+            ids[i] = MIPS_INS_LI;
           } else if (rd == rs) { // only look for LUI if rd and rs are the same
-            link_with_lui(state, block_id, i, rs, (unsigned int)imm);
+            link_with_lui(state, block, i,
+                          reg_track_find(&hilo_track, ids, rs, last_return),
+                          (unsigned int)ops[i].imm);
           }
           break;
         }
         }
+
+        // record register writes seen by later instructions
+        if (ids[i] == MIPS_INS_LUI) {
+          reg_track_write(&hilo_track, ops[i].reg[0], i);
+          reg_track_write(&float_track, ops[i].reg[0], i);
+        } else {
+          if (clobbers_hilo(ids[i])) {
+            reg_track_write(&hilo_track, ops[i].reg[0], i);
+          }
+          if (clobbers_float(ids[i])) {
+            reg_track_write(&float_track, ops[i].reg[0], i);
+          }
+        }
+        if (ids[i] == MIPS_INS_JR && ops[i].reg[0] == MIPS_REG_RA) {
+          last_return = i;
+        }
       }
     }
+    free(hilo_track.prev);
+    free(float_track.prev);
   } else {
     ERROR("Error: Failed to disassemble 0x%X bytes of code at 0x%08X\n",
           (unsigned int)length, vaddr);
   }
 }
 
+// pass 1 cache file layout: header, then per-instruction arrays (ids,
+// operands, flags, linked_insn, linked_value), local label vaddrs, and the
+// global label references to replay. raw words come from the ROM itself
+#define CACHE_MAGIC "MDC1"
+#define CACHE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t length;
+  uint32_t vaddr;
+  uint32_t instruction_count;
+  uint32_t local_count;
+  uint32_t ref_count;
+  uint32_t reserved;
+} cache_header;
+
+// key covering everything pass 1 output depends on
+static uint64_t cache_key(const disasm_state *state, const unsigned char *data,
+                          unsigned int length, unsigned int vaddr) {
+  uint32_t params[] = {
+      CACHE_VERSION,        length, vaddr, (uint32_t)state->syntax,
+      state->merge_pseudo, cs_version(NULL, NULL),
+  };
+  uint64_t key = fnv1a_64(MIPSDISASM_VERSION, strlen(MIPSDISASM_VERSION),
+                          FNV1A_64_INIT);
+  key = fnv1a_64(params, sizeof(params), key);
+  return fnv1a_64(data, length, key);
+}
+
+static void cache_filename(const disasm_state *state, uint64_t key,
+                           char *filename) {
+  sprintf(filename, "%s/%016" PRIX64 ".p1", state->cache_dir, key);
+}
+
+// write decoded instruction arrays and local label vaddrs of a block
+// returns 1 on success
+static int block_write(FILE *out, const asm_block *block) {
+  size_t n = block->instruction_count;
+  int ok = fwrite(block->ids, sizeof(*block->ids), n, out) == n &&
+           fwrite(block->operands, sizeof(*block->operands), n, out) == n &&
+           fwrite(block->flags, sizeof(*block->flags), n, out) == n &&
+           fwrite(block->linked_insn, sizeof(*block->linked_insn), n, out) ==
+               n &&
+           fwrite(block->linked_value, sizeof(*block->linked_value), n, out) ==
+               n;
+  for (int i = 0; ok && i < block->locals.count; i++) {
+    uint32_t vaddr = block->locals.labels[i].vaddr;
+    ok = fwrite(&vaddr, sizeof(vaddr), 1, out) == 1;
+  }
+  return ok;
+}
+
+// read back what block_write() wrote into an allocated block
+// returns 1 on success
+static int block_read(FILE *in, const disasm_state *state, asm_block *block,
+                      uint32_t local_count) {
+  size_t n = block->instruction_count;
+  int ok = fread(block->ids, sizeof(*block->ids), n, in) == n &&
+           fread(block->operands, sizeof(*block->operands), n, in) == n &&
+           fread(block->flags, sizeof(*block->flags), n, in) == n &&
+           fread(block->linked_insn, sizeof(*block->linked_insn), n, in) ==
+               n &&
+           fread(block->linked_value, sizeof(*block->linked_value), n, in) ==
+               n;
+  for (uint32_t i = 0; ok && i < local_count; i++) {
+    uint32_t vaddr;
+    ok = fread(&vaddr, sizeof(vaddr), 1, in) == 1;
+    if (ok) {
+      // already unique when written
+      locals_add(state, block, vaddr);
+    }
+  }
+  return ok;
+}
+
+// load a block from the cache
+// returns 1 if loaded, 0 if missing or stale
+static int cache_load(disasm_state *state, asm_block *block,
+                      const unsigned char *data, uint64_t key) {
+  char filename[FILENAME_MAX];
+  cache_header header;
+  FILE *in;
+  int n;
+  int ok;
+
+  cache_filename(state, key, filename);
+  in = fopen(filename, "rb");
+  if (in == NULL) {
+    return 0;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CACHE_VERSION || header.key != key ||
+      header.length != block->length || header.vaddr != block->vaddr ||
+      header.instruction_count != block->length / 4) {
+    fclose(in);
+    return 0;
+  }
+
+  n = header.instruction_count;
+  block_alloc_instructions(block, n);
+  for (int i = 0; i < n; i++) {
+    block->words[i] = read_u32_be(&data[i * 4]);
+  }
+  ok = block_read(in, state, block, header.local_count);
+  for (uint32_t i = 0; ok && i < header.ref_count; i++) {
+    global_ref ref;
+    ok = fread(&ref, sizeof(ref), 1, in) == 1;
+    if (ok) {
+      globals_reference(state, ref.kind, ref.vaddr);
+    }
+  }
+  fclose(in);
+
+  if (!ok) {
+    WARNING("Ignoring truncated disassembly cache '%s'\n", filename);
+    block_free_instructions(block);
+    block->locals.count = 0;
+    return 0;
+  }
+  return 1;
+}
+
+// store a freshly decoded block in the cache
+static void cache_save(const disasm_state *state, const asm_block *block,
+                       uint64_t key) {
+  char filename[FILENAME_MAX];
+  char tmp_filename[FILENAME_MAX + 4];
+  cache_header header = {0};
+  FILE *out;
+  int n = block->instruction_count;
+  int ok;
+
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.key = key;
+  header.length = block->length;
+  header.vaddr = block->vaddr;
+  header.instruction_count = n;
+  header.local_count = block->locals.count;
+  header.ref_count = state->ref_count;
+
+  // write to a temporary name so readers never see a partial file
+  cache_filename(state, key, filename);
+  sprintf(tmp_filename, "%s.tmp", filename);
+  out = fopen(tmp_filename, "wb");
+  if (out == NULL) {
+    WARNING("Cannot write disassembly cache '%s'\n", tmp_filename);
+    return;
+  }
+  ok = fwrite(&header, sizeof(header), 1, out) == 1 && block_write(out, block);
+  if (ok && state->ref_count > 0) {
+    ok = fwrite(state->refs, sizeof(*state->refs), state->ref_count, out) ==
+         (size_t)state->ref_count;
+  }
+  if (fclose(out) != 0 || !ok || rename(tmp_filename, filename) != 0) {
+    WARNING("Cannot write disassembly cache '%s'\n", filename);
+    remove(tmp_filename);
+  }
+}
+
 disasm_state *disasm_state_init(asm_syntax syntax, int merge_pseudo) {
   disasm_state *state = malloc(sizeof(*state));
   labels_alloc(&state->globals);
+  state->global_set = NULL;
+  state->global_set_size = 0;
+  state->global_set_count = 0;
+  state->globals_sorted = 1;
 
   state->block_count = 0;
   state->block_alloc = 128;
   state->blocks = malloc(sizeof(*state->blocks) * state->block_alloc);
+  state->block_index = NULL;
+  state->block_index_size = 0;
 
   state->syntax = syntax;
   state->merge_pseudo = merge_pseudo;
 
+  state->cache_dir = NULL;
+  state->refs = NULL;
+  state->ref_alloc = 0;
+  state->ref_count = 0;
+
   // open capstone disassembler
   if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN,
               &state->handle) != CS_ERR_OK) {
@@ -465,6 +845,21 @@ disasm_state *disasm_state_init(asm_syntax syntax, int merge_pseudo) {
   cs_option(state->handle, CS_OPT_DETAIL, CS_OPT_ON);
   cs_option(state->handle, CS_OPT_SKIPDATA, CS_OPT_ON);
 
+  // separate handle without detail for regenerating text in pass 2
+  if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN,
+              &state->text_handle) != CS_ERR_OK) {
+    ERROR("Error initializing disassembler\n");
+    exit(EXIT_FAILURE);
+  }
+  cs_option(state->text_handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+  state->text_insn = cs_malloc(state->text_handle);
+
+  // register names for pass 2 output
+  for (int i = 0; i < MIPS_REG_ENDING; i++) {
+    const char *name = cs_reg_name(state->handle, i);
+    state->reg_names[i] = name ? name : "";
+  }
+
   return state;
 }
 
@@ -476,10 +871,7 @@ void disasm_state_free(disasm_state *state) {
         free(state->blocks[i].locals.labels);
         state->blocks[i].locals.labels = NULL;
       }
-      if (state->blocks[i].instructions) {
-        free(state->blocks[i].instructions);
-        state->blocks[i].instructions = NULL;
-      }
+      block_free_instructions(&state->blocks[i]);
     }
     // Free the blocks array
     if (state->blocks) {
@@ -491,21 +883,177 @@ void disasm_state_free(disasm_state *state) {
       free(state->globals.labels);
       state->globals.labels = NULL;
     }
+    free(state->global_set);
+    free(state->block_index);
+    free(state->cache_dir);
+    free(state->refs);
+    cs_free(state->text_insn, 1);
+    cs_close(&state->text_handle);
     cs_close(&state->handle);
     // Free the state structure itself
     free(state);
   }
 }
 
+void disasm_set_cache_dir(disasm_state *state, const char *cache_dir) {
+  free(state->cache_dir);
+  state->cache_dir = NULL;
+  if (cache_dir != NULL) {
+    make_dir(cache_dir);
+    state->cache_dir = strdup(cache_dir);
+  }
+}
+
+// per-input index of all first pass results: header, global labels, then
+// for each block an index_block, raw words, and block_write() data
+#define INDEX_MAGIC "MDX1"
+#define INDEX_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t syntax;
+  uint32_t merge_pseudo;
+  uint32_t block_count;
+  uint32_t global_count;
+} index_header;
+
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+  uint32_t vaddr;
+  uint32_t instruction_count;
+  uint32_t local_count;
+  uint32_t reserved;
+} index_block;
+
+static uint64_t index_key(const unsigned char *data, long length) {
+  uint32_t capstone_version = cs_version(NULL, NULL);
+  uint64_t key = fnv1a_64(MIPSDISASM_VERSION, strlen(MIPSDISASM_VERSION),
+                          FNV1A_64_INIT);
+  key = fnv1a_64(&capstone_version, sizeof(capstone_version), key);
+  return fnv1a_64(data, length, key);
+}
+
+int disasm_index_save(const disasm_state *state, const unsigned char *data,
+                      long length, const char *filename) {
+  char tmp_filename[FILENAME_MAX + 4];
+  index_header header = {0};
+  FILE *out;
+  int ok;
+
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.key = index_key(data, length);
+  header.syntax = state->syntax;
+  header.merge_pseudo = state->merge_pseudo;
+  header.block_count = state->block_count;
+  header.global_count = state->globals.count;
+
+  // write to a temporary name so readers never see a partial file
+  sprintf(tmp_filename, "%s.tmp", filename);
+  out = fopen(tmp_filename, "wb");
+  if (out == NULL) {
+    WARNING("Cannot write disassembly index '%s'\n", tmp_filename);
+    return -1;
+  }
+  ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+       fwrite(state->globals.labels, sizeof(*state->globals.labels),
+              state->globals.count,
+              out) == (size_t)state->globals.count;
+  for (int i = 0; ok && i < state->block_count; i++) {
+    const asm_block *block = &state->blocks[i];
+    index_block info = {0};
+    info.offset = block->offset;
+    info.length = block->length;
+    info.vaddr = block->vaddr;
+    info.instruction_count = block->instruction_count;
+    info.local_count = block->locals.count;
+    ok = fwrite(&info, sizeof(info), 1, out) == 1 &&
+         fwrite(block->words, sizeof(*block->words), block->instruction_count,
+                out) == (size_t)block->instruction_count &&
+         block_write(out, block);
+  }
+  if (fclose(out) != 0 || !ok || rename(tmp_filename, filename) != 0) {
+    WARNING("Cannot write disassembly index '%s'\n", filename);
+    remove(tmp_filename);
+    return -1;
+  }
+  return 0;
+}
+
+disasm_state *disasm_index_load(const char *filename,
+                                const unsigned char *data, long length) {
+  disasm_state *state;
+  index_header header;
+  FILE *in;
+  int ok;
+
+  in = fopen(filename, "rb");
+  if (in == NULL) {
+    return NULL;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != INDEX_VERSION ||
+      (data != NULL && header.key != index_key(data, length)) ||
+      header.syntax > ASM_ARMIPS) {
+    fclose(in);
+    return NULL;
+  }
+
+  state = disasm_state_init(header.syntax, header.merge_pseudo);
+  ok = 1;
+  for (uint32_t i = 0; ok && i < header.global_count; i++) {
+    asm_label label;
+    ok = fread(&label, sizeof(label), 1, in) == 1;
+    if (ok) {
+      label.name[sizeof(label.name) - 1] = '\0';
+      globals_add(state, label.name, label.vaddr);
+    }
+  }
+  for (uint32_t i = 0; ok && i < header.block_count; i++) {
+    index_block info;
+    asm_block *block;
+    ok = fread(&info, sizeof(info), 1, in) == 1 &&
+         info.instruction_count == info.length / 4;
+    if (!ok) {
+      break;
+    }
+    block = block_new(state, info.offset, info.length, info.vaddr);
+    block_alloc_instructions(block, info.instruction_count);
+    state->block_count++;
+    ok = fread(block->words, sizeof(*block->words), info.instruction_count,
+               in) == info.instruction_count &&
+         block_read(in, state, block, info.local_count);
+    labels_sort(&block->locals);
+    block_index_add(state);
+  }
+  fclose(in);
+
+  if (!ok) {
+    WARNING("Ignoring invalid disassembly index '%s'\n", filename);
+    disasm_state_free(state);
+    return NULL;
+  }
+  globals_sort(state);
+  return state;
+}
+
 void disasm_label_add(disasm_state *state, const char *name,
                       unsigned int vaddr) {
-  labels_add(&state->globals, name, vaddr);
+  globals_add(state, name, vaddr);
 }
 
 int disasm_label_lookup(const disasm_state *state, unsigned int vaddr,
                         char *name) {
   int found = 0;
-  int id = labels_find(&state->globals, vaddr);
+  int id = -1;
+  if (globals_contains(state, vaddr)) {
+    id = state->globals_sorted ? labels_find_sorted(&state->globals, vaddr)
+                               : labels_find(&state->globals, vaddr);
+  }
   if (id >= 0) {
     strcpy(name, state->globals.labels[id].name);
     found = 1;
@@ -517,159 +1065,322 @@ int disasm_label_lookup(const disasm_state *state, unsigned int vaddr,
 void mipsdisasm_pass1(unsigned char *data, unsigned int offset,
                       unsigned int length, unsigned int vaddr,
                       disasm_state *state) {
-  if (state->block_count >= state->block_alloc) {
-    state->block_alloc *= 2;
-    state->blocks =
-        realloc(state->blocks, sizeof(*state->blocks) * state->block_alloc);
+  asm_block *block = block_new(state, offset, length, vaddr);
+
+  if (state->cache_dir) {
+    uint64_t key = cache_key(state, &data[offset], length, vaddr);
+    if (!cache_load(state, block, &data[offset], key)) {
+      // collect all branch and jump targets
+      state->ref_count = 0;
+      disassemble_block(&data[offset], length, vaddr, state,
+                        state->block_count);
+      cache_save(state, block, key);
+    } else {
+      DEBUG("Loaded 0x%X-0x%X from disassembly cache\n", offset,
+            offset + length);
+    }
+  } else {
+    // collect all branch and jump targets
+    disassemble_block(&data[offset], length, vaddr, state, state->block_count);
   }
-  asm_block *block = &state->blocks[state->block_count];
-  labels_alloc(&block->locals);
-  block->offset = offset;
-  block->length = length;
-  block->vaddr = vaddr;
-
-  // collect all branch and jump targets
-  disassemble_block(&data[offset], length, vaddr, state, state->block_count);
 
   // sort global and local labels
-  labels_sort(&state->globals);
+  globals_sort(state);
   labels_sort(&state->blocks[state->block_count].locals);
   state->block_count++;
+  block_index_add(state);
 }
 
-void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset) {
-  asm_block *block = NULL;
-  unsigned int vaddr;
+// buffered text writer for pass 2 - output is collected in large chunks and
+// handed to the FILE in a single fwrite() to avoid per-field stdio overhead
+#define OUT_BUF_SIZE (64 * 1024)
+
+typedef struct {
+  FILE *out;
+  size_t len;
+  char data[OUT_BUF_SIZE];
+} out_buf;
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static void out_flush(out_buf *buf) {
+  if (buf->len > 0) {
+    fwrite(buf->data, 1, buf->len, buf->out);
+    buf->len = 0;
+  }
+}
+
+// ensure at least 'size' bytes are free, size must be at most OUT_BUF_SIZE
+static char *out_reserve(out_buf *buf, size_t size) {
+  if (buf->len + size > OUT_BUF_SIZE) {
+    out_flush(buf);
+  }
+  return &buf->data[buf->len];
+}
+
+static void out_write(out_buf *buf, const char *str, size_t len) {
+  if (len > OUT_BUF_SIZE) {
+    out_flush(buf);
+    fwrite(str, 1, len, buf->out);
+    return;
+  }
+  memcpy(out_reserve(buf, len), str, len);
+  buf->len += len;
+}
+
+#define out_literal(buf, str) out_write(buf, str, sizeof(str) - 1)
+
+static void out_str(out_buf *buf, const char *str) {
+  out_write(buf, str, strlen(str));
+}
+
+static void out_char(out_buf *buf, char c) {
+  *out_reserve(buf, 1) = c;
+  buf->len++;
+}
+
+// uppercase hex, zero padded to at least 'digits' ("%0*X")
+static void out_hex(out_buf *buf, uint32_t value, int digits) {
+  while (digits < 8 && (value >> (4 * digits)) != 0) {
+    digits++;
+  }
+  char *dst = out_reserve(buf, digits);
+  for (int i = digits - 1; i >= 0; i--) {
+    dst[i] = hex_digits[value & 0xF];
+    value >>= 4;
+  }
+  buf->len += digits;
+}
+
+// "0x%08X"
+static void out_hex32(out_buf *buf, uint32_t value) {
+  out_literal(buf, "0x");
+  out_hex(buf, value, 8);
+}
+
+// "%-5s " - mnemonic padded to the operand column
+static void out_mnemonic(out_buf *buf, const char *mnemonic) {
+  size_t len = strlen(mnemonic);
+  out_write(buf, mnemonic, len);
+  for (; len < 5; len++) {
+    out_char(buf, ' ');
+  }
+  out_char(buf, ' ');
+}
+
+// "$name" from the precomputed register name table
+static void out_reg(out_buf *buf, const disasm_state *state, unsigned int reg) {
+  out_char(buf, '$');
+  out_str(buf, state->reg_names[reg]);
+}
+
+// formatted output for the less common cases
+static void out_printf(out_buf *buf, const char *format, ...) {
+  va_list args;
+  int len;
+  va_start(args, format);
+  len = vsnprintf(&buf->data[buf->len], OUT_BUF_SIZE - buf->len, format, args);
+  va_end(args);
+  if (len >= 0 && buf->len + len >= OUT_BUF_SIZE) {
+    out_flush(buf);
+    va_start(args, format);
+    len = vsnprintf(buf->data, OUT_BUF_SIZE, format, args);
+    va_end(args);
+  }
+  if (len > 0) {
+    buf->len += MIN((size_t)len, OUT_BUF_SIZE - 1 - buf->len);
+  }
+}
+
+// regenerate capstone text for a single instruction word
+// returns decoded instruction, valid until the next call
+static const cs_insn *insn_text(disasm_state *state, uint32_t word,
+                                unsigned int vaddr) {
+  uint8_t bytes[4];
+  const uint8_t *code = bytes;
+  size_t size = sizeof(bytes);
+  uint64_t address = vaddr;
+  write_u32_be(bytes, word);
+  if (!cs_disasm_iter(state->text_handle, &code, &size, &address,
+                      state->text_insn)) {
+    strcpy(state->text_insn->mnemonic, ".word");
+    sprintf(state->text_insn->op_str, "0x%08X", word);
+  }
+  return state->text_insn;
+}
+
+// N64 lacks these instructions, but capstone decodes them anyway
+static int invalid_n64_mnemonic(const char *mnemonic) {
+  return strncmp(mnemonic, "movf", 4) == 0 ||
+         strncmp(mnemonic, "lsa", 4) == 0 ||
+         strncmp(mnemonic, "dlsa", 4) == 0 ||
+         strncmp(mnemonic, "movn", 4) == 0 ||
+         strncmp(mnemonic, "ext", 4) == 0 ||
+         strncmp(mnemonic, "movt", 4) == 0 ||
+         strncmp(mnemonic, "movz", 4) == 0 ||
+         strncmp(mnemonic, "bbit", 4) == 0 ||
+         strncmp(mnemonic, "pref", 4) == 0 ||
+         strncmp(mnemonic, "synci", 5) == 0 ||
+         strncmp(mnemonic, "ld.b", 4) == 0 ||
+         strncmp(mnemonic, "ori.b", 4) == 0 ||
+         strncmp(mnemonic, "pause", 4) == 0 ||
+         strncmp(mnemonic, "rotr", 4) == 0 ||
+         strncmp(mnemonic, "madd", 4) == 0 ||
+         strncmp(mnemonic, "nmsub", 5) == 0 ||
+         strncmp(mnemonic, "mz.", 3) == 0 ||
+         strncmp(mnemonic, "bc0", 3) == 0 ||
+         strncmp(mnemonic, "dmtc", 4) == 0 ||
+         strncmp(mnemonic, "sync", 4) == 0 ||
+         strncmp(mnemonic, "bseli", 5) == 0 ||
+         strncmp(mnemonic, "bnz.", 4) == 0 ||
+         strncmp(mnemonic, "snei", 4) == 0 ||
+         strncmp(mnemonic, "cle_s.", 6) == 0 ||
+         strncmp(mnemonic, "bz.", 3) == 0 ||
+         strncmp(mnemonic, "msub.", 5) == 0 ||
+         strncmp(mnemonic, "shrav.", 5) == 0 ||
+         strncmp(mnemonic, "din", 3) == 0 ||
+         strncmp(mnemonic, "cins", 4) == 0 ||
+         strncmp(mnemonic, "st.", 3) == 0 ||
+         strncmp(mnemonic, "shra", 4) == 0 ||
+         strncmp(mnemonic, "dextm", 5) == 0 ||
+         strncmp(mnemonic, "srl.", 4) == 0 ||
+         strncmp(mnemonic, "bc1", 3) == 0 ||
+         strncmp(mnemonic, "sra.", 4) == 0 ||
+         strncmp(mnemonic, "fmul.", 4) == 0 ||
+         strncmp(mnemonic, "dextu", 5) == 0;
+}
+
+// output instructions [first, last) of a block as assembly text
+static void block_emit(out_buf *buf, disasm_state *state, asm_block *block,
+                       int first, int last) {
+  unsigned int offset = block->offset + 4 * first;
+  unsigned int vaddr = block->vaddr + 4 * first;
   int local_idx = 0;
   int global_idx = 0;
   int label;
   int indent = 0;
-  // lookup block by offset
-  for (int i = 0; i < state->block_count; i++) {
-    if (state->blocks[i].offset == offset) {
-      block = &state->blocks[i];
-      break;
+  const char *comment = state->syntax == ASM_GAS ? " # " : " // ";
+  char previous_instruction[32] = "";
+  // skip labels before the first instruction
+  if (first == 0) {
+    while ((global_idx < state->globals.count) &&
+           (vaddr > state->globals.labels[global_idx].vaddr)) {
+      global_idx++;
     }
+    while ((local_idx < block->locals.count) &&
+           (vaddr > block->locals.labels[local_idx].vaddr)) {
+      local_idx++;
+    }
+  } else {
+    global_idx = labels_lower_bound(&state->globals, vaddr);
+    local_idx = labels_lower_bound(&block->locals, vaddr);
+    // pick up output state left by the previous instruction
+    const char *previous = "li";
+    indent = block->flags[first - 1] & INSN_JUMP;
+    if (block->ids[first - 1] != MIPS_INS_LI) {
+      previous =
+          insn_text(state, block->words[first - 1], vaddr - 4)->mnemonic;
+    }
+    if (invalid_n64_mnemonic(previous)) {
+      previous = ".byte";
+    }
+    snprintf(previous_instruction, sizeof(previous_instruction), "%s",
+             previous);
   }
-  if (!block) {
-    ERROR("Could not find block offset 0x%X\n", offset);
-    exit(1);
-  }
-  vaddr = block->vaddr;
-  // skip labels before this section
-  while ((global_idx < state->globals.count) &&
-         (vaddr > state->globals.labels[global_idx].vaddr)) {
-    global_idx++;
-  }
-  while ((local_idx < block->locals.count) &&
-         (vaddr > block->locals.labels[local_idx].vaddr)) {
-    local_idx++;
-  }
-  char previous_instruction[16];
-  for (int i = 0; i < block->instruction_count; i++) {
-    disasm_data *insn = &block->instructions[i];
+  for (int i = first; i < last; i++) {
+    const insn_operands *ops = &block->operands[i];
+    unsigned int id = block->ids[i];
+    uint32_t word = block->words[i];
+    const cs_insn *text = insn_text(state, word, vaddr);
+    const char *mnemonic = text->mnemonic;
+    const char *op_str = text->op_str;
+    char li_op_str[64];
+    if (id == MIPS_INS_LI) {
+      // pseudo rewritten in pass 1
+      mnemonic = "li";
+      if (block->linked_insn[i] < 0) {
+        sprintf(li_op_str, "$%s, %" PRIi32, state->reg_names[ops->reg[0]],
+                ops->imm);
+        op_str = li_op_str;
+      }
+    }
     // newline between functions
-    if (insn->newline) {
-      fprintf(out, "\n");
+    if (block->flags[i] & INSN_NEWLINE) {
+      out_char(buf, '\n');
     }
     // insert all global labels at this address
     while ((global_idx < state->globals.count) &&
            (vaddr == state->globals.labels[global_idx].vaddr)) {
-      fprintf(out, "%s:\n", state->globals.labels[global_idx].name);
+      out_str(buf, state->globals.labels[global_idx].name);
+      out_literal(buf, ":\n");
       global_idx++;
     }
     // insert all local labels at this address
     while ((local_idx < block->locals.count) &&
            (vaddr == block->locals.labels[local_idx].vaddr)) {
-      fprintf(out, "%s:\n", block->locals.labels[local_idx].name);
+      out_str(buf, block->locals.labels[local_idx].name);
+      out_literal(buf, ":\n");
       local_idx++;
     }
     // write out bytes as comment
-    fprintf(out, "/* %06X %08X %02X%02X%02X%02X */  ", offset, vaddr,
-            insn->bytes[0], insn->bytes[1], insn->bytes[2], insn->bytes[3]);
+    out_literal(buf, "/* ");
+    out_hex(buf, offset, 6);
+    out_char(buf, ' ');
+    out_hex(buf, vaddr, 8);
+    out_char(buf, ' ');
+    out_hex(buf, word, 8);
+    out_literal(buf, " */  ");
     // indent the lines after a jump or branch
     if (indent) {
       indent = 0;
-      fputc(' ', out);
+      out_char(buf, ' ');
     }
-    if (strncmp(insn->mnemonic, "movf", 4) == 0 ||
-        strncmp(insn->mnemonic, "lsa", 4) == 0 ||
-        strncmp(insn->mnemonic, "dlsa", 4) == 0 ||
-        strncmp(insn->mnemonic, "movn", 4) == 0 ||
-        strncmp(insn->mnemonic, "ext", 4) == 0 ||
-        strncmp(insn->mnemonic, "movt", 4) == 0 ||
-        strncmp(insn->mnemonic, "movz", 4) == 0 ||
-        strncmp(insn->mnemonic, "bbit", 4) == 0 ||
-        strncmp(insn->mnemonic, "pref", 4) == 0 ||
-        strncmp(insn->mnemonic, "synci", 5) == 0 ||
-        strncmp(insn->mnemonic, "ld.b", 4) == 0 ||
-        strncmp(insn->mnemonic, "ori.b", 4) == 0 ||
-        strncmp(insn->mnemonic, "pause", 4) == 0 ||
-        strncmp(insn->mnemonic, "rotr", 4) == 0 ||
-        strncmp(insn->mnemonic, "madd", 4) == 0 ||
-        strncmp(insn->mnemonic, "nmsub", 5) == 0 ||
-        strncmp(insn->mnemonic, "mz.", 3) == 0 ||
-        strncmp(insn->mnemonic, "bc0", 3) == 0 ||
-        strncmp(insn->mnemonic, "dmtc", 4) == 0 ||
-        strncmp(insn->mnemonic, "sync", 4) == 0 ||
-        strncmp(insn->mnemonic, "bseli", 5) == 0 ||
-        strncmp(insn->mnemonic, "bnz.", 4) == 0 ||
-        strncmp(insn->mnemonic, "snei", 4) == 0 ||
-        strncmp(insn->mnemonic, "cle_s.", 6) == 0 ||
-        strncmp(insn->mnemonic, "bz.", 3) == 0 ||
-        strncmp(insn->mnemonic, "msub.", 5) == 0 ||
-        strncmp(insn->mnemonic, "shrav.", 5) == 0 ||
-        strncmp(insn->mnemonic, "din", 3) == 0 ||
-        strncmp(insn->mnemonic, "cins", 4) == 0 ||
-        strncmp(insn->mnemonic, "st.", 3) == 0 ||
-        strncmp(insn->mnemonic, "shra", 4) == 0 ||
-        strncmp(insn->mnemonic, "dextm", 5) == 0 ||
-        strncmp(insn->mnemonic, "srl.", 4) == 0 ||
-        strncmp(insn->mnemonic, "bc1", 3) == 0 ||
-        strncmp(insn->mnemonic, "sra.", 4) == 0 ||
-        strncmp(insn->mnemonic, "fmul.", 4) == 0 ||
-        strncmp(insn->mnemonic, "dextu", 5) == 0) {
+    if (invalid_n64_mnemonic(mnemonic)) {
       // These instructions aren't supported on the N64 but capstone didn't know
       // that
-      fprintf(out,
-              ".byte 0x%02X,0x%02X,0x%02X,0x%02X /* Because of invalid n64 "
-              "opcode %s */\n",
-              insn->bytes[0], insn->bytes[1], insn->bytes[2], insn->bytes[3],
-              insn->mnemonic);
-      strcpy(insn->mnemonic, ".byte");
+      out_literal(buf, ".byte ");
+      for (int b = 24; b >= 0; b -= 8) {
+        out_literal(buf, "0x");
+        out_hex(buf, (word >> b) & 0xFF, 2);
+        if (b > 0) {
+          out_char(buf, ',');
+        }
+      }
+      out_literal(buf, " /* Because of invalid n64 opcode ");
+      out_str(buf, mnemonic);
+      out_literal(buf, " */\n");
+      mnemonic = ".byte";
     } else if (strncmp(previous_instruction, ".byte", 4) == 0) {
       // fprintf(out, ".byte 0x%02X,0x%02X,0x%02X,0x%02X /* Because previous was
-      // .byte */\n", insn->bytes[0], insn->bytes[1], insn->bytes[2],
-      // insn->bytes[3]); strcpy(insn->mnemonic, ".byte");
-    } else if (insn->is_jump) {
+      // .byte */\n", word >> 24, (word >> 16) & 0xFF, (word >> 8) & 0xFF,
+      // word & 0xFF); mnemonic = ".byte";
+    } else if (block->flags[i] & INSN_JUMP) {
       indent = 1;
-      fprintf(out, "%-5s ", insn->mnemonic);
-      if (insn->id == MIPS_INS_JAL || insn->id == MIPS_INS_BAL ||
-          insn->id == MIPS_INS_J) {
-        unsigned int jal_target = (unsigned int)insn->operands[0].imm;
-        label = labels_find(&state->globals, jal_target);
+      out_mnemonic(buf, mnemonic);
+      if (id == MIPS_INS_JAL || id == MIPS_INS_BAL || id == MIPS_INS_J) {
+        unsigned int jal_target = (unsigned int)ops->imm;
+        label = labels_find_sorted(&state->globals, jal_target);
         if (label >= 0) {
-          fprintf(out, "%s\n", state->globals.labels[label].name);
+          out_str(buf, state->globals.labels[label].name);
         } else {
-          fprintf(out, "0x%08X\n", jal_target);
+          out_hex32(buf, jal_target);
         }
       } else {
-        for (int o = 0; o < insn->op_count; o++) {
+        for (int o = 0; o < ops->op_count; o++) {
           if (o > 0) {
-            fprintf(out, ", ");
+            out_literal(buf, ", ");
           }
-          switch (insn->operands[o].type) {
+          switch (ops->type[o]) {
           case MIPS_OP_REG:
-            fprintf(out, "$%s",
-                    cs_reg_name(state->handle, insn->operands[o].reg));
+            out_reg(buf, state, ops->reg[o]);
             break;
           case MIPS_OP_IMM: {
-            unsigned int branch_target = (unsigned int)insn->operands[o].imm;
-            label = labels_find(&block->locals, branch_target);
+            unsigned int branch_target = (unsigned int)ops->imm;
+            label = labels_find_sorted(&block->locals, branch_target);
             if (label >= 0) {
-              fprintf(out, "%s", block->locals.labels[label].name);
+              out_str(buf, block->locals.labels[label].name);
             } else {
-              fprintf(out, "0x%08X", branch_target);
+              out_hex32(buf, branch_target);
             }
             break;
           }
@@ -677,157 +1388,440 @@ void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset) {
             break;
           }
         }
-        fprintf(out, "\n");
       }
-    } else if (insn->id == MIPS_INS_MTC0 || insn->id == MIPS_INS_MFC0) {
+      out_char(buf, '\n');
+    } else if (id == MIPS_INS_MTC0 || id == MIPS_INS_MFC0) {
       // workaround bug in capstone/LLVM
-      unsigned char rd;
-      // 31-24 23-16 15-8 7-0
-      // 0     1     2    3
       //       31-26  25-21 20-16 15-11 10-0
       // mfc0: 010000 00000   rt    rd  00000000000
       // mtc0: 010000 00100   rt    rd  00000000000
       //       010000 00100 00000 11101 000 0000 0000
-      // rt = insn->bytes[1] & 0x1F;
-      rd = (insn->bytes[2] & 0xF8) >> 3;
-      fprintf(out, "%-5s $%s, $%d\n", insn->mnemonic,
-              cs_reg_name(state->handle, insn->operands[0].reg), rd);
+      unsigned char rd = (word >> 11) & 0x1F;
+      out_mnemonic(buf, mnemonic);
+      out_reg(buf, state, ops->reg[0]);
+      out_printf(buf, ", $%d\n", rd);
     } else {
-      int linked_insn = insn->linked_insn;
+      int linked_insn = block->linked_insn[i];
+      unsigned int linked_value = block->linked_value[i];
       if (linked_insn >= 0) {
-        if (insn->id == MIPS_INS_LI) {
+        if (id == MIPS_INS_LI) {
           // assume this is LUI converted to LI for matched MTC1
-          fprintf(out, "%-5s ", insn->mnemonic);
-
-          // Get hex representation of the float
-          uint32_t float_bits;
-          memcpy(&float_bits, &insn->linked_float, sizeof(float_bits));
-
-          switch (state->syntax) {
-          case ASM_GAS:
-            // Handle special values explicitly
-            if (insn->linked_float == 0.0f)
-              fprintf(out, "$%s, 0.0 # 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      float_bits);
-            else if (insn->linked_float == 1.0f)
-              fprintf(out, "$%s, 1.0 # 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      float_bits);
-            else {
-              // Use %g format for compact representation without trailing zeros
-              fprintf(out, "$%s, %g # 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      insn->linked_float, float_bits);
-            }
-            break;
-          case ASM_ARMIPS:
-            // Handle special values explicitly
-            if (insn->linked_float == 0.0f)
-              fprintf(out, "$%s, 0.0 // 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      float_bits);
-            else if (insn->linked_float == 1.0f)
-              fprintf(out, "$%s, 1.0 // 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      float_bits);
-            else {
-              // Use %g format for compact representation without trailing zeros
-              fprintf(out, "$%s, %g // 0x%08X\n",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      insn->linked_float, float_bits);
-            }
-            break;
+          float linked_float;
+          memcpy(&linked_float, &linked_value, sizeof(linked_float));
+          out_mnemonic(buf, mnemonic);
+          out_reg(buf, state, ops->reg[0]);
+          // Handle special values explicitly
+          if (linked_float == 0.0f) {
+            out_literal(buf, ", 0.0");
+          } else if (linked_float == 1.0f) {
+            out_literal(buf, ", 1.0");
+          } else {
+            // Use %g format for compact representation without trailing zeros
+            out_printf(buf, ", %g", linked_float);
           }
-        } else if (insn->id == MIPS_INS_LUI) {
-          label = labels_find(&state->globals, insn->linked_value);
+          out_str(buf, comment);
+          out_hex32(buf, linked_value);
+        } else if (id == MIPS_INS_LUI) {
+          label = labels_find_sorted(&state->globals, linked_value);
           // assume matched LUI with ADDIU/LW/SW etc.
           switch (state->syntax) {
           case ASM_GAS:
-            switch (block->instructions[linked_insn].id) {
-            case MIPS_INS_ADDIU:
-              fprintf(out, "%-5s $%s, %%hi(%s) # %s\n", insn->mnemonic,
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      state->globals.labels[label].name, insn->op_str);
-              break;
-            case MIPS_INS_ORI:
-              fprintf(out, "%-5s $%s, (0x%08X >> 16) # %s %s\n", insn->mnemonic,
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      insn->linked_value, insn->mnemonic, insn->op_str);
-              break;
-            default: // LW/SW/etc.
-              fprintf(out, "%-5s $%s, %%hi(%s) # %s\n", insn->mnemonic,
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      state->globals.labels[label].name, insn->op_str);
-              break;
+            out_mnemonic(buf, mnemonic);
+            out_reg(buf, state, ops->reg[0]);
+            if (block->ids[linked_insn] == MIPS_INS_ORI) {
+              out_literal(buf, ", (");
+              out_hex32(buf, linked_value);
+              out_literal(buf, " >> 16) # ");
+              out_str(buf, mnemonic);
+              out_char(buf, ' ');
+            } else { // ADDIU/LW/SW/etc.
+              out_literal(buf, ", %hi(");
+              out_str(buf, state->globals.labels[label].name);
+              out_literal(buf, ") # ");
             }
+            out_str(buf, op_str);
             break;
           case ASM_ARMIPS:
-            switch (block->instructions[linked_insn].id) {
+            switch (block->ids[linked_insn]) {
             case MIPS_INS_ADDIU:
-              fprintf(out, "%-5s $%s, %s // %s %s\n", "la.u",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      state->globals.labels[label].name, insn->mnemonic,
-                      insn->op_str);
+              out_mnemonic(buf, "la.u");
+              out_reg(buf, state, ops->reg[0]);
+              out_literal(buf, ", ");
+              out_str(buf, state->globals.labels[label].name);
               break;
             case MIPS_INS_ORI:
-              fprintf(out, "%-5s $%s, 0x%08X // %s %s\n", "li.u",
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      insn->linked_value, insn->mnemonic, insn->op_str);
+              out_mnemonic(buf, "li.u");
+              out_reg(buf, state, ops->reg[0]);
+              out_literal(buf, ", ");
+              out_hex32(buf, linked_value);
               break;
             default: // LW/SW/etc.
-              fprintf(out, "%-5s $%s, hi(%s) // %s\n", insn->mnemonic,
-                      cs_reg_name(state->handle, insn->operands[0].reg),
-                      state->globals.labels[label].name, insn->op_str);
+              out_mnemonic(buf, mnemonic);
+              out_reg(buf, state, ops->reg[0]);
+              out_literal(buf, ", hi(");
+              out_str(buf, state->globals.labels[label].name);
+              out_literal(buf, ") // ");
+              out_str(buf, op_str);
               break;
             }
+            if (block->ids[linked_insn] == MIPS_INS_ADDIU ||
+                block->ids[linked_insn] == MIPS_INS_ORI) {
+              out_literal(buf, " // ");
+              out_str(buf, mnemonic);
+              out_char(buf, ' ');
+              out_str(buf, op_str);
+            }
             break;
           }
-        } else if (insn->id == MIPS_INS_ADDIU) {
-          label = labels_find(&state->globals, insn->linked_value);
+        } else if (id == MIPS_INS_ADDIU) {
+          label = labels_find_sorted(&state->globals, linked_value);
           switch (state->syntax) {
           case ASM_GAS:
-            fprintf(out, "%-5s $%s, %%lo(%s) # %s %s\n", insn->mnemonic,
-                    cs_reg_name(state->handle, insn->operands[0].reg),
-                    state->globals.labels[label].name, insn->mnemonic,
-                    insn->op_str);
+            out_mnemonic(buf, mnemonic);
+            out_reg(buf, state, ops->reg[0]);
+            out_literal(buf, ", %lo(");
+            out_str(buf, state->globals.labels[label].name);
+            out_char(buf, ')');
             break;
           case ASM_ARMIPS:
-            fprintf(out, "%-5s $%s, %s // %s %s\n", "la.l",
-                    cs_reg_name(state->handle, insn->operands[0].reg),
-                    state->globals.labels[label].name, insn->mnemonic,
-                    insn->op_str);
+            out_mnemonic(buf, "la.l");
+            out_reg(buf, state, ops->reg[0]);
+            out_literal(buf, ", ");
+            out_str(buf, state->globals.labels[label].name);
             break;
           }
-        } else if (insn->id == MIPS_INS_ORI) {
+          out_str(buf, comment);
+          out_str(buf, mnemonic);
+          out_char(buf, ' ');
+          out_str(buf, op_str);
+        } else if (id == MIPS_INS_ORI) {
           switch (state->syntax) {
           case ASM_GAS:
-            fprintf(out, "%-5s $%s, (0x%08X & 0xFFFF) # %s %s\n",
-                    insn->mnemonic,
-                    cs_reg_name(state->handle, insn->operands[0].reg),
-                    insn->linked_value, insn->mnemonic, insn->op_str);
+            out_mnemonic(buf, mnemonic);
+            out_reg(buf, state, ops->reg[0]);
+            out_literal(buf, ", (");
+            out_hex32(buf, linked_value);
+            out_literal(buf, " & 0xFFFF)");
             break;
           case ASM_ARMIPS:
-            fprintf(out, "%-5s $%s, 0x%08X // %s %s\n", "li.l",
-                    cs_reg_name(state->handle, insn->operands[0].reg),
-                    insn->linked_value, insn->mnemonic, insn->op_str);
+            out_mnemonic(buf, "li.l");
+            out_reg(buf, state, ops->reg[0]);
+            out_literal(buf, ", ");
+            out_hex32(buf, linked_value);
             break;
           }
+          out_str(buf, comment);
+          out_str(buf, mnemonic);
+          out_char(buf, ' ');
+          out_str(buf, op_str);
         } else {
-          label = labels_find(&state->globals, insn->linked_value);
-          fprintf(out, "%-5s $%s, %slo(%s)($%s)\n", insn->mnemonic,
-                  cs_reg_name(state->handle, insn->operands[0].reg),
-                  state->syntax == ASM_GAS ? "%" : "",
-                  state->globals.labels[label].name,
-                  cs_reg_name(state->handle, insn->operands[1].reg));
+          label = labels_find_sorted(&state->globals, linked_value);
+          out_mnemonic(buf, mnemonic);
+          out_reg(buf, state, ops->reg[0]);
+          out_str(buf, state->syntax == ASM_GAS ? ", %lo(" : ", lo(");
+          out_str(buf, state->globals.labels[label].name);
+          out_literal(buf, ")(");
+          out_reg(buf, state, ops->reg[1]);
+          out_char(buf, ')');
         }
       } else {
-        fprintf(out, "%-5s %s\n", insn->mnemonic, insn->op_str);
+        out_mnemonic(buf, mnemonic);
+        out_str(buf, op_str);
       }
+      out_char(buf, '\n');
     }
     vaddr += 4;
     offset += 4;
-    strcpy(previous_instruction, insn->mnemonic);
+    strcpy(previous_instruction, mnemonic);
+  }
+}
+
+void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset) {
+  asm_block *block;
+  out_buf *buf;
+  // labels added since the last pass 1 block
+  globals_sort(state);
+  // lookup block by offset
+  block = block_lookup(state, offset);
+  if (!block) {
+    ERROR("Could not find block offset 0x%X\n", offset);
+    exit(1);
+  }
+  buf = malloc(sizeof(*buf));
+  buf->out = out;
+  buf->len = 0;
+  block_emit(buf, state, block, 0, block->instruction_count);
+  out_flush(buf);
+  free(buf);
+}
+
+// true if instruction idx begins a basic block: function boundary, label, or
+// first instruction after a branch delay slot
+static int block_starts_at(const disasm_state *state, const asm_block *block,
+                           int idx) {
+  unsigned int vaddr = block->vaddr + 4 * idx;
+  return idx == 0 || (block->flags[idx] & INSN_NEWLINE) ||
+         (idx >= 2 && (block->flags[idx - 2] & INSN_JUMP)) ||
+         labels_find_sorted(&block->locals, vaddr) >= 0 ||
+         labels_find_sorted(&state->globals, vaddr) >= 0;
+}
+
+int mipsdisasm_pass2_range(FILE *out, disasm_state *state,
+                           unsigned int start_vaddr, unsigned int end_vaddr) {
+  out_buf *buf = malloc(sizeof(*buf));
+  int count = 0;
+  globals_sort(state);
+  buf->out = out;
+  buf->len = 0;
+  for (int b = 0; b < state->block_count; b++) {
+    asm_block *block = &state->blocks[b];
+    unsigned int block_end = block->vaddr + 4 * block->instruction_count;
+    int first, last;
+    if (end_vaddr <= block->vaddr || start_vaddr >= block_end) {
+      continue;
+    }
+    first = (MAX(start_vaddr, block->vaddr) - block->vaddr) / 4;
+    last = (MIN(end_vaddr, block_end) - block->vaddr + 3) / 4;
+    // widen to the containing basic blocks
+    while (!block_starts_at(state, block, first)) {
+      first--;
+    }
+    while (last < block->instruction_count &&
+           !block_starts_at(state, block, last)) {
+      last++;
+    }
+    block_emit(buf, state, block, first, last);
+    count += last - first;
+  }
+  out_flush(buf);
+  free(buf);
+  return count;
+}
+
+// iterate over the global then local labels at each instruction address,
+// in the same order pass 2 emits them
+typedef struct {
+  int global_idx;
+  int local_idx;
+} label_cursor;
+
+// returns next label name at vaddr, NULL when there are no more
+static const char *label_cursor_next(label_cursor *cursor,
+                                     const disasm_state *state,
+                                     const asm_block *block,
+                                     unsigned int vaddr) {
+  const label_buf *globals = &state->globals;
+  const label_buf *locals = &block->locals;
+  while (cursor->global_idx < globals->count &&
+         globals->labels[cursor->global_idx].vaddr < vaddr) {
+    cursor->global_idx++;
+  }
+  if (cursor->global_idx < globals->count &&
+      globals->labels[cursor->global_idx].vaddr == vaddr) {
+    return globals->labels[cursor->global_idx++].name;
+  }
+  while (cursor->local_idx < locals->count &&
+         locals->labels[cursor->local_idx].vaddr < vaddr) {
+    cursor->local_idx++;
+  }
+  if (cursor->local_idx < locals->count &&
+      locals->labels[cursor->local_idx].vaddr == vaddr) {
+    return locals->labels[cursor->local_idx++].name;
+  }
+  return NULL;
+}
+
+static void out_uint(out_buf *buf, uint32_t value) {
+  char digits[10];
+  int len = 0;
+  do {
+    digits[len++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  char *dst = out_reserve(buf, len);
+  for (int i = 0; i < len; i++) {
+    dst[i] = digits[len - 1 - i];
+  }
+  buf->len += len;
+}
+
+static void out_int(out_buf *buf, int32_t value) {
+  if (value < 0) {
+    out_char(buf, '-');
+    out_uint(buf, -(uint32_t)value);
+  } else {
+    out_uint(buf, value);
+  }
+}
+
+// quoted and escaped JSON string
+static void out_json_str(out_buf *buf, const char *str) {
+  out_char(buf, '"');
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\') {
+      out_char(buf, '\\');
+      out_char(buf, c);
+    } else if (c < 0x20) {
+      out_literal(buf, "\\u00");
+      out_hex(buf, c, 2);
+    } else {
+      out_char(buf, c);
+    }
+  }
+  out_char(buf, '"');
+}
+
+static void export_jsonl(FILE *out, disasm_state *state, asm_block *block) {
+  out_buf *buf = malloc(sizeof(*buf));
+  label_cursor cursor = {0, 0};
+  buf->out = out;
+  buf->len = 0;
+  for (int i = 0; i < block->instruction_count; i++) {
+    const insn_operands *ops = &block->operands[i];
+    unsigned int vaddr = block->vaddr + 4 * i;
+    const char *name = cs_insn_name(state->handle, block->ids[i]);
+    const char *label;
+
+    out_literal(buf, "{\"offset\":");
+    out_uint(buf, block->offset + 4 * i);
+    out_literal(buf, ",\"vaddr\":");
+    out_uint(buf, vaddr);
+    out_literal(buf, ",\"word\":");
+    out_uint(buf, block->words[i]);
+    out_literal(buf, ",\"id\":");
+    out_uint(buf, block->ids[i]);
+    out_literal(buf, ",\"insn\":");
+    out_json_str(buf, name ? name : "");
+    out_literal(buf, ",\"operands\":[");
+    for (int o = 0; o < ops->op_count; o++) {
+      if (o > 0) {
+        out_char(buf, ',');
+      }
+      switch (ops->type[o]) {
+      case MIPS_OP_REG:
+        out_literal(buf, "{\"reg\":");
+        out_json_str(buf, state->reg_names[ops->reg[o]]);
+        break;
+      case MIPS_OP_IMM:
+        out_literal(buf, "{\"imm\":");
+        out_int(buf, ops->imm);
+        break;
+      case MIPS_OP_MEM:
+        out_literal(buf, "{\"base\":");
+        out_json_str(buf, state->reg_names[ops->reg[o]]);
+        out_literal(buf, ",\"disp\":");
+        out_int(buf, ops->imm);
+        break;
+      default:
+        out_char(buf, '{');
+        break;
+      }
+      out_char(buf, '}');
+    }
+    out_literal(buf, "],\"jump\":");
+    if (block->flags[i] & INSN_JUMP) {
+      out_literal(buf, "true");
+    } else {
+      out_literal(buf, "false");
+    }
+    out_literal(buf, ",\"newline\":");
+    if (block->flags[i] & INSN_NEWLINE) {
+      out_literal(buf, "true");
+    } else {
+      out_literal(buf, "false");
+    }
+    out_literal(buf, ",\"linked\":");
+    if (block->linked_insn[i] >= 0) {
+      out_literal(buf, "{\"vaddr\":");
+      out_uint(buf, block->vaddr + 4 * block->linked_insn[i]);
+      out_literal(buf, ",\"value\":");
+      out_uint(buf, block->linked_value[i]);
+      out_char(buf, '}');
+    } else {
+      out_literal(buf, "null");
+    }
+    out_literal(buf, ",\"labels\":[");
+    for (int l = 0;
+         (label = label_cursor_next(&cursor, state, block, vaddr)) != NULL;
+         l++) {
+      if (l > 0) {
+        out_char(buf, ',');
+      }
+      out_json_str(buf, label);
+    }
+    out_literal(buf, "]}\n");
+  }
+  out_flush(buf);
+  free(buf);
+}
+
+static void export_binary(FILE *out, disasm_state *state, asm_block *block) {
+  disasm_ir_header header;
+  disasm_ir_record *records;
+  char *strings = NULL;
+  size_t strings_size = 0;
+  size_t strings_alloc = 0;
+  label_cursor cursor = {0, 0};
+  int n = block->instruction_count;
+
+  records = calloc(MAX(n, 1), sizeof(*records));
+  for (int i = 0; i < n; i++) {
+    disasm_ir_record *rec = &records[i];
+    const insn_operands *ops = &block->operands[i];
+    const char *label;
+    rec->vaddr = block->vaddr + 4 * i;
+    rec->word = block->words[i];
+    rec->id = block->ids[i];
+    rec->flags = block->flags[i];
+    rec->op_count = ops->op_count;
+    memcpy(rec->op_type, ops->type, sizeof(rec->op_type));
+    memcpy(rec->op_reg, ops->reg, sizeof(rec->op_reg));
+    rec->imm = ops->imm;
+    rec->linked_insn = block->linked_insn[i];
+    rec->linked_value = block->linked_value[i];
+    rec->label = (uint32_t)strings_size;
+    while ((label = label_cursor_next(&cursor, state, block, rec->vaddr))) {
+      size_t len = strlen(label) + 1;
+      if (strings_size + len > strings_alloc) {
+        strings_alloc = MAX(2 * strings_alloc, strings_size + len + 4096);
+        strings = realloc(strings, strings_alloc);
+      }
+      memcpy(&strings[strings_size], label, len);
+      strings_size += len;
+      rec->label_count++;
+    }
+  }
+
+  memcpy(header.magic, DISASM_IR_MAGIC, sizeof(header.magic));
+  header.version = DISASM_IR_VERSION;
+  header.offset = block->offset;
+  header.vaddr = block->vaddr;
+  header.record_count = n;
+  header.strings_size = (uint32_t)strings_size;
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(records, sizeof(*records), n, out);
+  if (strings_size > 0) {
+    fwrite(strings, 1, strings_size, out);
+  }
+  free(strings);
+  free(records);
+}
+
+void mipsdisasm_export(FILE *out, disasm_state *state, unsigned int offset,
+                       disasm_export_format format) {
+  asm_block *block = block_lookup(state, offset);
+  if (!block) {
+    ERROR("Could not find block offset 0x%X\n", offset);
+    exit(1);
+  }
+  switch (format) {
+  case DISASM_EXPORT_JSONL:
+    export_jsonl(out, state, block);
+    break;
+  case DISASM_EXPORT_BINARY:
+    export_binary(out, state, block);
+    break;
   }
 }
 
@@ -855,14 +1849,24 @@ typedef struct {
   unsigned int vaddr;
 } range;
 
+typedef enum {
+  OUTPUT_ASM,    // assembly text
+  OUTPUT_JSONL,  // DISASM_EXPORT_JSONL
+  OUTPUT_BINARY, // DISASM_EXPORT_BINARY
+} output_format;
+
 typedef struct {
   range *ranges;
   int range_count;
   unsigned int vaddr;
   char *input_file;
   char *output_file;
+  char *cache_dir;
+  char *index_file;
+  char *window;
   int merge_pseudo;
   asm_syntax syntax;
+  output_format format;
 } arg_config;
 
 static arg_config default_args = {
@@ -871,8 +1875,12 @@ static arg_config default_args = {
     0x0,     // vaddr
     NULL,    // input_file
     NULL,    // output_file
+    NULL,    // cache_dir
+    NULL,    // index_file
+    NULL,    // window
     0,       // merge_pseudo
-    ASM_GAS, // GNU as
+    ASM_GAS,    // GNU as
+    OUTPUT_ASM, // format
 };
 
 void range_parse(range *r, const char *arg) {
@@ -890,11 +1898,52 @@ void range_parse(range *r, const char *arg) {
   }
 }
 
+// parse window of form <Start>-<End>, <Start>+<Length>, or <Start>
+static void window_parse(const char *arg, unsigned int *start,
+                         unsigned int *end) {
+  const char *minus = strchr(arg, '-');
+  const char *plus = strchr(arg, '+');
+  *start = strtoul(arg, NULL, 0);
+  if (minus) {
+    *end = strtoul(minus + 1, NULL, 0);
+  } else if (plus) {
+    *end = *start + strtoul(plus + 1, NULL, 0);
+  } else {
+    *end = *start + 4;
+  }
+}
+
+// true if an index loaded for the given ranges and settings can be used
+static int index_matches(const disasm_state *state, const arg_config *args,
+                         int default_range) {
+  if (state->syntax != args->syntax ||
+      state->merge_pseudo != args->merge_pseudo) {
+    return 0;
+  }
+  // without ranges, take whatever sections the index was built with
+  if (default_range) {
+    return 1;
+  }
+  if (state->block_count != args->range_count) {
+    return 0;
+  }
+  for (int i = 0; i < args->range_count; i++) {
+    const asm_block *block = &state->blocks[i];
+    const range *r = &args->ranges[i];
+    if (block->offset != r->start || block->length != r->length ||
+        block->vaddr != r->vaddr) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 // parse command line arguments
 static int parse_arguments(int argc, char *argv[], arg_config *config) {
   arg_parser *parser;
   int result;
   const char *syntax_values[] = {"gas", "armips"};
+  const char *format_values[] = {"asm", "jsonl", "binary"};
 
   // Initialize the argument parser
   parser = argparse_init("mipsdisasm", MIPSDISASM_VERSION, "MIPS disassembler");
@@ -904,10 +1953,23 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
   }
 
   // Add flag arguments
+  argparse_add_flag(parser, 'f', "format", ARG_TYPE_ENUM,
+                    "output format [asm, jsonl, binary] (default: asm)",
+                    "FORMAT", &config->format, false, format_values, 3);
+
+  argparse_add_flag(parser, 'i', "index", ARG_TYPE_STRING,
+                    "load first pass results from index file, creating it if "
+                    "missing",
+                    "INDEX", &config->index_file, false, NULL, 0);
+
   argparse_add_flag(parser, 'o', "output", ARG_TYPE_STRING,
                     "output filename (default: stdout)", "OUTPUT",
                     &config->output_file, false, NULL, 0);
 
+  argparse_add_flag(parser, 'c', "cache", ARG_TYPE_STRING,
+                    "directory to cache first pass results in (default: none)",
+                    "DIR", &config->cache_dir, false, NULL, 0);
+
   argparse_add_flag(parser, 'p', "pseudo", ARG_TYPE_NONE,
                     "emit pseudoinstructions for related instructions", NULL,
                     &config->merge_pseudo, false, NULL, 0);
@@ -920,6 +1982,11 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
                     "verbose progress output", NULL, &g_verbosity, false, NULL,
                     0);
 
+  argparse_add_flag(parser, 'w', "window", ARG_TYPE_STRING,
+                    "only output basic blocks covering vaddr window "
+                    "<Start>-<End> or <Start>+<Length>",
+                    "WINDOW", &config->window, false, NULL, 0);
+
   // Add positional arguments
   argparse_add_positional(parser, "FILE", "input binary file to disassemble",
                           ARG_TYPE_STRING, &config->input_file, true);
@@ -946,7 +2013,9 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
     for (i = 1; i < argc; i++) {
       if (argv[i][0] != '-' && strcmp(argv[i], config->input_file) != 0 &&
           (i == 1 || argv[i - 1][0] != '-' ||
-           (argv[i - 1][1] != 'o' && argv[i - 1][1] != 's'))) {
+           (argv[i - 1][1] != 'o' && argv[i - 1][1] != 's' &&
+             argv[i - 1][1] != 'c' && argv[i - 1][1] != 'f' &&
+             argv[i - 1][1] != 'i' && argv[i - 1][1] != 'w'))) {
         range_count++;
       }
     }
@@ -958,7 +2027,9 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
       for (i = 1; i < argc; i++) {
         if (argv[i][0] != '-' && strcmp(argv[i], config->input_file) != 0 &&
             (i == 1 || argv[i - 1][0] != '-' ||
-             (argv[i - 1][1] != 'o' && argv[i - 1][1] != 's'))) {
+             (argv[i - 1][1] != 'o' && argv[i - 1][1] != 's' &&
+             argv[i - 1][1] != 'c' && argv[i - 1][1] != 'f' &&
+             argv[i - 1][1] != 'i' && argv[i - 1][1] != 'w'))) {
           range_parse(&config->ranges[config->range_count], argv[i]);
           config->range_count++;
         }
@@ -978,9 +2049,12 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
 int main(int argc, char *argv[]) {
   arg_config args;
   long file_len;
-  disasm_state *state;
+  disasm_state *state = NULL;
+  rom_image rom;
   unsigned char *data;
   FILE *out;
+  int default_range;
+  int index_exists = 0;
 
   // load defaults
   out = stdout;
@@ -993,16 +2067,18 @@ int main(int argc, char *argv[]) {
 
   // read input file
   INFO("Reading input file '%s'\n", args.input_file);
-  file_len = read_file(args.input_file, &data);
-  if (file_len <= 0) {
+  if (rom_open(&rom, args.input_file) < 0) {
     ERROR("Error reading input file '%s'\n", args.input_file);
     return EXIT_FAILURE;
   }
+  // v64 and n64 dumps are disassembled in big-endian order, anything else as is
+  file_len = rom.size;
+  data = rom_range(&rom, 0, rom.size);
 
   // if specified, open output file
   if (args.output_file != NULL) {
     INFO("Opening output file '%s'\n", args.output_file);
-    out = fopen(args.output_file, "w");
+    out = fopen(args.output_file, args.format == OUTPUT_BINARY ? "wb" : "w");
     if (out == NULL) {
       ERROR("Error opening output file '%s'\n", args.output_file);
       return EXIT_FAILURE;
@@ -1011,8 +2087,9 @@ int main(int argc, char *argv[]) {
 
   // if no ranges specified or if only vaddr specified, add one of entire input
   // file
-  if (args.range_count < 1 ||
-      (args.range_count == 1 && args.ranges[0].length == 0)) {
+  default_range = args.range_count < 1 ||
+                  (args.range_count == 1 && args.ranges[0].length == 0);
+  if (default_range) {
     if (args.range_count < 1) {
       // Allocate memory for one range if none were specified
       args.ranges = malloc(sizeof(range));
@@ -1023,37 +2100,116 @@ int main(int argc, char *argv[]) {
     args.range_count = 1;
   }
 
-  // assembler header output
-  switch (args.syntax) {
-  case ASM_GAS:
-    fprintf(out, ".set noat      # allow manual use of $at\n");
-    fprintf(out, ".set noreorder # don't insert nops after branches\n\n");
-    break;
-  case ASM_ARMIPS: {
-    char output_binary[FILENAME_MAX];
-    if (args.output_file == NULL) {
-      strcpy(output_binary, "test.bin");
-    } else {
-      const char *base = basename(args.output_file);
-      generate_filename(base, output_binary, "bin");
+  // reuse first pass results from the index if it matches. an existing index
+  // is never rewritten: window queries take the syntax and pseudoinstruction
+  // settings it was built with, and an index that can't be used is left alone
+  if (args.index_file != NULL) {
+    index_exists = filesize(args.index_file) >= 0;
+    state = disasm_index_load(args.index_file, data, file_len);
+    if (state != NULL && args.window != NULL) {
+      args.syntax = state->syntax;
+      args.merge_pseudo = state->merge_pseudo;
+    }
+    if (state != NULL && !index_matches(state, &args, default_range)) {
+      disasm_state_free(state);
+      state = NULL;
+    }
+    if (state == NULL && index_exists) {
+      if (args.window != NULL) {
+        ERROR("Index '%s' does not match input file '%s' or its ranges\n",
+              args.index_file, args.input_file);
+        rom_close(&rom);
+        free(args.ranges);
+        return EXIT_FAILURE;
+      }
+      WARNING("Index '%s' does not match input file, ranges or settings, "
+              "disassembling without it\n",
+              args.index_file);
+    }
+    if (state != NULL) {
+      INFO("Loaded index '%s'\n", args.index_file);
+      args.range_count = state->block_count;
+      args.ranges = realloc(args.ranges, MAX(args.range_count, 1) *
+                                             sizeof(*args.ranges));
+      for (int i = 0; i < state->block_count; i++) {
+        args.ranges[i].start = state->blocks[i].offset;
+        args.ranges[i].length = state->blocks[i].length;
+        args.ranges[i].vaddr = state->blocks[i].vaddr;
+      }
     }
-    fprintf(out, ".n64\n");
-    fprintf(out, ".create \"%s\", 0x%08X\n\n", output_binary, 0);
-    break;
   }
-  default:
-    break;
+
+  // assembler header output
+  if (args.format == OUTPUT_ASM && args.window == NULL) {
+    switch (args.syntax) {
+    case ASM_GAS:
+      fprintf(out, ".set noat      # allow manual use of $at\n");
+      fprintf(out, ".set noreorder # don't insert nops after branches\n\n");
+      break;
+    case ASM_ARMIPS: {
+      char output_binary[FILENAME_MAX];
+      if (args.output_file == NULL) {
+        strcpy(output_binary, "test.bin");
+      } else {
+        const char *base = basename(args.output_file);
+        generate_filename(base, output_binary, "bin");
+      }
+      fprintf(out, ".n64\n");
+      fprintf(out, ".create \"%s\", 0x%08X\n\n", output_binary, 0);
+      break;
+    }
+    default:
+      break;
+    }
   }
 
-  state = disasm_state_init(args.syntax, args.merge_pseudo);
+  if (state == NULL) {
+    state = disasm_state_init(args.syntax, args.merge_pseudo);
+    disasm_set_cache_dir(state, args.cache_dir);
 
-  // run first pass disassembler on each section
-  for (int i = 0; i < args.range_count; i++) {
-    range *r = &args.ranges[i];
-    INFO("Disassembling range 0x%X-0x%X at 0x%08X\n", r->start,
-         r->start + r->length, r->vaddr);
+    // run first pass disassembler on each section
+    for (int i = 0; i < args.range_count; i++) {
+      range *r = &args.ranges[i];
+      INFO("Disassembling range 0x%X-0x%X at 0x%08X\n", r->start,
+           r->start + r->length, r->vaddr);
+
+      (void)mipsdisasm_pass1(data, r->start, r->length, r->vaddr, state);
+    }
+
+    if (args.index_file != NULL && !index_exists) {
+      INFO("Writing index '%s'\n", args.index_file);
+      disasm_index_save(state, data, file_len, args.index_file);
+    }
+  }
 
-    (void)mipsdisasm_pass1(data, r->start, r->length, r->vaddr, state);
+  // output only the requested window
+  if (args.window != NULL) {
+    unsigned int start, end;
+    int count;
+    window_parse(args.window, &start, &end);
+    count = mipsdisasm_pass2_range(out, state, start, end);
+    disasm_state_free(state);
+    rom_close(&rom);
+    free(args.ranges);
+    if (count == 0) {
+      ERROR("Window 0x%08X-0x%08X is not in any range\n", start, end);
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // export records instead of assembly
+  if (args.format != OUTPUT_ASM) {
+    disasm_export_format format = args.format == OUTPUT_JSONL
+                                      ? DISASM_EXPORT_JSONL
+                                      : DISASM_EXPORT_BINARY;
+    for (int i = 0; i < args.range_count; i++) {
+      mipsdisasm_export(out, state, args.ranges[i].start, format);
+    }
+    disasm_state_free(state);
+    rom_close(&rom);
+    free(args.ranges);
+    return EXIT_SUCCESS;
   }
 
   // output global labels not in asm sections
@@ -1099,7 +2255,7 @@ int main(int argc, char *argv[]) {
     break;
   }
 
-  free(data);
+  rom_close(&rom);
   
   // Free the allocated ranges array
   if (args.ranges) {
@@ -1,6 +1,9 @@
 #ifndef MIPSDISASM_H_
 #define MIPSDISASM_H_
 
+#include <stdint.h>
+#include <stdio.h>
+
 // typedefs
 typedef struct _disasm_state disasm_state;
 
@@ -9,6 +12,47 @@ typedef enum {
   ASM_ARMIPS, // armips
 } asm_syntax;
 
+typedef enum {
+  DISASM_EXPORT_JSONL,  // one JSON object per instruction per line
+  DISASM_EXPORT_BINARY, // disasm_ir_header followed by disasm_ir_records
+} disasm_export_format;
+
+// binary export layout, in host byte order and suitable for mmap()ing:
+// disasm_ir_header, header.record_count disasm_ir_records (one per
+// instruction), then header.strings_size bytes of NUL terminated label names.
+// sections exported back to back each start with their own header
+#define DISASM_IR_MAGIC "MDIR"
+#define DISASM_IR_VERSION 1
+
+// disasm_ir_record.flags
+#define DISASM_IR_JUMP 0x01    // branch, jump, or call
+#define DISASM_IR_NEWLINE 0x02 // function boundary, blank line in asm output
+
+typedef struct {
+  char magic[4];         // DISASM_IR_MAGIC
+  uint32_t version;      // DISASM_IR_VERSION
+  uint32_t offset;       // offset of first instruction in input
+  uint32_t vaddr;        // virtual address of first instruction
+  uint32_t record_count; // number of records following the header
+  uint32_t strings_size; // size of label string table following the records
+} disasm_ir_header;
+
+typedef struct {
+  uint32_t vaddr;
+  uint32_t word;         // raw instruction word
+  uint16_t id;           // capstone mips_insn, MIPS_INS_LI for merged pseudos
+  uint8_t flags;         // DISASM_IR_* flags
+  uint8_t op_count;      // number of valid op_type/op_reg entries
+  uint8_t op_type[3];    // capstone mips_op_type
+  uint8_t op_reg[3];     // capstone mips_reg, base register for memory
+  uint16_t label_count;  // number of labels at vaddr
+  int32_t imm;           // immediate, branch/jump target, or memory offset
+  int32_t linked_insn;   // record index of linked pseudo pair, -1 if none
+  uint32_t linked_value; // address or value formed by the linked pair
+  uint32_t label;        // string table offset of first label at vaddr,
+                         // further labels follow consecutively
+} disasm_ir_record;
+
 /*
  * allocate and initialize disassembler state to be passed into disassembler
  * routines syntax: assembler syntax to use merge_pseudo: if true, attempt to
@@ -23,6 +67,36 @@ disasm_state *disasm_state_init(asm_syntax syntax, int merge_pseudo);
  */
 void disasm_state_free(disasm_state *state);
 
+/*
+ * cache first pass results on disk, keyed by section contents, vaddr, and
+ * disassembler settings. unchanged sections are loaded instead of disassembled
+ * state: disassembler state returned from disasm_state_alloc()
+ * cache_dir: directory for cache files (created if missing), NULL to disable
+ */
+void disasm_set_cache_dir(disasm_state *state, const char *cache_dir);
+
+/*
+ * save first pass results of all sections to an index file, so later runs
+ * can produce output without disassembling again
+ * state: disassembler state from pass1
+ * data: buffer passed to pass1, recorded to detect stale indexes
+ * length: length of data
+ * filename: index file to write
+ * returns 0 on success
+ */
+int disasm_index_save(const disasm_state *state, const unsigned char *data,
+                      long length, const char *filename);
+
+/*
+ * load disassembler state saved by disasm_index_save()
+ * filename: index file to read
+ * data: buffer the index must have been built from, NULL to skip the check
+ * length: length of data
+ * returns disassembler state, NULL if missing, stale, or invalid
+ */
+disasm_state *disasm_index_load(const char *filename,
+                                const unsigned char *data, long length);
+
 /*
  * add a label to the disassembler state
  * state: disassembler state returned from disasm_state_alloc() or
@@ -62,6 +136,28 @@ void mipsdisasm_pass1(unsigned char *data, unsigned int offset,
  */
 void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset);
 
+/*
+ * disassemble only the basic blocks covering a virtual address window
+ * out: stream to output data to
+ * state: disassembler state from pass1 or disasm_index_load()
+ * start_vaddr: first virtual address of window
+ * end_vaddr: virtual address just past the window
+ * returns number of instructions output, 0 if no section covers the window
+ */
+int mipsdisasm_pass2_range(FILE *out, disasm_state *state,
+                           unsigned int start_vaddr, unsigned int end_vaddr);
+
+/*
+ * export a region of code as records instead of assembly text
+ * out: stream to output data to (opened in binary mode for
+ * DISASM_EXPORT_BINARY)
+ * state: disassembler state from pass1
+ * offset: starting offset to match in disassembler state
+ * format: output record format
+ */
+void mipsdisasm_export(FILE *out, disasm_state *state, unsigned int offset,
+                       disasm_export_format format);
+
 // get version string of raw disassembler
 const char *disasm_get_version(void);
 
@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libn64.h"
+#include "romimage.h"
 #include "utils.h"
 
 #define N64CKSUM_VERSION "0.1"
 
+// CRC1 and CRC2 in the header, computed over [0x1000, CKSUM_END)
+#define CKSUM_OFFSET 0x10
+#define CKSUM_LENGTH 8
+#define CKSUM_END 0x101000
+
 static void print_usage(void) {
   ERROR("Usage: n64cksum ROM [ROM_OUT]\n"
         "\n"
@@ -17,11 +24,13 @@ static void print_usage(void) {
 }
 
 int main(int argc, char *argv[]) {
+  rom_image rom;
   unsigned char *rom_data;
+  unsigned char cksum[CKSUM_LENGTH];
   char *file_in;
   char *file_out;
-  long length;
-  long write_length;
+  FILE *out;
+  int ret = EXIT_SUCCESS;
   if (argc < 2) {
     print_usage();
     return EXIT_FAILURE;
@@ -34,22 +43,50 @@ int main(int argc, char *argv[]) {
     file_out = argv[1];
   }
 
-  length = read_file(file_in, &rom_data);
-  if (length < 0) {
+  if (rom_open(&rom, file_in) < 0) {
     ERROR("Error reading input file \"%s\"\n", file_in);
     return EXIT_FAILURE;
   }
 
+  // only the header and the checksummed region are converted to big-endian
+  rom_data = rom_range(&rom, 0, CKSUM_END);
+  if (rom_data == NULL) {
+    ERROR("Input file \"%s\" is too small to checksum\n", file_in);
+    rom_close(&rom);
+    return EXIT_FAILURE;
+  }
+
   sm64_update_checksums(rom_data);
 
-  write_length = write_file(file_out, rom_data, length);
+  // patch the checksums in the file's own byte order rather than rewriting it
+  memcpy(cksum, &rom_data[CKSUM_OFFSET], CKSUM_LENGTH);
+  if (rom.format == ROM_FORMAT_V64) {
+    swap_bytes(cksum, CKSUM_LENGTH);
+  } else if (rom.format == ROM_FORMAT_N64) {
+    reverse_endian(cksum, CKSUM_LENGTH);
+  }
+  rom_close(&rom);
 
-  free(rom_data);
+  if (strcmp(file_in, file_out) != 0 && copy_file(file_in, file_out) < 0) {
+    ERROR("Error writing to output file \"%s\"\n", file_out);
+    return EXIT_FAILURE;
+  }
 
-  if (write_length != length) {
+  out = fopen(file_out, "r+b");
+  if (out == NULL) {
     ERROR("Error writing to output file \"%s\"\n", file_out);
     return EXIT_FAILURE;
   }
+  if (fseek(out, CKSUM_OFFSET, SEEK_SET) != 0 ||
+      fwrite(cksum, 1, CKSUM_LENGTH, out) != CKSUM_LENGTH) {
+    ret = EXIT_FAILURE;
+  }
+  if (fclose(out) != 0) {
+    ret = EXIT_FAILURE;
+  }
+  if (ret != EXIT_SUCCESS) {
+    ERROR("Error writing to output file \"%s\"\n", file_out);
+  }
 
-  return EXIT_SUCCESS;
+  return ret;
 }
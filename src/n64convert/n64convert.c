@@ -2,22 +2,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#if !defined(N64CONVERT_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#elif !defined(N64CONVERT_SCALAR) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif !defined(N64CONVERT_SCALAR) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "utils.h"
 #include "argparse.h"
+#include "romimage.h"
 
 #define N64CONVERT_VERSION "1.0"
 
-typedef enum {
-    ROM_FORMAT_Z64, // Big-endian (ABCD) - native N64 format
-    ROM_FORMAT_V64, // Byte-swapped (BADC)
-    ROM_FORMAT_N64, // Little-endian (DCBA)
-    ROM_FORMAT_UNKNOWN
-} rom_format_t;
+// bytes converted per read/write, a multiple of the widest shuffle
+#define CONVERT_CHUNK_SIZE (1 * MB)
 
 typedef struct {
     char *input_file;
     char *output_file;
-    rom_format_t target_format;
+    rom_format target_format;
     bool force;
 } arg_config;
 
@@ -28,36 +33,8 @@ static arg_config default_config = {
     false,              // force
 };
 
-// ROM format magic bytes
-static const unsigned char z64_magic[] = {0x80, 0x37, 0x12, 0x40}; // ABCD
-static const unsigned char v64_magic[] = {0x37, 0x80, 0x40, 0x12}; // BADC
-static const unsigned char n64_magic[] = {0x40, 0x12, 0x37, 0x80}; // DCBA
-
-// Function to detect ROM format
-static rom_format_t detect_rom_format(unsigned char *buf) {
-    if (!memcmp(buf, z64_magic, sizeof(z64_magic))) {
-        return ROM_FORMAT_Z64;
-    } else if (!memcmp(buf, v64_magic, sizeof(v64_magic))) {
-        return ROM_FORMAT_V64;
-    } else if (!memcmp(buf, n64_magic, sizeof(n64_magic))) {
-        return ROM_FORMAT_N64;
-    } else {
-        return ROM_FORMAT_UNKNOWN;
-    }
-}
-
-// Function to get format name string
-static const char *get_format_name(rom_format_t format) {
-    switch (format) {
-        case ROM_FORMAT_Z64: return "Z64 (big-endian/ABCD)";
-        case ROM_FORMAT_V64: return "V64 (byte-swapped/BADC)";
-        case ROM_FORMAT_N64: return "N64 (little-endian/DCBA)";
-        default: return "Unknown";
-    }
-}
-
 // Function to get format extension
-static const char *get_format_extension(rom_format_t format) {
+static const char *get_format_extension(rom_format format) {
     switch (format) {
         case ROM_FORMAT_Z64: return "z64";
         case ROM_FORMAT_V64: return "v64";
@@ -66,75 +43,159 @@ static const char *get_format_extension(rom_format_t format) {
     }
 }
 
-// Swap every 2 bytes (for V64 <-> Z64 conversion)
-static void swap_bytes_16(unsigned char *data, long length) {
-    unsigned char tmp;
-    long i;
-    for (i = 0; i < length; i += 2) {
-        if (i + 1 < length) {
-            tmp = data[i];
-            data[i] = data[i + 1];
-            data[i + 1] = tmp;
-        }
+// position of each big-endian (Z64) byte within a word of each format
+static const unsigned char format_order[3][4] = {
+    {0, 1, 2, 3}, // Z64 (ABCD)
+    {1, 0, 3, 2}, // V64 (BADC)
+    {3, 2, 1, 0}, // N64 (DCBA)
+};
+
+// single-pass conversion between any two formats: output byte i of each word
+// is input byte perm[i]. all orders are involutions, so the target order
+// maps output positions back to Z64 bytes and the source order finds them
+typedef struct {
+    unsigned char perm[4];
+    bool swap_tail; // swap a trailing halfword, only V64 is halfword based
+} convert_plan;
+
+static void plan_conversion(convert_plan *plan, rom_format from, rom_format to) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        plan->perm[i] = format_order[from][format_order[to][i]];
     }
+    plan->swap_tail = (from == ROM_FORMAT_V64) != (to == ROM_FORMAT_V64);
 }
 
-// Reverse every 4 bytes (for N64 <-> Z64 conversion)
-static void swap_bytes_32(unsigned char *data, long length) {
-    unsigned char tmp;
-    long i;
-    for (i = 0; i < length; i += 4) {
-        if (i + 3 < length) {
-            // Swap bytes 0 and 3
-            tmp = data[i];
-            data[i] = data[i + 3];
-            data[i + 3] = tmp;
-            // Swap bytes 1 and 2
-            tmp = data[i + 1];
-            data[i + 1] = data[i + 2];
-            data[i + 2] = tmp;
+// convert a buffer in place, length need only be a multiple of 4 at EOF
+static void convert_block(unsigned char *data, size_t length, const convert_plan *plan) {
+    const unsigned char *perm = plan->perm;
+    size_t i = 0;
+
+#if !defined(N64CONVERT_SCALAR) && (defined(__AVX2__) || defined(__SSSE3__) || \
+    (defined(__ARM_NEON) && defined(__aarch64__)))
+    unsigned char mask[32];
+    for (i = 0; i < sizeof(mask); i++) {
+        mask[i] = (i & 0xC) + perm[i & 3]; // lanes are 16 bytes wide
+    }
+    i = 0;
+#if defined(__AVX2__)
+    __m256i shuffle = _mm256_loadu_si256((const __m256i *)mask);
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+#elif defined(__SSSE3__)
+    __m128i shuffle = _mm_loadu_si128((const __m128i *)mask);
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_shuffle_epi8(v, shuffle));
+    }
+#else
+    uint8x16_t shuffle = vld1q_u8(mask);
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(data + i, vqtbl1q_u8(vld1q_u8(data + i), shuffle));
+    }
+#endif
+#endif
+
+    // 64-bit fallback: every permutation is a combination of swapping the
+    // bytes of each halfword and swapping the halfwords of each word
+    bool swap_pairs = perm[0] & 1;
+    bool swap_halves = perm[0] & 2;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        if (swap_pairs) {
+            w = ((w & 0x00FF00FF00FF00FFULL) << 8) | ((w >> 8) & 0x00FF00FF00FF00FFULL);
+        }
+        if (swap_halves) {
+            w = ((w & 0x0000FFFF0000FFFFULL) << 16) | ((w >> 16) & 0x0000FFFF0000FFFFULL);
         }
+        memcpy(data + i, &w, 8);
+    }
+    for (; i + 4 <= length; i += 4) {
+        unsigned char w[4];
+        memcpy(w, data + i, 4);
+        data[i] = w[perm[0]];
+        data[i + 1] = w[perm[1]];
+        data[i + 2] = w[perm[2]];
+        data[i + 3] = w[perm[3]];
+    }
+    // odd sized dumps: only V64 conversions touch a partial word
+    if (plan->swap_tail && i + 2 <= length) {
+        unsigned char tmp = data[i];
+        data[i] = data[i + 1];
+        data[i + 1] = tmp;
     }
 }
 
-// Main conversion function
-static int convert_rom_format(unsigned char *data, long length, 
-                             rom_format_t from_format, rom_format_t to_format) {
-    if (from_format == to_format) {
-        INFO("ROM is already in target format\n");
-        return 0;
+// determine if two paths name the same existing file
+static bool same_file(const char *a, const char *b) {
+    struct stat sa, sb;
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0) {
+        return false;
     }
-    
-    INFO("Converting from %s to %s\n", 
-         get_format_name(from_format), get_format_name(to_format));
-    
-    // Simple conversion logic based on format differences
-    if ((from_format == ROM_FORMAT_Z64 && to_format == ROM_FORMAT_V64) ||
-        (from_format == ROM_FORMAT_V64 && to_format == ROM_FORMAT_Z64)) {
-        // Z64 <-> V64: swap every 2 bytes
-        swap_bytes_16(data, length);
-    } 
-    else if ((from_format == ROM_FORMAT_Z64 && to_format == ROM_FORMAT_N64) ||
-             (from_format == ROM_FORMAT_N64 && to_format == ROM_FORMAT_Z64)) {
-        // Z64 <-> N64: reverse every 4 bytes
-        swap_bytes_32(data, length);
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    return !strcmp(a, b);
+#else
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+// stream input to output in fixed-size chunks, converting each as it passes.
+// converting a file onto itself rewrites each chunk in place
+// returns 0 on success, -1 on open failure, -2 on read/write failure
+static int convert_file(const char *in_name, const char *out_name,
+                        const convert_plan *plan) {
+    bool in_place = same_file(in_name, out_name);
+    unsigned char *buf;
+    FILE *in;
+    FILE *out;
+    long offset = 0;
+    size_t length;
+    int ret = 0;
+
+    in = fopen(in_name, in_place ? "r+b" : "rb");
+    if (in == NULL) {
+        return -1;
     }
-    else if (from_format == ROM_FORMAT_V64 && to_format == ROM_FORMAT_N64) {
-        // V64 -> N64: first convert V64 to Z64, then Z64 to N64
-        swap_bytes_16(data, length);  // V64 -> Z64
-        swap_bytes_32(data, length);  // Z64 -> N64
+    out = in_place ? in : fopen(out_name, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return -1;
     }
-    else if (from_format == ROM_FORMAT_N64 && to_format == ROM_FORMAT_V64) {
-        // N64 -> V64: first convert N64 to Z64, then Z64 to V64
-        swap_bytes_32(data, length);  // N64 -> Z64
-        swap_bytes_16(data, length);  // Z64 -> V64
+    buf = malloc(CONVERT_CHUNK_SIZE);
+    if (buf == NULL) {
+        ret = -2;
     }
-    
-    return 0;
+
+    while (ret == 0 && (length = fread(buf, 1, CONVERT_CHUNK_SIZE, in)) > 0) {
+        convert_block(buf, length, plan);
+        if (in_place && fseek(in, offset, SEEK_SET) != 0) {
+            ret = -2;
+        } else if (fwrite(buf, 1, length, out) != length) {
+            ret = -2;
+        }
+        offset += length;
+        // switching from writing back to reading requires a seek
+        if (in_place && ret == 0 && fseek(in, offset, SEEK_SET) != 0) {
+            ret = -2;
+        }
+    }
+    if (ferror(in)) {
+        ret = -2;
+    }
+
+    free(buf);
+    if (!in_place && fclose(out) != 0) {
+        ret = -2;
+    }
+    fclose(in);
+    return ret;
 }
 
 // Parse format string to enum
-static rom_format_t parse_format_string(const char *format_str) {
+static rom_format parse_format_string(const char *format_str) {
     if (!strcasecmp(format_str, "z64") || !strcasecmp(format_str, "big") || 
         !strcasecmp(format_str, "abcd")) {
         return ROM_FORMAT_Z64;
@@ -151,7 +212,7 @@ static rom_format_t parse_format_string(const char *format_str) {
 
 // Generate output filename if not provided
 static void generate_output_filename(const char *input_file, char *output_file, 
-                                   rom_format_t target_format) {
+                                   rom_format target_format) {
     const char *extension = get_format_extension(target_format);
     generate_filename(input_file, output_file, (char*)extension);
 }
@@ -213,9 +274,10 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
 
 int main(int argc, char *argv[]) {
     arg_config config = default_config;
-    unsigned char *rom_data = NULL;
+    rom_image rom;
     long rom_size;
-    rom_format_t detected_format;
+    rom_format detected_format;
+    convert_plan plan;
     char output_filename[FILENAME_MAX];
     
     // Parse command line arguments
@@ -225,33 +287,32 @@ int main(int argc, char *argv[]) {
     
     INFO("n64convert v" N64CONVERT_VERSION "\n");
     INFO("Input file: %s\n", config.input_file);
-    INFO("Target format: %s\n", get_format_name(config.target_format));
+    INFO("Target format: %s\n", rom_format_name(config.target_format));
     
-    // Read ROM file
-    rom_size = read_file(config.input_file, &rom_data);
-    if (rom_size < 0) {
+    // Map ROM file, only the header is examined here
+    if (rom_open(&rom, config.input_file) < 0) {
         ERROR("Error: Failed to read ROM file '%s'\n", config.input_file);
         return EXIT_FAILURE;
     }
+    rom_size = rom.size;
+    detected_format = rom.format;
+    rom_close(&rom);
     
     if (rom_size < 64) {
         ERROR("Error: File too small to be a valid N64 ROM (minimum 64 bytes)\n");
-        free(rom_data);
         return EXIT_FAILURE;
     }
     
     INFO("ROM size: %ld bytes (%.2f MB)\n", rom_size, rom_size / (1024.0 * 1024.0));
     
     // Detect current ROM format
-    detected_format = detect_rom_format(rom_data);
     if (detected_format == ROM_FORMAT_UNKNOWN) {
         ERROR("Error: Unknown or invalid ROM format\n");
         ERROR("Expected N64 ROM magic bytes not found in first 4 bytes\n");
-        free(rom_data);
         return EXIT_FAILURE;
     }
     
-    INFO("Detected format: %s\n", get_format_name(detected_format));
+    INFO("Detected format: %s\n", rom_format_name(detected_format));
     
     // Generate output filename if not provided
     if (config.output_file == NULL) {
@@ -265,29 +326,27 @@ int main(int argc, char *argv[]) {
     if (!config.force && filesize(config.output_file) >= 0) {
         ERROR("Error: Output file '%s' already exists. Use -F to force overwrite.\n", 
               config.output_file);
-        free(rom_data);
         return EXIT_FAILURE;
     }
     
-    // Perform conversion
-    if (convert_rom_format(rom_data, rom_size, detected_format, config.target_format) != 0) {
-        ERROR("Error: ROM conversion failed\n");
-        free(rom_data);
-        return EXIT_FAILURE;
+    if (detected_format == config.target_format) {
+        INFO("ROM is already in target format\n");
+    } else {
+        INFO("Converting from %s to %s\n", 
+             rom_format_name(detected_format), rom_format_name(config.target_format));
     }
     
-    // Write output file
-    if (write_file(config.output_file, rom_data, rom_size) != rom_size) {
+    // Convert while streaming to the output file
+    plan_conversion(&plan, detected_format, config.target_format);
+    if (convert_file(config.input_file, config.output_file, &plan) != 0) {
         ERROR("Error: Failed to write output file '%s'\n", config.output_file);
-        free(rom_data);
         return EXIT_FAILURE;
     }
     
     INFO("Conversion completed successfully\n");
     printf("Converted %s (%s) to %s (%s)\n",
-           config.input_file, get_format_name(detected_format),
-           config.output_file, get_format_name(config.target_format));
+           config.input_file, rom_format_name(detected_format),
+           config.output_file, rom_format_name(config.target_format));
     
-    free(rom_data);
     return EXIT_SUCCESS;
 }
@@ -1,7 +1,12 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <time.h>
+#if defined(N64GRAPHICS_ZLIB)
+#include <zlib.h>
+#endif
 
 #define STBI_NO_LINEAR
 #define STBI_NO_HDR
@@ -23,6 +28,371 @@
 #define SCALE_3_8(VAL_) ((VAL_) * 0x24)
 #define SCALE_8_3(VAL_) ((VAL_) / 0x24)
 
+// expand F_(I_) ... F_(I_ + N - 1) to build lookup tables at compile time
+#define LUT4(F_, I_) F_(I_), F_((I_) + 1), F_((I_) + 2), F_((I_) + 3)
+#define LUT16(F_, I_)                                                          \
+  LUT4(F_, I_), LUT4(F_, (I_) + 4), LUT4(F_, (I_) + 8), LUT4(F_, (I_) + 12)
+#define LUT64(F_, I_)                                                          \
+  LUT16(F_, I_), LUT16(F_, (I_) + 16), LUT16(F_, (I_) + 32),                   \
+      LUT16(F_, (I_) + 48)
+#define LUT256(F_, I_)                                                         \
+  LUT64(F_, I_), LUT64(F_, (I_) + 64), LUT64(F_, (I_) + 128),                  \
+      LUT64(F_, (I_) + 192)
+
+static const uint8_t scale_5_8[32] = {LUT16(SCALE_5_8, 0),
+                                      LUT16(SCALE_5_8, 16)};
+static const uint8_t scale_8_5[256] = {LUT256(SCALE_8_5, 0)};
+static const uint8_t scale_8_4[256] = {LUT256(SCALE_8_4, 0)};
+static const uint8_t scale_8_3[256] = {LUT256(SCALE_8_3, 0)};
+
+// IA4 and I4 nibble -> IA pixel
+#define IA4_PIXEL(N_)                                                          \
+  {SCALE_3_8(((N_) >> 1) & 0x07), ((N_) & 0x01) ? 0xFF : 0x00}
+#define I4_PIXEL(N_) {SCALE_4_8(N_), 0xFF}
+static const ia ia4_pixel[16] = {LUT16(IA4_PIXEL, 0)};
+static const ia i4_pixel[16] = {LUT16(I4_PIXEL, 0)};
+
+// RGBA pixel -> RGBA16 value
+static inline unsigned rgba16_pack(const rgba *px) {
+  return (scale_8_5[px->red] << 11) | (scale_8_5[px->green] << 6) |
+         (scale_8_5[px->blue] << 1) | (px->alpha ? 0x1 : 0x0);
+}
+
+// SIMD kernels for the common 8 and 16-bit formats. build with
+// -DN64GRAPHICS_SCALAR to use only the table driven loops, which are also
+// what NEON and other targets get
+#if !defined(N64GRAPHICS_SCALAR) && defined(__SSE2__)
+#define N64GRAPHICS_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define N64GRAPHICS_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(N64GRAPHICS_SSE2)
+// 5-bit fields -> 8-bit, (v * 2106) >> 8 == SCALE_5_8(v) for v < 32
+static inline __m128i scale_5_8_sse2(__m128i v) {
+  return _mm_srli_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(2106)), 8);
+}
+
+// 8-bit values -> 5-bit, ((v + 4) * 7968) >> 16 == SCALE_8_5(v) for v < 256
+static inline __m128i scale_8_5_sse2(__m128i v) {
+  return _mm_mulhi_epu16(_mm_add_epi16(v, _mm_set1_epi16(4)),
+                         _mm_set1_epi16(7968));
+}
+
+static inline __m128i swap16_sse2(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+// 8 RGBA16 pixels -> RGBA
+static void rgba16_decode_sse2(rgba *img, const uint8_t *raw) {
+  const __m128i mask5 = _mm_set1_epi16(0x1F);
+  __m128i c = swap16_sse2(_mm_loadu_si128((const __m128i *)raw));
+  __m128i r = scale_5_8_sse2(_mm_srli_epi16(c, 11));
+  __m128i g = scale_5_8_sse2(_mm_and_si128(_mm_srli_epi16(c, 6), mask5));
+  __m128i b = scale_5_8_sse2(_mm_and_si128(_mm_srli_epi16(c, 1), mask5));
+  __m128i a = _mm_srai_epi16(_mm_slli_epi16(c, 15), 15);
+  __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+  __m128i ba = _mm_or_si128(b, _mm_and_si128(a, _mm_set1_epi16((short)0xFF00)));
+  _mm_storeu_si128((__m128i *)img, _mm_unpacklo_epi16(rg, ba));
+  _mm_storeu_si128((__m128i *)(img + 4), _mm_unpackhi_epi16(rg, ba));
+}
+
+// 8 RGBA pixels -> RGBA16
+static void rgba16_encode_sse2(uint8_t *raw, const rgba *img) {
+  const __m128i mask8 = _mm_set1_epi32(0xFF);
+  __m128i p0 = _mm_loadu_si128((const __m128i *)img);
+  __m128i p1 = _mm_loadu_si128((const __m128i *)(img + 4));
+  __m128i r = _mm_packs_epi32(_mm_and_si128(p0, mask8),
+                              _mm_and_si128(p1, mask8));
+  __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask8),
+                              _mm_and_si128(_mm_srli_epi32(p1, 8), mask8));
+  __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask8),
+                              _mm_and_si128(_mm_srli_epi32(p1, 16), mask8));
+  __m128i a = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+  __m128i c = _mm_andnot_si128(_mm_cmpeq_epi16(a, _mm_setzero_si128()),
+                               _mm_set1_epi16(1));
+  c = _mm_or_si128(c, _mm_slli_epi16(scale_8_5_sse2(r), 11));
+  c = _mm_or_si128(c, _mm_slli_epi16(scale_8_5_sse2(g), 6));
+  c = _mm_or_si128(c, _mm_slli_epi16(scale_8_5_sse2(b), 1));
+  _mm_storeu_si128((__m128i *)raw, swap16_sse2(c));
+}
+
+// 16 IA8 pixels -> IA
+static void ia8_decode_sse2(ia *img, const uint8_t *raw) {
+  const __m128i mask4 = _mm_set1_epi8(0x0F);
+  __m128i v = _mm_loadu_si128((const __m128i *)raw);
+  __m128i i = _mm_and_si128(_mm_srli_epi16(v, 4), mask4);
+  __m128i a = _mm_and_si128(v, mask4);
+  i = _mm_or_si128(i, _mm_slli_epi16(i, 4));
+  a = _mm_or_si128(a, _mm_slli_epi16(a, 4));
+  _mm_storeu_si128((__m128i *)img, _mm_unpacklo_epi8(i, a));
+  _mm_storeu_si128((__m128i *)(img + 8), _mm_unpackhi_epi8(i, a));
+}
+
+// 16 IA pixels -> IA8, (v * 3856) >> 16 == SCALE_8_4(v) for v < 256
+static void ia8_encode_sse2(uint8_t *raw, const ia *img) {
+  const __m128i mask8 = _mm_set1_epi16(0xFF);
+  const __m128i div17 = _mm_set1_epi16(3856);
+  __m128i p0 = _mm_loadu_si128((const __m128i *)img);
+  __m128i p1 = _mm_loadu_si128((const __m128i *)(img + 8));
+  __m128i v0 = _mm_mulhi_epu16(_mm_and_si128(p0, mask8), div17);
+  __m128i v1 = _mm_mulhi_epu16(_mm_and_si128(p1, mask8), div17);
+  __m128i a0 = _mm_mulhi_epu16(_mm_srli_epi16(p0, 8), div17);
+  __m128i a1 = _mm_mulhi_epu16(_mm_srli_epi16(p1, 8), div17);
+  v0 = _mm_or_si128(_mm_slli_epi16(v0, 4), a0);
+  v1 = _mm_or_si128(_mm_slli_epi16(v1, 4), a1);
+  _mm_storeu_si128((__m128i *)raw, _mm_packus_epi16(v0, v1));
+}
+
+// 16 I8 pixels -> IA
+static void i8_decode_sse2(ia *img, const uint8_t *raw) {
+  const __m128i opaque = _mm_set1_epi8((char)0xFF);
+  __m128i v = _mm_loadu_si128((const __m128i *)raw);
+  _mm_storeu_si128((__m128i *)img, _mm_unpacklo_epi8(v, opaque));
+  _mm_storeu_si128((__m128i *)(img + 8), _mm_unpackhi_epi8(v, opaque));
+}
+
+// 16 IA pixels -> I8
+static void i8_encode_sse2(uint8_t *raw, const ia *img) {
+  const __m128i mask8 = _mm_set1_epi16(0xFF);
+  __m128i p0 = _mm_loadu_si128((const __m128i *)img);
+  __m128i p1 = _mm_loadu_si128((const __m128i *)(img + 8));
+  _mm_storeu_si128((__m128i *)raw,
+                   _mm_packus_epi16(_mm_and_si128(p0, mask8),
+                                    _mm_and_si128(p1, mask8)));
+}
+#endif // N64GRAPHICS_SSE2
+
+#if defined(N64GRAPHICS_AVX2)
+static inline __m256i swap16_avx2(__m256i v) {
+  return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+}
+
+// 16 RGBA16 pixels -> RGBA
+static void rgba16_decode_avx2(rgba *img, const uint8_t *raw) {
+  const __m256i mask5 = _mm256_set1_epi16(0x1F);
+  const __m256i mul = _mm256_set1_epi16(2106);
+  __m256i c = swap16_avx2(_mm256_loadu_si256((const __m256i *)raw));
+  __m256i r = _mm256_srli_epi16(c, 11);
+  __m256i g = _mm256_and_si256(_mm256_srli_epi16(c, 6), mask5);
+  __m256i b = _mm256_and_si256(_mm256_srli_epi16(c, 1), mask5);
+  __m256i a = _mm256_srai_epi16(_mm256_slli_epi16(c, 15), 15);
+  r = _mm256_srli_epi16(_mm256_mullo_epi16(r, mul), 8);
+  g = _mm256_srli_epi16(_mm256_mullo_epi16(g, mul), 8);
+  b = _mm256_srli_epi16(_mm256_mullo_epi16(b, mul), 8);
+  __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+  __m256i ba =
+      _mm256_or_si256(b, _mm256_and_si256(a, _mm256_set1_epi16((short)0xFF00)));
+  // unpack works within 128-bit lanes: lo = pixels 0-3, 8-11
+  __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+  __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+  _mm256_storeu_si256((__m256i *)img, _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i *)(img + 8),
+                      _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+// 16 RGBA pixels -> RGBA16
+static void rgba16_encode_avx2(uint8_t *raw, const rgba *img) {
+  const __m256i mask8 = _mm256_set1_epi32(0xFF);
+  const __m256i four = _mm256_set1_epi16(4);
+  const __m256i div255 = _mm256_set1_epi16(7968);
+  __m256i p0 = _mm256_loadu_si256((const __m256i *)img);
+  __m256i p1 = _mm256_loadu_si256((const __m256i *)(img + 8));
+  // pack works within 128-bit lanes: pixels 0-3, 8-11, 4-7, 12-15
+  __m256i r = _mm256_packs_epi32(_mm256_and_si256(p0, mask8),
+                                 _mm256_and_si256(p1, mask8));
+  __m256i g =
+      _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), mask8),
+                         _mm256_and_si256(_mm256_srli_epi32(p1, 8), mask8));
+  __m256i b =
+      _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), mask8),
+                         _mm256_and_si256(_mm256_srli_epi32(p1, 16), mask8));
+  __m256i a =
+      _mm256_packs_epi32(_mm256_srli_epi32(p0, 24), _mm256_srli_epi32(p1, 24));
+  r = _mm256_mulhi_epu16(_mm256_add_epi16(r, four), div255);
+  g = _mm256_mulhi_epu16(_mm256_add_epi16(g, four), div255);
+  b = _mm256_mulhi_epu16(_mm256_add_epi16(b, four), div255);
+  __m256i c = _mm256_andnot_si256(
+      _mm256_cmpeq_epi16(a, _mm256_setzero_si256()), _mm256_set1_epi16(1));
+  c = _mm256_or_si256(c, _mm256_slli_epi16(r, 11));
+  c = _mm256_or_si256(c, _mm256_slli_epi16(g, 6));
+  c = _mm256_or_si256(c, _mm256_slli_epi16(b, 1));
+  c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(3, 1, 2, 0));
+  _mm256_storeu_si256((__m256i *)raw, swap16_avx2(c));
+}
+#endif // N64GRAPHICS_AVX2
+
+//---------------------------------------------------------
+// pixel converters, count pixels from raw to img or back
+//---------------------------------------------------------
+
+static void decode_rgba16(rgba *img, const uint8_t *raw, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_AVX2)
+  for (; i + 16 <= count; i += 16) {
+    rgba16_decode_avx2(&img[i], &raw[i * 2]);
+  }
+#endif
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 8 <= count; i += 8) {
+    rgba16_decode_sse2(&img[i], &raw[i * 2]);
+  }
+#endif
+  for (; i < count; i++) {
+    unsigned c = (raw[i * 2] << 8) | raw[i * 2 + 1];
+    img[i].red = scale_5_8[c >> 11];
+    img[i].green = scale_5_8[(c >> 6) & 0x1F];
+    img[i].blue = scale_5_8[(c >> 1) & 0x1F];
+    img[i].alpha = (c & 0x01) ? 0xFF : 0x00;
+  }
+}
+
+static void encode_rgba16(uint8_t *raw, const rgba *img, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_AVX2)
+  for (; i + 16 <= count; i += 16) {
+    rgba16_encode_avx2(&raw[i * 2], &img[i]);
+  }
+#endif
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 8 <= count; i += 8) {
+    rgba16_encode_sse2(&raw[i * 2], &img[i]);
+  }
+#endif
+  for (; i < count; i++) {
+    unsigned c = rgba16_pack(&img[i]);
+    raw[i * 2] = c >> 8;
+    raw[i * 2 + 1] = c & 0xFF;
+  }
+}
+
+static void decode_ia8(ia *img, const uint8_t *raw, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 16 <= count; i += 16) {
+    ia8_decode_sse2(&img[i], &raw[i]);
+  }
+#endif
+  for (; i < count; i++) {
+    img[i].intensity = SCALE_4_8(raw[i] >> 4);
+    img[i].alpha = SCALE_4_8(raw[i] & 0x0F);
+  }
+}
+
+static void encode_ia8(uint8_t *raw, const ia *img, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 16 <= count; i += 16) {
+    ia8_encode_sse2(&raw[i], &img[i]);
+  }
+#endif
+  for (; i < count; i++) {
+    raw[i] = (scale_8_4[img[i].intensity] << 4) | scale_8_4[img[i].alpha];
+  }
+}
+
+static void decode_i8(ia *img, const uint8_t *raw, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 16 <= count; i += 16) {
+    i8_decode_sse2(&img[i], &raw[i]);
+  }
+#endif
+  for (; i < count; i++) {
+    img[i].intensity = raw[i];
+    img[i].alpha = 0xFF;
+  }
+}
+
+static void encode_i8(uint8_t *raw, const ia *img, int count) {
+  int i = 0;
+#if defined(N64GRAPHICS_SSE2)
+  for (; i + 16 <= count; i += 16) {
+    i8_encode_sse2(&raw[i], &img[i]);
+  }
+#endif
+  for (; i < count; i++) {
+    raw[i] = img[i].intensity;
+  }
+}
+
+// 4-bit formats: one table lookup per nibble, high nibble first
+static void decode_4bit(ia *img, const uint8_t *raw, int count,
+                        const ia *pixel) {
+  int i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    img[i] = pixel[raw[i / 2] >> 4];
+    img[i + 1] = pixel[raw[i / 2] & 0x0F];
+  }
+  if (i < count) {
+    img[i] = pixel[raw[i / 2] >> 4];
+  }
+}
+
+static void decode_ia1(ia *img, const uint8_t *raw, int count) {
+  int i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    for (int b = 0; b < 8; b++) {
+      uint8_t bits = ((raw[i / 8] >> (7 - b)) & 0x01) ? 0xFF : 0x00;
+      img[i + b].intensity = bits;
+      img[i + b].alpha = bits;
+    }
+  }
+  for (; i < count; i++) {
+    uint8_t bits = ((raw[i / 8] >> (7 - (i % 8))) & 0x01) ? 0xFF : 0x00;
+    img[i].intensity = bits;
+    img[i].alpha = bits;
+  }
+}
+
+// trailing odd pixels only replace their own bits of the last byte
+static void encode_ia4(uint8_t *raw, const ia *img, int count) {
+  int i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    raw[i / 2] = (scale_8_3[img[i].intensity] << 5) |
+                 (img[i].alpha ? 0x10 : 0x00) |
+                 (scale_8_3[img[i + 1].intensity] << 1) |
+                 (img[i + 1].alpha ? 0x01 : 0x00);
+  }
+  if (i < count) {
+    raw[i / 2] = (raw[i / 2] & 0x0F) | (scale_8_3[img[i].intensity] << 5) |
+                 (img[i].alpha ? 0x10 : 0x00);
+  }
+}
+
+static void encode_i4(uint8_t *raw, const ia *img, int count) {
+  int i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    raw[i / 2] =
+        (scale_8_4[img[i].intensity] << 4) | scale_8_4[img[i + 1].intensity];
+  }
+  if (i < count) {
+    raw[i / 2] = (raw[i / 2] & 0x0F) | (scale_8_4[img[i].intensity] << 4);
+  }
+}
+
+static void encode_ia1(uint8_t *raw, const ia *img, int count) {
+  int i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    uint8_t bits = 0;
+    for (int b = 0; b < 8; b++) {
+      bits = (bits << 1) | (img[i + b].intensity ? 0x01 : 0x00);
+    }
+    raw[i / 8] = bits;
+  }
+  for (; i < count; i++) {
+    uint8_t bit = 1 << (7 - (i % 8));
+    if (img[i].intensity) {
+      raw[i / 8] |= bit;
+    } else {
+      raw[i / 8] &= ~bit;
+    }
+  }
+}
+
 typedef enum {
   IMG_FORMAT_RGBA,
   IMG_FORMAT_IA,
@@ -30,10 +400,109 @@ typedef enum {
   IMG_FORMAT_CI,
 } img_format;
 
+//---------------------------------------------------------
+// texture scratch buffer
+//---------------------------------------------------------
+
+void *texture_scratch_reserve(texture_scratch *scratch, size_t size) {
+  if (size > scratch->capacity) {
+    // contents needn't survive, so skip the copy realloc would do
+    size_t capacity = MAX(size, 2 * scratch->capacity);
+    free(scratch->data);
+    scratch->data = malloc(capacity);
+    if (!scratch->data) {
+      ERROR("Error allocating %zu bytes\n", capacity);
+      scratch->capacity = 0;
+      return NULL;
+    }
+    scratch->capacity = capacity;
+  }
+  return scratch->data;
+}
+
+void texture_scratch_free(texture_scratch *scratch) {
+  free(scratch->data);
+  scratch->data = NULL;
+  scratch->capacity = 0;
+}
+
 //---------------------------------------------------------
 // N64 RGBA/IA/I/CI -> internal RGBA/IA
 //---------------------------------------------------------
 
+int raw2rgba_into(rgba *img, const uint8_t *raw, int width, int height,
+                  int depth) {
+  switch (depth) {
+  case 16:
+    decode_rgba16(img, raw, width * height);
+    break;
+  case 32:
+    memcpy(img, raw, width * height * sizeof(*img));
+    break;
+  default:
+    ERROR("Error invalid depth %d\n", depth);
+    return -1;
+  }
+  return 0;
+}
+
+int raw2ia_into(ia *img, const uint8_t *raw, int width, int height,
+                int depth) {
+  switch (depth) {
+  case 16:
+    memcpy(img, raw, width * height * sizeof(*img));
+    break;
+  case 8:
+    decode_ia8(img, raw, width * height);
+    break;
+  case 4:
+    decode_4bit(img, raw, width * height, ia4_pixel);
+    break;
+  case 1:
+    decode_ia1(img, raw, width * height);
+    break;
+  default:
+    ERROR("Error invalid depth %d\n", depth);
+    return -1;
+  }
+  return 0;
+}
+
+int raw2i_into(ia *img, const uint8_t *raw, int width, int height, int depth) {
+  switch (depth) {
+  case 8:
+    decode_i8(img, raw, width * height);
+    break;
+  case 4:
+    decode_4bit(img, raw, width * height, i4_pixel);
+    break;
+  default:
+    ERROR("Error invalid depth %d\n", depth);
+    return -1;
+  }
+  return 0;
+}
+
+// extract RGBA from CI raw data and palette
+int rawci2rgba_into(rgba *img, const uint8_t *rawci, const uint8_t *palette,
+                    int width, int height, int depth) {
+  rgba colors[256];
+  int count = width * height;
+  int used = 0;
+
+  // only decode palette entries up to the highest index referenced
+  for (int i = 0; i < count; i++) {
+    used = MAX(used, rawci[i] + 1);
+  }
+  if (raw2rgba_into(colors, palette, used, 1, depth) < 0) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    img[i] = colors[rawci[i]];
+  }
+  return 0;
+}
+
 rgba *raw2rgba(const uint8_t *raw, int width, int height, int depth) {
   rgba *img;
   int img_size;
@@ -45,21 +514,9 @@ rgba *raw2rgba(const uint8_t *raw, int width, int height, int depth) {
     return NULL;
   }
 
-  if (depth == 16) {
-    for (int i = 0; i < width * height; i++) {
-      img[i].red = SCALE_5_8((raw[i * 2] & 0xF8) >> 3);
-      img[i].green = SCALE_5_8(((raw[i * 2] & 0x07) << 2) |
-                               ((raw[i * 2 + 1] & 0xC0) >> 6));
-      img[i].blue = SCALE_5_8((raw[i * 2 + 1] & 0x3E) >> 1);
-      img[i].alpha = (raw[i * 2 + 1] & 0x01) ? 0xFF : 0x00;
-    }
-  } else if (depth == 32) {
-    for (int i = 0; i < width * height; i++) {
-      img[i].red = raw[i * 4];
-      img[i].green = raw[i * 4 + 1];
-      img[i].blue = raw[i * 4 + 2];
-      img[i].alpha = raw[i * 4 + 3];
-    }
+  if (raw2rgba_into(img, raw, width, height, depth) < 0) {
+    free(img);
+    img = NULL;
   }
 
   return img;
@@ -76,46 +533,9 @@ ia *raw2ia(const uint8_t *raw, int width, int height, int depth) {
     return NULL;
   }
 
-  switch (depth) {
-  case 16:
-    for (int i = 0; i < width * height; i++) {
-      img[i].intensity = raw[i * 2];
-      img[i].alpha = raw[i * 2 + 1];
-    }
-    break;
-  case 8:
-    for (int i = 0; i < width * height; i++) {
-      img[i].intensity = SCALE_4_8((raw[i] & 0xF0) >> 4);
-      img[i].alpha = SCALE_4_8(raw[i] & 0x0F);
-    }
-    break;
-  case 4:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t bits;
-      bits = raw[i / 2];
-      if (i % 2) {
-        bits &= 0xF;
-      } else {
-        bits >>= 4;
-      }
-      img[i].intensity = SCALE_3_8((bits >> 1) & 0x07);
-      img[i].alpha = (bits & 0x01) ? 0xFF : 0x00;
-    }
-    break;
-  case 1:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t bits;
-      uint8_t mask;
-      bits = raw[i / 8];
-      mask = 1 << (7 - (i % 8)); // MSb->LSb
-      bits = (bits & mask) ? 0xFF : 0x00;
-      img[i].intensity = bits;
-      img[i].alpha = bits;
-    }
-    break;
-  default:
-    ERROR("Error invalid depth %d\n", depth);
-    break;
+  if (raw2ia_into(img, raw, width, height, depth) < 0) {
+    free(img);
+    img = NULL;
   }
 
   return img;
@@ -132,60 +552,31 @@ ia *raw2i(const uint8_t *raw, int width, int height, int depth) {
     return NULL;
   }
 
-  switch (depth) {
-  case 8:
-    for (int i = 0; i < width * height; i++) {
-      img[i].intensity = raw[i];
-      img[i].alpha = 0xFF;
-    }
-    break;
-  case 4:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t bits;
-      bits = raw[i / 2];
-      if (i % 2) {
-        bits &= 0xF;
-      } else {
-        bits >>= 4;
-      }
-      img[i].intensity = SCALE_4_8(bits);
-      img[i].alpha = 0xFF;
-    }
-    break;
-  default:
-    ERROR("Error invalid depth %d\n", depth);
-    break;
+  if (raw2i_into(img, raw, width, height, depth) < 0) {
+    free(img);
+    img = NULL;
   }
 
   return img;
 }
 
-// extract RGBA from CI raw data and palette
-// TODO: different palette depths
 rgba *rawci2rgba(const uint8_t *rawci, const uint8_t *palette, int width,
                  int height, int depth) {
-  uint8_t *raw_rgba;
-  rgba *img = NULL;
-  int raw_size;
+  rgba *img;
+  int img_size;
 
-  // first convert to raw RGBA
-  raw_size = 2 * width * height;
-  raw_rgba = malloc(raw_size);
-  if (!raw_rgba) {
-    ERROR("Error allocating %u bytes\n", raw_size);
+  img_size = width * height * sizeof(*img);
+  img = malloc(img_size);
+  if (!img) {
+    ERROR("Error allocating %u bytes\n", img_size);
     return NULL;
   }
 
-  for (int i = 0; i < width * height; i++) {
-    raw_rgba[2 * i] = palette[2 * rawci[i]];
-    raw_rgba[2 * i + 1] = palette[2 * rawci[i] + 1];
+  if (rawci2rgba_into(img, rawci, palette, width, height, depth) < 0) {
+    free(img);
+    img = NULL;
   }
 
-  // then convert to RGBA image data
-  img = raw2rgba(raw_rgba, width, height, depth);
-
-  free(raw_rgba);
-
   return img;
 }
 
@@ -199,22 +590,9 @@ int rgba2raw(uint8_t *raw, const rgba *img, int width, int height, int depth) {
   INFO("Converting RGBA%d %dx%d to raw\n", depth, width, height);
 
   if (depth == 16) {
-    for (int i = 0; i < width * height; i++) {
-      uint8_t r, g, b, a;
-      r = SCALE_8_5(img[i].red);
-      g = SCALE_8_5(img[i].green);
-      b = SCALE_8_5(img[i].blue);
-      a = img[i].alpha ? 0x1 : 0x0;
-      raw[i * 2] = (r << 3) | (g >> 2);
-      raw[i * 2 + 1] = ((g & 0x3) << 6) | (b << 1) | a;
-    }
+    encode_rgba16(raw, img, width * height);
   } else if (depth == 32) {
-    for (int i = 0; i < width * height; i++) {
-      raw[i * 4] = img[i].red;
-      raw[i * 4 + 1] = img[i].green;
-      raw[i * 4 + 2] = img[i].blue;
-      raw[i * 4 + 3] = img[i].alpha;
-    }
+    memcpy(raw, img, size);
   } else {
     ERROR("Error invalid depth %d\n", depth);
     size = -1;
@@ -229,41 +607,16 @@ int ia2raw(uint8_t *raw, const ia *img, int width, int height, int depth) {
 
   switch (depth) {
   case 16:
-    for (int i = 0; i < width * height; i++) {
-      raw[i * 2] = img[i].intensity;
-      raw[i * 2 + 1] = img[i].alpha;
-    }
+    memcpy(raw, img, size);
     break;
   case 8:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t val = SCALE_8_4(img[i].intensity);
-      uint8_t alpha = SCALE_8_4(img[i].alpha);
-      raw[i] = (val << 4) | alpha;
-    }
+    encode_ia8(raw, img, width * height);
     break;
   case 4:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t val = SCALE_8_3(img[i].intensity);
-      uint8_t alpha = img[i].alpha ? 0x01 : 0x00;
-      uint8_t old = raw[i / 2];
-      if (i % 2) {
-        raw[i / 2] = (old & 0xF0) | (val << 1) | alpha;
-      } else {
-        raw[i / 2] = (old & 0x0F) | (((val << 1) | alpha) << 4);
-      }
-    }
+    encode_ia4(raw, img, width * height);
     break;
   case 1:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t val = img[i].intensity;
-      uint8_t old = raw[i / 8];
-      uint8_t bit = 1 << (7 - (i % 8));
-      if (val) {
-        raw[i / 8] = old | bit;
-      } else {
-        raw[i / 8] = old & (~bit);
-      }
-    }
+    encode_ia1(raw, img, width * height);
     break;
   default:
     ERROR("Error invalid depth %d\n", depth);
@@ -280,20 +633,10 @@ int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth) {
 
   switch (depth) {
   case 8:
-    for (int i = 0; i < width * height; i++) {
-      raw[i] = img[i].intensity;
-    }
+    encode_i8(raw, img, width * height);
     break;
   case 4:
-    for (int i = 0; i < width * height; i++) {
-      uint8_t val = SCALE_8_4(img[i].intensity);
-      uint8_t old = raw[i / 2];
-      if (i % 2) {
-        raw[i / 2] = (old & 0xF0) | val;
-      } else {
-        raw[i / 2] = (old & 0x0F) | (val << 4);
-      }
-    }
+    encode_i4(raw, img, width * height);
     break;
   default:
     ERROR("Error invalid depth %d\n", depth);
@@ -304,83 +647,589 @@ int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth) {
   return size;
 }
 
+//---------------------------------------------------------
+// internal RGBA -> N64 CI + palette
+//---------------------------------------------------------
+
+// every RGBA16 value, used to index histograms and lookups directly
+#define RGBA16_COLORS 0x10000
+
+// median cut axes, alpha first so that opaque and transparent colors are
+// separated before anything else
+enum { CI_AXIS_ALPHA, CI_AXIS_GREEN, CI_AXIS_RED, CI_AXIS_BLUE, CI_AXES };
+
+// range of colors[start, end) being split by median cut
+typedef struct {
+  int start;
+  int end;
+  uint64_t weight; // pixels covered
+  int axis;        // widest axis
+  int range;       // extent along it
+} ci_box;
+
+static inline int ci_component(unsigned c, int axis) {
+  switch (axis) {
+  case CI_AXIS_ALPHA:
+    return (c & 0x1) ? 0x1F : 0;
+  case CI_AXIS_GREEN:
+    return (c >> 6) & 0x1F;
+  case CI_AXIS_RED:
+    return c >> 11;
+  default:
+    return (c >> 1) & 0x1F;
+  }
+}
+
+static void ci_box_update(ci_box *box, const uint16_t *colors,
+                          const uint32_t *hist) {
+  int lo[CI_AXES] = {0x1F, 0x1F, 0x1F, 0x1F};
+  int hi[CI_AXES] = {0};
+  box->weight = 0;
+  for (int i = box->start; i < box->end; i++) {
+    box->weight += hist[colors[i]];
+    for (int a = 0; a < CI_AXES; a++) {
+      int v = ci_component(colors[i], a);
+      lo[a] = MIN(lo[a], v);
+      hi[a] = MAX(hi[a], v);
+    }
+  }
+  box->axis = 0;
+  box->range = -1;
+  for (int a = 0; a < CI_AXES; a++) {
+    if (hi[a] - lo[a] > box->range) {
+      box->axis = a;
+      box->range = hi[a] - lo[a];
+    }
+  }
+}
+
+// reduce 'count' distinct colors to at most 'max_colors' weighted averages
+// colors is reordered, tmp must hold count entries
+static int ci_median_cut(uint16_t *palette, int max_colors, uint16_t *colors,
+                         uint16_t *tmp, int count, const uint32_t *hist) {
+  ci_box boxes[256];
+  int box_count = 1;
+
+  boxes[0].start = 0;
+  boxes[0].end = count;
+  ci_box_update(&boxes[0], colors, hist);
+
+  while (box_count < max_colors) {
+    ci_box *box = NULL;
+    uint64_t best = 0;
+    // split the box with the most pixels times spread
+    for (int b = 0; b < box_count; b++) {
+      uint64_t score = boxes[b].weight * boxes[b].range;
+      if (boxes[b].end - boxes[b].start > 1 && score > best) {
+        box = &boxes[b];
+        best = score;
+      }
+    }
+    if (!box) {
+      break;
+    }
+
+    // counting sort along the axis, components are 5-bit
+    int offsets[0x20 + 1] = {0};
+    for (int i = box->start; i < box->end; i++) {
+      offsets[ci_component(colors[i], box->axis) + 1]++;
+    }
+    for (int v = 0; v < 0x20; v++) {
+      offsets[v + 1] += offsets[v];
+    }
+    for (int i = box->start; i < box->end; i++) {
+      tmp[offsets[ci_component(colors[i], box->axis)]++] = colors[i];
+    }
+    memcpy(&colors[box->start], tmp,
+           (box->end - box->start) * sizeof(*colors));
+
+    // split at the weighted median, leaving at least one color each side
+    uint64_t acc = 0;
+    int mid = box->start;
+    while (mid < box->end - 1 && 2 * (acc + hist[colors[mid]]) <= box->weight) {
+      acc += hist[colors[mid]];
+      mid++;
+    }
+    mid = MAX(mid, box->start + 1);
+
+    ci_box *next = &boxes[box_count++];
+    next->start = mid;
+    next->end = box->end;
+    box->end = mid;
+    ci_box_update(box, colors, hist);
+    ci_box_update(next, colors, hist);
+  }
+
+  for (int b = 0; b < box_count; b++) {
+    uint64_t sum[CI_AXES] = {0};
+    uint64_t weight = boxes[b].weight;
+    for (int i = boxes[b].start; i < boxes[b].end; i++) {
+      for (int a = 0; a < CI_AXES; a++) {
+        sum[a] += (uint64_t)ci_component(colors[i], a) * hist[colors[i]];
+      }
+    }
+    for (int a = 0; a < CI_AXES; a++) {
+      sum[a] = (sum[a] + weight / 2) / weight;
+    }
+    palette[b] = (sum[CI_AXIS_RED] << 11) | (sum[CI_AXIS_GREEN] << 6) |
+                 (sum[CI_AXIS_BLUE] << 1) | (sum[CI_AXIS_ALPHA] > 0xF);
+  }
+  return box_count;
+}
+
+// closest palette entry, alpha must match whenever possible
+static int ci_nearest(const uint16_t *palette, int pal_len, unsigned c) {
+  int best = 0;
+  int best_dist = -1;
+  for (int i = 0; i < pal_len; i++) {
+    int dist = 0;
+    for (int a = CI_AXIS_GREEN; a < CI_AXES; a++) {
+      int d = ci_component(c, a) - ci_component(palette[i], a);
+      dist += d * d;
+    }
+    if ((c ^ palette[i]) & 0x1) {
+      dist += 4 * 0x20 * 0x20;
+    }
+    if (best_dist < 0 || dist < best_dist) {
+      best = i;
+      best_dist = dist;
+    }
+  }
+  return best;
+}
+
+int rgba2rawci_shared(uint8_t *const *raws, uint8_t *out_palette, int *pal_len,
+                      int max_colors, const rgba *const *imgs,
+                      const int *widths, const int *heights, int count,
+                      int depth) {
+  uint32_t *hist;
+  uint16_t *colors;
+  uint16_t palette[256];
+  int16_t *lookup;
+  int distinct = 0;
+  int used;
+  int size = 0;
+
+  if (depth != 4 && depth != 8) {
+    ERROR("Error invalid depth %d\n", depth);
+    return -1;
+  }
+  if (max_colors <= 0 || max_colors > (1 << depth)) {
+    max_colors = 1 << depth;
+  }
+  INFO("Converting %d RGBA images to CI%d, up to %d colors\n", count, depth,
+       max_colors);
+
+  // colors as RGBA16 in order of first use, hist counts pixels of each
+  hist = calloc(RGBA16_COLORS, sizeof(*hist));
+  colors = malloc(2 * RGBA16_COLORS * sizeof(*colors));
+  lookup = malloc(RGBA16_COLORS * sizeof(*lookup));
+  if (!hist || !colors || !lookup) {
+    ERROR("Error allocating CI tables\n");
+    size = -1;
+    goto cleanup;
+  }
+  for (int n = 0; n < count; n++) {
+    for (int i = 0; i < widths[n] * heights[n]; i++) {
+      unsigned c = rgba16_pack(&imgs[n][i]);
+      if (hist[c]++ == 0) {
+        colors[distinct++] = c;
+      }
+    }
+  }
+
+  if (distinct <= max_colors) {
+    memcpy(palette, colors, distinct * sizeof(*colors));
+    used = distinct;
+  } else {
+    used = ci_median_cut(palette, max_colors, colors, &colors[RGBA16_COLORS],
+                         distinct, hist);
+    INFO("Quantized %d colors to %d\n", distinct, used);
+  }
+
+  // exact matches are seeded, everything else is resolved on first use
+  memset(lookup, 0xFF, RGBA16_COLORS * sizeof(*lookup));
+  for (int i = used - 1; i >= 0; i--) {
+    lookup[palette[i]] = i;
+  }
+  for (int n = 0; n < count; n++) {
+    int pixels = widths[n] * heights[n];
+    uint8_t *raw = raws[n];
+    for (int i = 0; i < pixels; i++) {
+      unsigned c = rgba16_pack(&imgs[n][i]);
+      if (lookup[c] < 0) {
+        lookup[c] = ci_nearest(palette, used, c);
+      }
+      // CI4 even pixels set the whole byte, so an odd tail ends in a zero nibble
+      if (depth == 8) {
+        raw[i] = lookup[c];
+      } else if (i % 2) {
+        raw[i / 2] |= lookup[c];
+      } else {
+        raw[i / 2] = lookup[c] << 4;
+      }
+    }
+    size += (pixels * depth + 7) / 8;
+  }
+
+  for (int i = 0; i < used; i++) {
+    write_u16_be(&out_palette[i * 2], palette[i]);
+  }
+  *pal_len = used;
+
+cleanup:
+  free(hist);
+  free(colors);
+  free(lookup);
+  return size;
+}
+
+int rgba2rawci(uint8_t *raw, uint8_t *out_palette, int *pal_len,
+               const rgba *img, int width, int height, int depth) {
+  return rgba2rawci_shared(&raw, out_palette, pal_len, 0, &img, &width,
+                           &height, 1, depth);
+}
+
 //---------------------------------------------------------
 // internal RGBA/IA -> PNG
 //---------------------------------------------------------
 
-int rgba2png(const char *png_filename, const rgba *img, int width, int height) {
-  int ret = 0;
-  INFO("Saving RGBA %dx%d to \"%s\"\n", width, height, png_filename);
+// PNG row filter types, PNG_FILTER_ADAPTIVE picks one per row
+enum {
+  PNG_FILTER_NONE,
+  PNG_FILTER_SUB,
+  PNG_FILTER_UP,
+  PNG_FILTER_AVERAGE,
+  PNG_FILTER_PAETH,
+  PNG_FILTER_ADAPTIVE,
+};
+
+static png_options png_defaults = {PNG_EFFORT_DEFAULT, NULL};
+
+void png_set_default_options(const png_options *opts) { png_defaults = *opts; }
 
-  // convert to format stb_image_write expects
-  uint8_t *data = malloc(4 * width * height);
-  if (data) {
-    for (int j = 0; j < height; j++) {
-      for (int i = 0; i < width; i++) {
-        int idx = j * width + i;
-        data[4 * idx] = img[idx].red;
-        data[4 * idx + 1] = img[idx].green;
-        data[4 * idx + 2] = img[idx].blue;
-        data[4 * idx + 3] = img[idx].alpha;
+static uint8_t *png_deflate_builtin(const uint8_t *data, int length,
+                                    int *out_length, int level) {
+#if defined(N64GRAPHICS_ZLIB)
+  uLongf out_len = compressBound(length);
+  uint8_t *out = malloc(out_len);
+  if (out && compress2(out, &out_len, data, length, level) == Z_OK) {
+    *out_length = out_len;
+    return out;
+  }
+  free(out);
+  return NULL;
+#else
+  return stbi_zlib_compress((unsigned char *)data, length, out_length, level);
+#endif
+}
+
+static inline int png_paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+// filter one row of 'length' bytes into out[0] = type, out[1..length]
+static void png_filter_row(uint8_t *out, const uint8_t *row,
+                           const uint8_t *prev, int length, int bpp,
+                           int type) {
+  int i;
+  *out++ = type;
+  switch (type) {
+  case PNG_FILTER_NONE:
+    memcpy(out, row, length);
+    break;
+  case PNG_FILTER_SUB:
+    memcpy(out, row, bpp);
+    for (i = bpp; i < length; i++) {
+      out[i] = row[i] - row[i - bpp];
+    }
+    break;
+  case PNG_FILTER_UP:
+    for (i = 0; i < length; i++) {
+      out[i] = row[i] - prev[i];
+    }
+    break;
+  case PNG_FILTER_AVERAGE:
+    for (i = 0; i < bpp; i++) {
+      out[i] = row[i] - (prev[i] >> 1);
+    }
+    for (; i < length; i++) {
+      out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+    }
+    break;
+  case PNG_FILTER_PAETH:
+    for (i = 0; i < bpp; i++) {
+      out[i] = row[i] - prev[i];
+    }
+    for (; i < length; i++) {
+      out[i] = row[i] - png_paeth(row[i - bpp], prev[i], prev[i - bpp]);
+    }
+    break;
+  }
+}
+
+// filter the whole image, PNG_FILTER_ADAPTIVE chooses the filter with the
+// smallest sum of absolute differences for each row, as libpng does
+static void png_filter_image(uint8_t *out, const uint8_t *pixels, int width,
+                             int height, int bpp, int filter,
+                             uint8_t *scratch) {
+  int stride = width * bpp;
+  uint8_t *zero = scratch;
+  uint8_t *trial = scratch + stride;
+
+  memset(zero, 0, stride);
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = &pixels[y * stride];
+    const uint8_t *prev = y ? row - stride : zero;
+    uint8_t *dst = &out[y * (stride + 1)];
+    if (filter != PNG_FILTER_ADAPTIVE) {
+      png_filter_row(dst, row, prev, stride, bpp, filter);
+      continue;
+    }
+    unsigned best_cost = ~0u;
+    for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+      unsigned cost = 0;
+      png_filter_row(trial, row, prev, stride, bpp, type);
+      for (int i = 1; i <= stride; i++) {
+        cost += abs((int8_t)trial[i]);
+      }
+      if (cost < best_cost) {
+        best_cost = cost;
+        memcpy(dst, trial, stride + 1);
       }
     }
+  }
+}
+
+// PNG CRC-32 table: entry n is byte n shifted through the reflected
+// polynomial 0xEDB88320
+static const uint32_t png_crc_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+static uint32_t png_crc(uint32_t crc, const uint8_t *buf, size_t length) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = png_crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static uint8_t *png_chunk(uint8_t *out, const char *type, const uint8_t *data,
+                          uint32_t length) {
+  uint32_t crc;
+  write_u32_be(out, length);
+  memcpy(out + 4, type, 4);
+  if (length) {
+    memcpy(out + 8, data, length);
+  }
+  crc = png_crc(0, out + 4, length + 4);
+  write_u32_be(out + 8 + length, crc);
+  return out + 12 + length;
+}
+
+static int png_write(const char *png_filename, const uint8_t *pixels,
+                     int width, int height, int channels,
+                     const png_options *opts, png_stats *stats) {
+  static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+  png_deflate_fn deflate;
+  struct timespec start, end;
+  uint8_t ihdr[13];
+  uint8_t *filtered = NULL;
+  uint8_t *scratch = NULL;
+  uint8_t *idat = NULL;
+  uint8_t *png = NULL;
+  int stride = width * channels;
+  int filtered_len = height * (stride + 1);
+  int idat_len = 0;
+  int ret = 0;
+
+  // failed writes report nothing written
+  if (stats) {
+    stats->bytes = 0;
+    stats->seconds = 0;
+  }
+  timespec_get(&start, TIME_UTC);
+  if (!opts) {
+    opts = &png_defaults;
+  }
+  deflate = opts->deflate ? opts->deflate : png_deflate_builtin;
 
-    ret = stbi_write_png(png_filename, width, height, 4, data, 0);
+  filtered = malloc(filtered_len);
+  scratch = malloc(2 * stride + 1);
+  if (!filtered || !scratch) {
+    ERROR("Error allocating %d bytes\n", filtered_len);
+    goto cleanup;
+  }
+  switch (opts->effort) {
+  case PNG_EFFORT_FAST:
+    png_filter_image(filtered, pixels, width, height, channels,
+                     PNG_FILTER_NONE, scratch);
+    idat = deflate(filtered, filtered_len, &idat_len, 1);
+    break;
+  case PNG_EFFORT_MAX:
+    // keep the smallest of adaptive and every fixed filter
+    for (int filter = PNG_FILTER_ADAPTIVE; filter >= PNG_FILTER_NONE;
+         filter--) {
+      int trial_len = 0;
+      uint8_t *trial;
+      png_filter_image(filtered, pixels, width, height, channels, filter,
+                       scratch);
+      trial = deflate(filtered, filtered_len, &trial_len, 9);
+      if (trial && (!idat || trial_len < idat_len)) {
+        free(idat);
+        idat = trial;
+        idat_len = trial_len;
+      } else {
+        free(trial);
+      }
+    }
+    break;
+  default:
+    png_filter_image(filtered, pixels, width, height, channels,
+                     PNG_FILTER_ADAPTIVE, scratch);
+    idat = deflate(filtered, filtered_len, &idat_len, 6);
+    break;
+  }
+  if (!idat) {
+    ERROR("Error compressing \"%s\"\n", png_filename);
+    goto cleanup;
+  }
 
-    free(data);
+  write_u32_be(&ihdr[0], width);
+  write_u32_be(&ihdr[4], height);
+  ihdr[8] = 8;                       // bits per channel
+  ihdr[9] = channels == 4 ? 6 : 4;   // RGBA or grey + alpha
+  ihdr[10] = ihdr[11] = ihdr[12] = 0; // deflate, adaptive filter, progressive
+
+  size_t png_len = sizeof(signature) + 12 + sizeof(ihdr) + 12 + idat_len + 12;
+  png = malloc(png_len);
+  if (!png) {
+    ERROR("Error allocating %zu bytes\n", png_len);
+    goto cleanup;
+  }
+  uint8_t *p = png;
+  memcpy(p, signature, sizeof(signature));
+  p = png_chunk(p + sizeof(signature), "IHDR", ihdr, sizeof(ihdr));
+  p = png_chunk(p, "IDAT", idat, idat_len);
+  png_chunk(p, "IEND", NULL, 0);
+
+  ret = write_file(png_filename, png, png_len) == (long)png_len;
+  timespec_get(&end, TIME_UTC);
+  if (stats) {
+    stats->bytes = ret ? (long)png_len : 0;
+    stats->seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
   }
 
+cleanup:
+  free(filtered);
+  free(scratch);
+  free(idat);
+  free(png);
   return ret;
 }
 
-int ia2png(const char *png_filename, const ia *img, int width, int height) {
-  int ret = 0;
+int rgba2png_opts(const char *png_filename, const rgba *img, int width,
+                  int height, const png_options *opts, png_stats *stats) {
+  INFO("Saving RGBA %dx%d to \"%s\"\n", width, height, png_filename);
+  return png_write(png_filename, (const uint8_t *)img, width, height, 4, opts,
+                   stats);
+}
+
+int ia2png_opts(const char *png_filename, const ia *img, int width,
+                int height, const png_options *opts, png_stats *stats) {
   INFO("Saving IA %dx%d to \"%s\"\n", width, height, png_filename);
+  return png_write(png_filename, (const uint8_t *)img, width, height, 2, opts,
+                   stats);
+}
 
-  // convert to format stb_image_write expects
-  uint8_t *data = malloc(2 * width * height);
-  if (data) {
-    for (int j = 0; j < height; j++) {
-      for (int i = 0; i < width; i++) {
-        int idx = j * width + i;
-        data[2 * idx] = img[idx].intensity;
-        data[2 * idx + 1] = img[idx].alpha;
-      }
-    }
-
-    ret = stbi_write_png(png_filename, width, height, 2, data, 0);
-
-    free(data);
-  }
+// rgba and ia are laid out as the 4 and 2 channel pixels PNG stores, so rows
+// are filtered straight from the image
+int rgba2png(const char *png_filename, const rgba *img, int width, int height) {
+  return rgba2png_opts(png_filename, img, width, height, NULL, NULL);
+}
 
-  return ret;
+int ia2png(const char *png_filename, const ia *img, int width, int height) {
+  return ia2png_opts(png_filename, img, width, height, NULL, NULL);
 }
 
 //---------------------------------------------------------
 // PNG -> internal RGBA/IA
 //---------------------------------------------------------
 
-rgba *png2rgba(const char *png_filename, int *width, int *height) {
-  rgba *img = NULL;
+static stbi_uc *png_load(const char *png_filename, int *width, int *height,
+                         int *channels) {
   int w = 0;
   int h = 0;
-  int channels = 0;
-  int img_size;
 
-  stbi_uc *data = stbi_load(png_filename, &w, &h, &channels, STBI_default);
+  stbi_uc *data = stbi_load(png_filename, &w, &h, channels, STBI_default);
   if (!data || w <= 0 || h <= 0) {
     ERROR("Error loading \"%s\"\n", png_filename);
+    if (data) {
+      stbi_image_free(data);
+    }
     return NULL;
   }
-  INFO("Read \"%s\" %dx%d channels: %d\n", png_filename, w, h, channels);
+  INFO("Read \"%s\" %dx%d channels: %d\n", png_filename, w, h, *channels);
 
-  img_size = w * h * sizeof(*img);
-  img = malloc(img_size);
-  if (!img) {
-    ERROR("Error allocating %u bytes\n", img_size);
-    return NULL;
-  }
+  *width = w;
+  *height = h;
+  return data;
+}
 
+static int png_to_rgba(rgba *img, const stbi_uc *data, int w, int h,
+                       int channels) {
   switch (channels) {
   case 3: // red, green, blue
   case 4: // red, green, blue, alpha
@@ -411,38 +1260,13 @@ rgba *png2rgba(const char *png_filename, int *width, int *height) {
     break;
   default:
     ERROR("Don't know how to read channels: %d\n", channels);
-    free(img);
-    img = NULL;
+    return -1;
   }
-
-  // cleanup
-  stbi_image_free(data);
-
-  *width = w;
-  *height = h;
-  return img;
+  return 0;
 }
 
-ia *png2ia(const char *png_filename, int *width, int *height) {
-  ia *img = NULL;
-  int w = 0, h = 0;
-  int channels = 0;
-  int img_size;
-
-  stbi_uc *data = stbi_load(png_filename, &w, &h, &channels, STBI_default);
-  if (!data || w <= 0 || h <= 0) {
-    ERROR("Error loading \"%s\"\n", png_filename);
-    return NULL;
-  }
-  INFO("Read \"%s\" %dx%d channels: %d\n", png_filename, w, h, channels);
-
-  img_size = w * h * sizeof(*img);
-  img = malloc(img_size);
-  if (!img) {
-    ERROR("Error allocating %d bytes\n", img_size);
-    return NULL;
-  }
-
+static int png_to_ia(ia *img, const stbi_uc *data, int w, int h,
+                     int channels) {
   switch (channels) {
   case 3: // red, green, blue
   case 4: // red, green, blue, alpha
@@ -463,16 +1287,60 @@ ia *png2ia(const char *png_filename, int *width, int *height) {
     }
     break;
   case 2: // grey, alpha
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-        int idx = j * w + i;
-        img[idx].intensity = data[2 * idx];
-        img[idx].alpha = data[2 * idx + 1];
-      }
-    }
+    memcpy(img, data, w * h * sizeof(*img));
     break;
   default:
     ERROR("Don't know how to read channels: %d\n", channels);
+    return -1;
+  }
+  return 0;
+}
+
+rgba *png2rgba(const char *png_filename, int *width, int *height) {
+  rgba *img = NULL;
+  int w = 0;
+  int h = 0;
+  int channels = 0;
+  int img_size;
+
+  stbi_uc *data = png_load(png_filename, &w, &h, &channels);
+  if (!data) {
+    return NULL;
+  }
+
+  img_size = w * h * sizeof(*img);
+  img = malloc(img_size);
+  if (!img) {
+    ERROR("Error allocating %u bytes\n", img_size);
+  } else if (png_to_rgba(img, data, w, h, channels) < 0) {
+    free(img);
+    img = NULL;
+  }
+
+  // cleanup
+  stbi_image_free(data);
+
+  *width = w;
+  *height = h;
+  return img;
+}
+
+ia *png2ia(const char *png_filename, int *width, int *height) {
+  ia *img = NULL;
+  int w = 0, h = 0;
+  int channels = 0;
+  int img_size;
+
+  stbi_uc *data = png_load(png_filename, &w, &h, &channels);
+  if (!data) {
+    return NULL;
+  }
+
+  img_size = w * h * sizeof(*img);
+  img = malloc(img_size);
+  if (!img) {
+    ERROR("Error allocating %d bytes\n", img_size);
+  } else if (png_to_ia(img, data, w, h, channels) < 0) {
     free(img);
     img = NULL;
   }
@@ -485,15 +1353,65 @@ ia *png2ia(const char *png_filename, int *width, int *height) {
   return img;
 }
 
+rgba *png2rgba_into(texture_scratch *scratch, const char *png_filename,
+                    int *width, int *height) {
+  rgba *img;
+  int w = 0, h = 0;
+  int channels = 0;
+
+  stbi_uc *data = png_load(png_filename, &w, &h, &channels);
+  if (!data) {
+    return NULL;
+  }
+
+  img = texture_scratch_reserve(scratch, w * h * sizeof(*img));
+  if (img && png_to_rgba(img, data, w, h, channels) < 0) {
+    img = NULL;
+  }
+
+  stbi_image_free(data);
+
+  *width = w;
+  *height = h;
+  return img;
+}
+
+ia *png2ia_into(texture_scratch *scratch, const char *png_filename, int *width,
+                int *height) {
+  ia *img;
+  int w = 0, h = 0;
+  int channels = 0;
+
+  stbi_uc *data = png_load(png_filename, &w, &h, &channels);
+  if (!data) {
+    return NULL;
+  }
+
+  img = texture_scratch_reserve(scratch, w * h * sizeof(*img));
+  if (img && png_to_ia(img, data, w, h, channels) < 0) {
+    img = NULL;
+  }
+
+  stbi_image_free(data);
+
+  *width = w;
+  *height = h;
+  return img;
+}
+
 const char *n64graphics_get_read_version(void) { return "stb_image 2.19"; }
 
 const char *n64graphics_get_write_version(void) {
-  return "stb_image_write 1.09";
+#if defined(N64GRAPHICS_ZLIB)
+  return "zlib " ZLIB_VERSION;
+#else
+  return "stb_image_write 1.09 deflate";
+#endif
 }
 
 #ifdef N64GRAPHICS_STANDALONE
-#define N64GRAPHICS_VERSION "0.3"
-#include <string.h>
+#define N64GRAPHICS_VERSION "0.4"
+#include "parallel.h"
 
 typedef enum {
   MODE_EXPORT,
@@ -503,27 +1421,51 @@ typedef enum {
 typedef struct {
   char *img_filename;
   char *bin_filename;
+  char *manifest_filename;
   tool_mode mode;
   unsigned int offset;
   img_format format;
   int depth;
   int width;
   int height;
-  int truncate;
+  int threads;
+  bool concat;
+  bool has_offset; // -o given with -i
 } graphics_config;
 
 static const graphics_config default_config = {
     .img_filename = NULL,
     .bin_filename = NULL,
+    .manifest_filename = NULL,
     .mode = MODE_EXPORT,
     .offset = 0,
     .format = IMG_FORMAT_RGBA,
     .depth = 16,
     .width = 32,
     .height = 32,
-    .truncate = 1,
+    .threads = 0,
+    .concat = false,
+    .has_offset = false,
 };
 
+// one PNG <-> raw conversion
+typedef struct {
+  tool_mode mode;
+  img_format format;
+  int depth;
+  char *img_filename;
+  char *bin_filename;
+  unsigned int offset;
+  bool has_offset; // import: write at offset rather than truncating
+  int width;
+  int height;
+  int line; // manifest line, 0 for command line
+  // import result, written out after all conversions are done
+  uint8_t *raw;
+  int length;
+  bool failed;
+} graphics_job;
+
 typedef struct {
   const char *name;
   img_format format;
@@ -538,11 +1480,11 @@ static const format_entry format_table[] = {
     {"ci8", IMG_FORMAT_CI, 8},       {"ci16", IMG_FORMAT_CI, 16},
 };
 
-static int parse_format(graphics_config *config, const char *str) {
+static int parse_format(img_format *format, int *depth, const char *str) {
   for (unsigned i = 0; i < DIM(format_table); i++) {
     if (!strcasecmp(str, format_table[i].name)) {
-      config->format = format_table[i].format;
-      config->depth = format_table[i].depth;
+      *format = format_table[i].format;
+      *depth = format_table[i].depth;
       return 1;
     }
   }
@@ -594,20 +1536,35 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config) {
                     &config->height, false, NULL, 0);
 
   argparse_add_flag(parser, 'o', "offset", ARG_TYPE_UINT,
-                    "offset in output file to write to (default: 0)", "OFFSET",
-                    &config->offset, false, NULL, 0);
+                    "offset in BIN_FILE to read from or write to (default: 0)",
+                    "OFFSET", &config->offset, false, NULL, 0);
 
   argparse_add_flag(parser, 'v', "verbose", ARG_TYPE_NONE,
                     "verbose progress output", NULL, &g_verbosity, false, NULL,
                     0);
 
+  argparse_add_flag(parser, 'm', "manifest", ARG_TYPE_STRING,
+                    "run every conversion listed in MANIFEST, one per line: "
+                    "import|export FORMAT PNG_FILE BIN_FILE [OFFSET [WIDTH "
+                    "HEIGHT]]",
+                    "MANIFEST", &config->manifest_filename, false, NULL, 0);
+
+  argparse_add_flag(parser, 'c', "concat", ARG_TYPE_NONE,
+                    "let manifest imports share a BIN_FILE, each written at "
+                    "its OFFSET or after the previous one",
+                    NULL, &config->concat, false, NULL, 0);
+
+  argparse_add_flag(parser, 't', "threads", ARG_TYPE_INT,
+                    "manifest worker threads (default: one per CPU)", "N",
+                    &config->threads, false, NULL, 0);
+
   // Parse the arguments
   result = argparse_parse(parser, argc, argv);
 
   // Process format selection
   if (result == 0 && parser->flags[3].processed) { // 'f' flag was used
     const char *format_str = format_options[format_index];
-    if (!parse_format(config, format_str)) {
+    if (!parse_format(&config->format, &config->depth, format_str)) {
       ERROR("Error: invalid format '%s'\n", format_str);
       result = -1;
     }
@@ -621,7 +1578,7 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config) {
   }
 
   // Check for required arguments
-  if (result == 0) {
+  if (result == 0 && config->manifest_filename == NULL) {
     if (config->bin_filename == NULL) {
       ERROR("Error: must specify either -e BIN_FILE or -i BIN_FILE\n");
       result = -1;
@@ -633,125 +1590,343 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config) {
     }
   }
 
+  // an explicit offset on import writes into the existing file
+  if (result == 0 && config->mode == MODE_IMPORT &&
+      parser->flags[6].processed) {
+    config->has_offset = true;
+  }
+
   // Free the parser
   argparse_free(parser);
 
   return result;
 }
 
-int main(int argc, char *argv[]) {
-  graphics_config config = default_config;
-  rgba *imgr;
-  ia *imgi;
+// read a manifest into jobs
+// returns number of jobs or -1 on error
+static int parse_manifest(const char *filename, graphics_job **jobs_out) {
+  char line[3 * FILENAME_MAX];
+  graphics_job *jobs = NULL;
+  int count = 0;
+  int capacity = 0;
+  int line_num = 0;
   FILE *fp;
-  uint8_t *raw;
-  int raw_size;
-  int length = 0;
-  int flength;
-  int res;
 
-  int valid = parse_arguments(argc, argv, &config);
-  if (valid <= 0 || !config.bin_filename || !config.img_filename) {
-    exit(EXIT_FAILURE);
+  fp = fopen(filename, "r");
+  if (!fp) {
+    ERROR("Error opening \"%s\"\n", filename);
+    return -1;
   }
-
-  if (config.mode == MODE_IMPORT) {
-    if (config.truncate) {
-      fp = fopen(config.bin_filename, "w");
+  while (fgets(line, sizeof(line), fp)) {
+    char *fields[7];
+    int field_count = 0;
+    char *tok;
+    graphics_job *job;
+
+    line_num++;
+    for (tok = strtok(line, " \t\r\n"); tok && tok[0] != '#' && field_count < 7;
+         tok = strtok(NULL, " \t\r\n")) {
+      fields[field_count++] = tok;
+    }
+    if (field_count == 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      jobs = realloc(jobs, capacity * sizeof(*jobs));
+    }
+    job = &jobs[count];
+    memset(job, 0, sizeof(*job));
+    job->line = line_num;
+    job->width = default_config.width;
+    job->height = default_config.height;
+    if (field_count < 4 || field_count == 6) {
+      ERROR("%s:%d: expected MODE FORMAT PNG_FILE BIN_FILE [OFFSET [WIDTH "
+            "HEIGHT]]\n",
+            filename, line_num);
+      goto error;
+    }
+    if (!strcasecmp(fields[0], "import")) {
+      job->mode = MODE_IMPORT;
+    } else if (!strcasecmp(fields[0], "export")) {
+      job->mode = MODE_EXPORT;
     } else {
-      fp = fopen(config.bin_filename, "r+");
+      ERROR("%s:%d: unknown mode \"%s\"\n", filename, line_num, fields[0]);
+      goto error;
     }
-    if (!fp) {
-      ERROR("Error opening \"%s\"\n", config.bin_filename);
+    if (!parse_format(&job->format, &job->depth, fields[1])) {
+      ERROR("%s:%d: unknown format \"%s\"\n", filename, line_num, fields[1]);
+      goto error;
+    }
+    job->img_filename = strdup(fields[2]);
+    job->bin_filename = strdup(fields[3]);
+    count++;
+    if (field_count > 4) {
+      job->offset = strtoul(fields[4], NULL, 0);
+      job->has_offset = true;
+    }
+    if (field_count > 6) {
+      job->width = strtol(fields[5], NULL, 0);
+      job->height = strtol(fields[6], NULL, 0);
+    }
+  }
+  fclose(fp);
+  *jobs_out = jobs;
+  return count;
+
+error:
+  fclose(fp);
+  for (int i = 0; i < count; i++) {
+    free(jobs[i].img_filename);
+    free(jobs[i].bin_filename);
+  }
+  free(jobs);
+  return -1;
+}
+
+// PNG_FILE -> job->raw
+static int job_import(graphics_job *job) {
+  rgba *imgr;
+  ia *imgi;
+  int width = 0;
+  int height = 0;
+  int raw_size;
+
+  switch (job->format) {
+  case IMG_FORMAT_RGBA:
+    imgr = png2rgba(job->img_filename, &width, &height);
+    if (!imgr) {
       return -1;
     }
-    if (!config.truncate) {
-      fseek(fp, config.offset, SEEK_SET);
+    raw_size = width * height * job->depth / 8;
+    job->raw = malloc(raw_size);
+    job->length = job->raw ? rgba2raw(job->raw, imgr, width, height, job->depth)
+                           : -1;
+    free(imgr);
+    break;
+  case IMG_FORMAT_IA:
+  case IMG_FORMAT_I:
+    imgi = png2ia(job->img_filename, &width, &height);
+    if (!imgi) {
+      return -1;
     }
-    switch (config.format) {
-    case IMG_FORMAT_RGBA:
-      imgr = png2rgba(config.img_filename, &config.width, &config.height);
-      raw_size = config.width * config.height * config.depth / 8;
-      raw = malloc(raw_size);
-      if (!raw) {
-        ERROR("Error allocating %u bytes\n", raw_size);
-      }
-      length = rgba2raw(raw, imgr, config.width, config.height, config.depth);
-      break;
-    case IMG_FORMAT_IA:
-      imgi = png2ia(config.img_filename, &config.width, &config.height);
-      raw_size = config.width * config.height * config.depth / 8;
-      raw = malloc(raw_size);
-      if (!raw) {
-        ERROR("Error allocating %u bytes\n", raw_size);
-      }
-      length = ia2raw(raw, imgi, config.width, config.height, config.depth);
-      break;
-    case IMG_FORMAT_I:
-      imgi = png2ia(config.img_filename, &config.width, &config.height);
-      raw_size = config.width * config.height * config.depth / 8;
-      raw = malloc(raw_size);
-      if (!raw) {
-        ERROR("Error allocating %u bytes\n", raw_size);
-      }
-      length = i2raw(raw, imgi, config.width, config.height, config.depth);
-      break;
-    default:
-      return EXIT_FAILURE;
+    // 4 and 1-bit encoders merge into existing bits of a partial last byte
+    raw_size = (width * height * job->depth + 7) / 8;
+    job->raw = calloc(raw_size, 1);
+    if (!job->raw) {
+      job->length = -1;
+    } else if (job->format == IMG_FORMAT_IA) {
+      job->length = ia2raw(job->raw, imgi, width, height, job->depth);
+    } else {
+      job->length = i2raw(job->raw, imgi, width, height, job->depth);
     }
-    if (length <= 0) {
-      ERROR("Error converting to raw format\n");
-      return EXIT_FAILURE;
+    free(imgi);
+    break;
+  default:
+    ERROR("Error: import of CI formats is not supported\n");
+    return -1;
+  }
+  if (job->length <= 0) {
+    ERROR("Error converting \"%s\" to raw format\n", job->img_filename);
+    return -1;
+  }
+  return 0;
+}
+
+// BIN_FILE -> PNG_FILE
+static int job_export(graphics_job *job) {
+  texture_scratch scratch = {NULL, 0};
+  uint8_t *raw;
+  FILE *fp;
+  int raw_size;
+  int flength;
+  int res = 0;
+
+  if (job->width <= 0 || job->height <= 0 || job->depth <= 0) {
+    ERROR("Error: must set position width and height for export\n");
+    return -1;
+  }
+  fp = fopen(job->bin_filename, "rb");
+  if (!fp) {
+    ERROR("Error opening \"%s\"\n", job->bin_filename);
+    return -1;
+  }
+  raw_size = job->width * job->height * job->depth / 8;
+  raw = calloc(raw_size, 1);
+  if (job->offset > 0) {
+    fseek(fp, job->offset, SEEK_SET);
+  }
+  flength = fread(raw, 1, raw_size, fp);
+  fclose(fp);
+  if (flength != raw_size) {
+    ERROR("Error reading %d bytes from \"%s\"\n", raw_size, job->bin_filename);
+  }
+  switch (job->format) {
+  case IMG_FORMAT_RGBA: {
+    rgba *img =
+        texture_scratch_reserve(&scratch, job->width * job->height * 4);
+    if (img &&
+        raw2rgba_into(img, raw, job->width, job->height, job->depth) == 0) {
+      res = rgba2png(job->img_filename, img, job->width, job->height);
     }
-    INFO("Writing 0x%X bytes to offset 0x%X of \"%s\"\n", length, config.offset,
-         config.bin_filename);
-    flength = fwrite(raw, 1, length, fp);
-    if (flength != length) {
-      ERROR("Error writing %d bytes to \"%s\"\n", length, config.bin_filename);
+    break;
+  }
+  case IMG_FORMAT_IA:
+  case IMG_FORMAT_I: {
+    ia *img = texture_scratch_reserve(&scratch, job->width * job->height * 2);
+    if (img && (job->format == IMG_FORMAT_IA
+                    ? raw2ia_into(img, raw, job->width, job->height, job->depth)
+                    : raw2i_into(img, raw, job->width, job->height,
+                                 job->depth)) == 0) {
+      res = ia2png(job->img_filename, img, job->width, job->height);
     }
-    fclose(fp);
+    break;
+  }
+  default:
+    ERROR("Error: export of CI formats is not supported\n");
+    break;
+  }
+  free(raw);
+  texture_scratch_free(&scratch);
+  if (!res) {
+    ERROR("Error writing to \"%s\"\n", job->img_filename);
+    return -1;
+  }
+  return 0;
+}
 
+static void graphics_job_fn(int index, int worker, void *arg) {
+  graphics_job *job = &((graphics_job *)arg)[index];
+  (void)worker;
+  if (job->mode == MODE_IMPORT) {
+    job->failed = job_import(job) < 0;
   } else {
-    if (config.width <= 0 || config.height <= 0 || config.depth <= 0) {
-      ERROR("Error: must set position width and height for export\n");
-      return EXIT_FAILURE;
+    job->failed = job_export(job) < 0;
+  }
+}
+
+static int job_bin_cmp(const void *a, const void *b) {
+  const graphics_job *ja = *(const graphics_job *const *)a;
+  const graphics_job *jb = *(const graphics_job *const *)b;
+  int cmp = strcmp(ja->bin_filename, jb->bin_filename);
+  return cmp ? cmp : ja->line - jb->line;
+}
+
+// write converted imports, opening each BIN_FILE once
+// returns number of files that failed
+static int write_imports(graphics_job *jobs, int count, bool concat) {
+  graphics_job **order;
+  int order_count = 0;
+  int failures = 0;
+
+  order = malloc(count * sizeof(*order));
+  for (int i = 0; i < count; i++) {
+    if (jobs[i].mode == MODE_IMPORT && !jobs[i].failed) {
+      order[order_count++] = &jobs[i];
+    }
+  }
+  // group by file, keeping manifest order within each
+  qsort(order, order_count, sizeof(*order), job_bin_cmp);
+
+  for (int start = 0, end; start < order_count; start = end) {
+    const char *bin_filename = order[start]->bin_filename;
+    bool has_offset = false;
+    long position = 0;
+    FILE *fp;
+
+    for (end = start; end < order_count &&
+                      !strcmp(order[end]->bin_filename, bin_filename);
+         end++) {
+      has_offset |= order[end]->has_offset;
+    }
+    if (end - start > 1 && !concat) {
+      ERROR("Error: %d imports to \"%s\", use --concat to combine them\n",
+            end - start, bin_filename);
+      failures++;
+      continue;
     }
-    fp = fopen(config.bin_filename, "r");
+
+    // only truncate when nothing is placed at an explicit offset
+    fp = has_offset ? fopen(bin_filename, "r+b") : NULL;
     if (!fp) {
-      ERROR("Error opening \"%s\"\n", config.bin_filename);
-      return -1;
+      fp = fopen(bin_filename, "wb");
     }
-    raw_size = config.width * config.height * config.depth / 8;
-    raw = malloc(raw_size);
-    if (config.offset > 0) {
-      fseek(fp, config.offset, SEEK_SET);
+    if (!fp) {
+      ERROR("Error opening \"%s\"\n", bin_filename);
+      failures++;
+      continue;
     }
-    flength = fread(raw, 1, raw_size, fp);
-    if (flength != raw_size) {
-      ERROR("Error reading %d bytes from \"%s\"\n", raw_size,
-            config.bin_filename);
+    for (int i = start; i < end; i++) {
+      graphics_job *job = order[i];
+      if (job->has_offset) {
+        position = job->offset;
+      }
+      INFO("Writing 0x%X bytes to offset 0x%lX of \"%s\"\n", job->length,
+           position, bin_filename);
+      if (fseek(fp, position, SEEK_SET) != 0 ||
+          (int)fwrite(job->raw, 1, job->length, fp) != job->length) {
+        ERROR("Error writing %d bytes to \"%s\"\n", job->length, bin_filename);
+        failures++;
+        break;
+      }
+      position += job->length;
     }
-    switch (config.format) {
-    case IMG_FORMAT_RGBA:
-      imgr = raw2rgba(raw, config.width, config.height, config.depth);
-      res = rgba2png(config.img_filename, imgr, config.width, config.height);
-      break;
-    case IMG_FORMAT_IA:
-      imgi = raw2ia(raw, config.width, config.height, config.depth);
-      res = ia2png(config.img_filename, imgi, config.width, config.height);
-      break;
-    case IMG_FORMAT_I:
-      imgi = raw2i(raw, config.width, config.height, config.depth);
-      res = ia2png(config.img_filename, imgi, config.width, config.height);
-      break;
-    default:
-      return EXIT_FAILURE;
+    fclose(fp);
+  }
+
+  free(order);
+  return failures;
+}
+
+int main(int argc, char *argv[]) {
+  graphics_config config = default_config;
+  graphics_job single;
+  graphics_job *jobs;
+  int job_count;
+  int failures = 0;
+
+  if (parse_arguments(argc, argv, &config) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.manifest_filename) {
+    job_count = parse_manifest(config.manifest_filename, &jobs);
+    if (job_count < 0) {
+      exit(EXIT_FAILURE);
     }
-    if (!res) {
-      ERROR("Error writing to \"%s\"\n", config.img_filename);
+  } else {
+    memset(&single, 0, sizeof(single));
+    single.mode = config.mode;
+    single.format = config.format;
+    single.depth = config.depth;
+    single.img_filename = config.img_filename;
+    single.bin_filename = config.bin_filename;
+    single.offset = config.offset;
+    single.has_offset = config.has_offset;
+    single.width = config.width;
+    single.height = config.height;
+    jobs = &single;
+    job_count = 1;
+  }
+
+  parallel_for(job_count, config.threads, graphics_job_fn, jobs);
+  for (int i = 0; i < job_count; i++) {
+    failures += jobs[i].failed;
+  }
+  failures += write_imports(jobs, job_count, config.concat);
+
+  if (config.manifest_filename) {
+    INFO("Processed %d textures, %d failures\n", job_count, failures);
+    for (int i = 0; i < job_count; i++) {
+      free(jobs[i].img_filename);
+      free(jobs[i].bin_filename);
+      free(jobs[i].raw);
     }
+    free(jobs);
+  } else {
+    free(single.raw);
   }
 
-  return EXIT_SUCCESS;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 #endif // N64GRAPHICS_STANDALONE
@@ -1,6 +1,7 @@
 #ifndef N64GRAPHICS_H_
 #define N64GRAPHICS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 // intermediate formats
@@ -16,22 +17,46 @@ typedef struct _ia {
   uint8_t alpha;
 } ia;
 
+// reusable buffer for intermediate images. it grows to fit the largest
+// request and is only released by texture_scratch_free(), so converting many
+// textures through one scratch buffer allocates a handful of times in total.
+// zero initialize before first use
+typedef struct {
+  void *data;
+  size_t capacity;
+} texture_scratch;
+
+// get a buffer of at least size bytes, invalidating earlier results
+// returns NULL if it can't be allocated
+void *texture_scratch_reserve(texture_scratch *scratch, size_t size);
+
+// free the buffer, the scratch can be reused afterwards
+void texture_scratch_free(texture_scratch *scratch);
+
 //---------------------------------------------------------
 // N64 RGBA/IA/I/CI -> intermediate RGBA/IA
+// the _into variants write width * height pixels to a caller provided 'img'
+// and return 0 on success or -1 on invalid depth
 //---------------------------------------------------------
 
 // N64 raw RGBA16/RGBA32 -> intermediate RGBA
 rgba *raw2rgba(const uint8_t *raw, int width, int height, int depth);
+int raw2rgba_into(rgba *img, const uint8_t *raw, int width, int height,
+                  int depth);
 
 // N64 raw IA1/IA4/IA8/IA16 -> intermediate IA
 ia *raw2ia(const uint8_t *raw, int width, int height, int depth);
+int raw2ia_into(ia *img, const uint8_t *raw, int width, int height, int depth);
 
 // N64 raw I4/I8 -> intermediate IA
 ia *raw2i(const uint8_t *raw, int width, int height, int depth);
+int raw2i_into(ia *img, const uint8_t *raw, int width, int height, int depth);
 
-// N64 raw CI + palette -> intermediate RGBA
+// N64 raw CI8 + RGBA16/RGBA32 palette -> intermediate RGBA
 rgba *rawci2rgba(const uint8_t *rawci, const uint8_t *palette, int width,
                  int height, int depth);
+int rawci2rgba_into(rgba *img, const uint8_t *rawci, const uint8_t *palette,
+                    int width, int height, int depth);
 
 //---------------------------------------------------------
 // intermediate RGBA/IA -> N64 RGBA/IA/I/CI
@@ -47,21 +72,70 @@ int ia2raw(uint8_t *raw, const ia *img, int width, int height, int depth);
 // intermediate IA -> N64 raw I4/I8
 int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth);
 
-// intermediate RGBA -> N64 raw CI + palette
-// TODO
-// int rgba2rawci(uint8_t *raw, uint8_t *out_palette, int *pal_len, const rgba
-// *img, int width, int height, int depth);
+// intermediate RGBA -> N64 raw CI4/CI8 + RGBA16 palette
+// colors are matched exactly when they fit in the palette, otherwise they are
+// reduced with median cut and each pixel gets the nearest entry
+// out_palette: receives up to 1 << depth big-endian RGBA16 entries
+// pal_len: receives number of palette entries used
+int rgba2rawci(uint8_t *raw, uint8_t *out_palette, int *pal_len,
+               const rgba *img, int width, int height, int depth);
+
+// as above, for 'count' images sharing one palette
+// raws[i]: receives (widths[i] * heights[i] * depth + 7) / 8 bytes
+// max_colors: palette size limit, 0 for 1 << depth
+// returns total length written to 'raws' or -1 on error
+int rgba2rawci_shared(uint8_t *const *raws, uint8_t *out_palette, int *pal_len,
+                      int max_colors, const rgba *const *imgs,
+                      const int *widths, const int *heights, int count,
+                      int depth);
 
 //---------------------------------------------------------
 // intermediate RGBA/IA -> PNG
 //---------------------------------------------------------
 
+// trade-off between PNG write speed and file size
+typedef enum {
+  PNG_EFFORT_FAST,    // no row filtering, fastest deflate level
+  PNG_EFFORT_DEFAULT, // per-row filter selection, default deflate level
+  PNG_EFFORT_MAX,     // best of every filter strategy at maximum deflate level
+} png_effort;
+
+// deflate backend: compress 'length' bytes of 'data' into a zlib stream
+// level: 0-9 as in zlib
+// returns malloc'd stream and sets out_length, or NULL on error
+typedef uint8_t *(*png_deflate_fn)(const uint8_t *data, int length,
+                                   int *out_length, int level);
+
+typedef struct {
+  png_effort effort;
+  png_deflate_fn deflate; // NULL for the built-in backend
+} png_options;
+
+// per-file results of a PNG write
+typedef struct {
+  long bytes;     // size of the file written
+  double seconds; // time spent filtering, compressing and writing
+} png_stats;
+
+// set options used by rgba2png(), ia2png() and the _opts variants when
+// passed NULL. not thread safe, set before starting any workers
+void png_set_default_options(const png_options *opts);
+
 // intermediate RGBA write to PNG file
 int rgba2png(const char *png_filename, const rgba *img, int width, int height);
 
 // intermediate IA write to grayscale PNG file
 int ia2png(const char *png_filename, const ia *img, int width, int height);
 
+// as above, with explicit options
+// opts: NULL for the defaults
+// stats: filled in if not NULL, bytes is 0 if the write failed
+// returns 1 on success, 0 on error
+int rgba2png_opts(const char *png_filename, const rgba *img, int width,
+                  int height, const png_options *opts, png_stats *stats);
+int ia2png_opts(const char *png_filename, const ia *img, int width, int height,
+                const png_options *opts, png_stats *stats);
+
 //---------------------------------------------------------
 // PNG -> intermediate RGBA/IA
 //---------------------------------------------------------
@@ -72,6 +146,13 @@ rgba *png2rgba(const char *png_filename, int *width, int *height);
 // PNG file -> intermediate IA
 ia *png2ia(const char *png_filename, int *width, int *height);
 
+// as above, but decode into 'scratch' rather than a new allocation
+// returns pointer into scratch, valid until its next use, or NULL on error
+rgba *png2rgba_into(texture_scratch *scratch, const char *png_filename,
+                    int *width, int *height);
+ia *png2ia_into(texture_scratch *scratch, const char *png_filename, int *width,
+                int *height);
+
 //---------------------------------------------------------
 // version
 //---------------------------------------------------------
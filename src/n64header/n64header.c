@@ -1,22 +1,36 @@
 #include "argparse.h"
+#include "parallel.h"
+#include "romimage.h"
 #include "utils.h"
+#include <dirent.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define N64HEADER_VERSION "1.0"
 
 typedef struct {
   char *rom_file;
   bool verbose;
+  char *catalog_dir;
+  char *output_file;
+  int catalog_format;
+  int threads;
 } arg_config;
 
 static arg_config default_config = {
     NULL,  // ROM filename
     false, // verbose
+    NULL,  // catalog directory
+    NULL,  // catalog output file
+    0,     // catalog format (jsonl)
+    0,     // catalog threads (one per CPU)
 };
 
+static const char *catalog_format_values[] = {"jsonl", "csv"};
+
 typedef struct {
   // 0x00-0x03: Standard header fields
   unsigned char reserved_byte;    // 0x00: Reserved (0x80 for commercial games)
@@ -77,12 +91,32 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
                     "Enable verbose output", NULL, &config->verbose, false,
                     NULL, 0);
 
+  // Catalog mode
+  argparse_add_flag(parser, 0, "catalog", ARG_TYPE_STRING,
+                    "Catalog every ROM under DIR instead of showing one header",
+                    "DIR", &config->catalog_dir, false, NULL, 0);
+  argparse_add_flag(parser, 'o', "output", ARG_TYPE_STRING,
+                    "Catalog output file, unchanged files in an existing "
+                    "catalog are not rescanned (default: stdout)",
+                    "FILE", &config->output_file, false, NULL, 0);
+  argparse_add_flag(parser, 'f', "format", ARG_TYPE_ENUM,
+                    "Catalog format [jsonl, csv] (default: jsonl)", "FORMAT",
+                    &config->catalog_format, false, catalog_format_values, 2);
+  argparse_add_flag(parser, 't', "threads", ARG_TYPE_INT,
+                    "Number of catalog threads (default: one per CPU)", "N",
+                    &config->threads, false, NULL, 0);
+
   // Add positional argument for ROM file
   argparse_add_positional(parser, "FILE", "N64 ROM file to analyze",
-                          ARG_TYPE_STRING, &config->rom_file, true);
+                          ARG_TYPE_STRING, &config->rom_file, false);
 
   // Parse the arguments
   result = argparse_parse(parser, argc, argv);
+  if (result == 0 && !config->rom_file && !config->catalog_dir) {
+    ERROR("Error: FILE or --catalog DIR is required\n");
+    argparse_print_help(parser, stderr);
+    result = -1;
+  }
 
   // Free the parser
   argparse_free(parser);
@@ -90,54 +124,6 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
   return result;
 }
 
-// Function to determine the ROM format (big endian, byte-swapped, little
-// endian)
-static const char *detect_rom_format(unsigned char *buf) {
-  const unsigned char z64_magic[] = {0x80, 0x37, 0x12,
-                                     0x40}; // big-endian (ABCD)
-  const unsigned char v64_magic[] = {0x37, 0x80, 0x40,
-                                     0x12}; // byte-swapped (BADC)
-  const unsigned char n64_magic[] = {0x40, 0x12, 0x37,
-                                     0x80}; // little-endian (DCBA)
-
-  if (!memcmp(buf, z64_magic, sizeof(z64_magic))) {
-    return "Z64 (big-endian/ABCD)";
-  } else if (!memcmp(buf, v64_magic, sizeof(v64_magic))) {
-    return "V64 (byte-swapped/BADC)";
-  } else if (!memcmp(buf, n64_magic, sizeof(n64_magic))) {
-    return "N64 (little-endian/DCBA)";
-  } else {
-    return "Unknown format";
-  }
-}
-
-// Function to convert V64 format to Z64 format (big-endian)
-// This is done by swapping every two bytes
-static void swap_bytes_v64(unsigned char *data, int length) {
-  unsigned char tmp;
-  int i;
-  for (i = 0; i < length; i += 2) {
-    tmp = data[i];
-    data[i] = data[i + 1];
-    data[i + 1] = tmp;
-  }
-}
-
-// Function to convert N64 format to Z64 format (big-endian)
-// This is done by swapping every four bytes
-static void swap_bytes_n64(unsigned char *data, int length) {
-  unsigned char tmp;
-  int i;
-  for (i = 0; i < length; i += 4) {
-    tmp = data[i];
-    data[i] = data[i + 3];
-    data[i + 3] = tmp;
-    tmp = data[i + 1];
-    data[i + 1] = data[i + 2];
-    data[i + 2] = tmp;
-  }
-}
-
 // Get country name from code
 static const char *get_country_name(char country_code) {
   switch (country_code) {
@@ -190,50 +176,8 @@ static const char *get_country_name(char country_code) {
   }
 }
 
-// Read header from ROM file
-static int read_header(const char *rom_file, n64_header *header) {
-  unsigned char buf[64]; // N64 header is 64 bytes
-  unsigned long length;
-  FILE *file;
-
-  if (g_verbosity) {
-    printf("Opening file: %s\n", rom_file);
-  }
-
-  file = fopen(rom_file, "rb");
-  if (!file) {
-    ERROR("Error: Could not open file '%s'\n", rom_file);
-    return -1;
-  }
-
-  length = fread(buf, 1, sizeof(buf), file);
-  fclose(file);
-
-  if (length < sizeof(buf)) {
-    ERROR("Error: File '%s' is too small to be an N64 ROM\n", rom_file);
-    return -1;
-  }
-
-  if (g_verbosity) {
-    printf("Detecting ROM format...\n");
-  }
-
-  // Convert to big-endian if necessary
-  const char *rom_format = detect_rom_format(buf);
-  if (strstr(rom_format, "V64")) {
-    if (g_verbosity) {
-      printf("Converting from V64 (byte-swapped) format to Z64 (big-endian)\n");
-    }
-    swap_bytes_v64(buf, sizeof(buf));
-  } else if (strstr(rom_format, "N64")) {
-    if (g_verbosity) {
-      printf(
-          "Converting from N64 (little-endian) format to Z64 (big-endian)\n");
-    }
-    swap_bytes_n64(buf, sizeof(buf));
-  }
-
-  // Parse header according to official specification
+// Parse big-endian header according to official specification
+static void parse_header(const unsigned char *buf, n64_header *header) {
   // 0x00: Reserved byte (usually 0x80)
   header->reserved_byte = buf[0x00];
 
@@ -308,6 +252,41 @@ static int read_header(const char *rom_file, n64_header *header) {
     header->destination_code = '?';
   }
 
+}
+
+// Read header from ROM file, converted to big-endian
+static int read_header(const char *rom_file, n64_header *header,
+                       rom_format *format) {
+  rom_image rom;
+  const unsigned char *buf;
+
+  if (g_verbosity) {
+    printf("Opening file: %s\n", rom_file);
+  }
+
+  if (rom_open(&rom, rom_file) < 0) {
+    ERROR("Error: Could not open file '%s'\n", rom_file);
+    return -1;
+  }
+
+  // N64 header is 64 bytes, only its page is byte-swapped
+  buf = rom_range(&rom, 0, 64);
+  if (buf == NULL) {
+    ERROR("Error: File '%s' is too small to be an N64 ROM\n", rom_file);
+    rom_close(&rom);
+    return -1;
+  }
+
+  *format = rom.format;
+  if (g_verbosity && rom.format != ROM_FORMAT_Z64 &&
+      rom.format != ROM_FORMAT_UNKNOWN) {
+    printf("Converting from %s format to Z64 (big-endian)\n",
+           rom_format_name(rom.format));
+  }
+
+  parse_header(buf, header);
+
+  rom_close(&rom);
   return 0;
 }
 
@@ -456,12 +435,504 @@ static void display_header(const n64_header *header, const char *rom_format) {
   }
 }
 
+//==============================================================================
+// ROM catalog
+//==============================================================================
+
+// IPL3 boot code and the range covered by CRC1/CRC2
+#define IPL3_START 0x40
+#define IPL3_END 0x1000
+#define CHECKSUM_START 0x1000
+#define CHECKSUM_LENGTH 0x100000
+
+typedef enum {
+  CATALOG_JSONL,
+  CATALOG_CSV,
+} catalog_format;
+
+static const char *const short_format_names[] = {"z64", "v64", "n64"};
+
+typedef struct {
+  char *path;
+  long long size;
+  long long mtime;
+  char *record; // formatted line without newline, NULL if not a ROM
+  bool reused;  // record copied from the previous catalog
+} catalog_entry;
+
+typedef struct {
+  catalog_entry *entries;
+  int count;
+  int allocation;
+} catalog;
+
+// CICs are identified by the CRC32 of their IPL3
+typedef struct {
+  unsigned int ipl3_crc;
+  int cic; // CIC-NUS-xxxx
+  unsigned int seed;
+} cic_type;
+
+static const cic_type cic_types[] = {
+    {0x6170A4A1, 6101, 0xF8CA4DDC},
+    {0x90BB6CB5, 6102, 0xF8CA4DDC},
+    {0x0B050EE0, 6103, 0xA3886759},
+    {0x98BC2C86, 6105, 0xDF26F436},
+    {0xACC8580A, 6106, 0x1FEA617A},
+};
+
+static unsigned int crc32_table[256];
+
+// fill crc32_table, must run before any worker threads start
+static void crc32_init(void) {
+  unsigned int i, j, c;
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    }
+    crc32_table[i] = c;
+  }
+}
+
+static unsigned int crc32(const unsigned char *buf, size_t length) {
+  unsigned int crc = 0xFFFFFFFF;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    crc = crc32_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static const cic_type *detect_cic(const unsigned char *rom) {
+  unsigned int crc = crc32(rom + IPL3_START, IPL3_END - IPL3_START);
+  unsigned int i;
+  for (i = 0; i < DIM(cic_types); i++) {
+    if (cic_types[i].ipl3_crc == crc) {
+      return &cic_types[i];
+    }
+  }
+  return NULL;
+}
+
+#define ROL32(V_, S_) (((V_) << (S_)) | ((V_) >> ((32 - (S_)) & 31)))
+
+// compute CRC1/CRC2 the way the IPL3 of each CIC does
+// rom: big-endian ROM of at least CHECKSUM_START + CHECKSUM_LENGTH bytes
+static void calc_checksums(const unsigned char *rom, const cic_type *cic,
+                           unsigned int crc[2]) {
+  unsigned int t1, t2, t3, t4, t5, t6;
+  unsigned int d, r;
+  unsigned int i;
+
+  t1 = t2 = t3 = t4 = t5 = t6 = cic->seed;
+  for (i = CHECKSUM_START; i < CHECKSUM_START + CHECKSUM_LENGTH; i += 4) {
+    d = read_u32_be(&rom[i]);
+    if (t6 + d < t6) {
+      t4++;
+    }
+    t6 += d;
+    t3 ^= d;
+    r = ROL32(d, d & 0x1F);
+    t5 += r;
+    if (t2 > d) {
+      t2 ^= r;
+    } else {
+      t2 ^= t6 ^ d;
+    }
+    if (cic->cic == 6105) {
+      t1 += read_u32_be(&rom[IPL3_START + 0x0710 + (i & 0xFF)]) ^ d;
+    } else {
+      t1 += t5 ^ d;
+    }
+  }
+  if (cic->cic == 6103) {
+    crc[0] = (t6 ^ t4) + t3;
+    crc[1] = (t5 ^ t2) + t1;
+  } else if (cic->cic == 6106) {
+    crc[0] = (t6 * t4) + t3;
+    crc[1] = (t5 * t2) + t1;
+  } else {
+    crc[0] = t6 ^ t4 ^ t3;
+    crc[1] = t5 ^ t2 ^ t1;
+  }
+}
+
+// append str quoted for the catalog format, returns new length of out
+// out must have room for 6 bytes per input byte plus quotes
+static size_t append_quoted(char *out, size_t len, const char *str,
+                            catalog_format format) {
+  const unsigned char *s = (const unsigned char *)str;
+  out[len++] = '"';
+  for (; *s; s++) {
+    if (format == CATALOG_CSV) {
+      if (*s == '"') {
+        out[len++] = '"';
+      }
+      out[len++] = *s;
+    } else if (*s == '"' || *s == '\\') {
+      out[len++] = '\\';
+      out[len++] = *s;
+    } else if (*s < 0x20) {
+      len += sprintf(out + len, "\\u%04X", *s);
+    } else {
+      out[len++] = *s;
+    }
+  }
+  out[len++] = '"';
+  out[len] = '\0';
+  return len;
+}
+
+// format the catalog record for one ROM
+static char *catalog_record(const catalog_entry *entry, rom_image *rom,
+                            catalog_format format) {
+  static const char *const json_fmt =
+      ",\"size\":%lld,\"mtime\":%lld,\"format\":\"%s\",\"title\":%s,"
+      "\"game_code\":%s,\"version\":%u,\"clock_rate\":\"0x%08X\","
+      "\"boot_address\":\"0x%08X\",\"libultra\":\"0x%08X\",\"cic\":%s,"
+      "\"crc1\":\"0x%08X\",\"crc2\":\"0x%08X\",\"crc_ok\":%s,"
+      "\"hash\":\"%016llx\"}";
+  static const char *const csv_fmt =
+      ",%lld,%lld,%s,%s,%s,%u,0x%08X,0x%08X,0x%08X,%s,0x%08X,0x%08X,%s,"
+      "%016llx";
+  const unsigned char *data = rom_range(rom, 0, rom->size);
+  const cic_type *cic = NULL;
+  n64_header header;
+  char title[21];
+  char quoted_title[21 * 6 + 3];
+  char quoted_code[5 * 6 + 3];
+  char cic_name[16];
+  const char *crc_ok;
+  unsigned int crc[2];
+  unsigned long long hash;
+  size_t path_len = strlen(entry->path);
+  char *record;
+  size_t len;
+  int i;
+
+  parse_header(data, &header);
+
+  // printable title without trailing padding
+  for (i = 0; i < 20; i++) {
+    unsigned char c = header.game_title[i];
+    title[i] = (c >= 32 && c < 127) ? c : '.';
+  }
+  for (i = 20; i > 0 && (header.game_title[i - 1] == ' ' ||
+                         header.game_title[i - 1] == '\0');
+       i--)
+    ;
+  title[i] = '\0';
+  append_quoted(quoted_title, 0, title, format);
+  for (i = 0; i < 4; i++) {
+    unsigned char c = header.game_code[i];
+    header.game_code[i] = (c >= 32 && c < 127) ? c : '.';
+  }
+  append_quoted(quoted_code, 0, header.game_code, format);
+
+  // checksums need the IPL3 and the full checksummed range
+  crc_ok = format == CATALOG_CSV ? "" : "null";
+  if (rom->size >= CHECKSUM_START + CHECKSUM_LENGTH) {
+    cic = detect_cic(data);
+  }
+  if (cic) {
+    calc_checksums(data, cic, crc);
+    if (crc[0] == header.check_code_hi && crc[1] == header.check_code_lo) {
+      crc_ok = format == CATALOG_CSV ? "1" : "true";
+    } else {
+      crc_ok = format == CATALOG_CSV ? "0" : "false";
+    }
+    sprintf(cic_name, format == CATALOG_CSV ? "%d" : "\"%d\"", cic->cic);
+  } else {
+    strcpy(cic_name, format == CATALOG_CSV ? "" : "null");
+  }
+
+  // hash of the big-endian contents, equal for any byte order of a dump
+  hash = fnv1a_64(data, rom->size, FNV1A_64_INIT);
+
+  record = malloc(path_len * 6 + sizeof(quoted_title) + sizeof(quoted_code) +
+                  512);
+  len = 0;
+  if (format == CATALOG_JSONL) {
+    len += sprintf(record, "{\"path\":");
+  }
+  len = append_quoted(record, len, entry->path, format);
+  sprintf(record + len, format == CATALOG_CSV ? csv_fmt : json_fmt,
+          entry->size, entry->mtime, short_format_names[rom->format],
+          quoted_title, quoted_code, header.rom_version,
+          header.clock_rate, header.boot_address, header.libultra_version,
+          cic_name, header.check_code_hi, header.check_code_lo, crc_ok, hash);
+  return record;
+}
+
+static void catalog_add(catalog *cat, const char *path, const struct stat *st) {
+  catalog_entry *entry;
+  if (cat->count >= cat->allocation) {
+    cat->allocation = cat->allocation ? cat->allocation * 2 : 256;
+    cat->entries = realloc(cat->entries, cat->allocation * sizeof(*cat->entries));
+  }
+  entry = &cat->entries[cat->count++];
+  memset(entry, 0, sizeof(*entry));
+  entry->path = strdup(path);
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtime;
+}
+
+static int str_ptr_cmp(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// stat for catalog_walk: symlinks to files are followed, symlinks to
+// directories are skipped so a link back up the tree can't recurse forever
+static int catalog_stat(const char *path, struct stat *st) {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+  return stat(path, st);
+#else
+  if (lstat(path, st) != 0) {
+    return -1;
+  }
+  if (!S_ISLNK(st->st_mode)) {
+    return 0;
+  }
+  if (stat(path, st) != 0 || S_ISDIR(st->st_mode)) {
+    return -1;
+  }
+  return 0;
+#endif
+}
+
+// recursively list non-empty regular files under dir, sorted by name in each
+// directory
+static void catalog_walk(catalog *cat, const char *dir) {
+  struct dirent *dent;
+  struct stat st;
+  char path[FILENAME_MAX];
+  char **names = NULL;
+  int count = 0;
+  int allocation = 0;
+  DIR *dfd;
+  int i;
+
+  dfd = opendir(dir);
+  if (dfd == NULL) {
+    WARNING("Can't open directory '%s'\n", dir);
+    return;
+  }
+  while ((dent = readdir(dfd)) != NULL) {
+    if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, "..")) {
+      continue;
+    }
+    if (count >= allocation) {
+      allocation = allocation ? allocation * 2 : 64;
+      names = realloc(names, allocation * sizeof(*names));
+    }
+    names[count++] = strdup(dent->d_name);
+  }
+  closedir(dfd);
+
+  qsort(names, count, sizeof(*names), str_ptr_cmp);
+  for (i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    if (catalog_stat(path, &st) == 0) {
+      if (S_ISDIR(st.st_mode)) {
+        catalog_walk(cat, path);
+      } else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        catalog_add(cat, path, &st);
+      }
+    }
+    free(names[i]);
+  }
+  free(names);
+}
+
+// parse the leading path, size and mtime of a record written by
+// catalog_record(). returns 0 on success
+static int parse_record_key(const char *line, catalog_format format,
+                            char *path, size_t path_size, long long *size,
+                            long long *mtime) {
+  const char *p = line;
+  size_t len = 0;
+
+  if (format == CATALOG_JSONL) {
+    if (strncmp(p, "{\"path\":\"", 9) != 0) {
+      return -1;
+    }
+    p += 9;
+  } else if (*p++ != '"') {
+    return -1;
+  }
+  while (*p && len + 1 < path_size) {
+    if (*p == '"') {
+      if (format == CATALOG_CSV && p[1] == '"') {
+        p++;
+      } else {
+        break;
+      }
+    } else if (*p == '\\' && format == CATALOG_JSONL) {
+      p++;
+      if (*p == 'u') {
+        unsigned int c;
+        if (sscanf(p + 1, "%4x", &c) != 1) {
+          return -1;
+        }
+        path[len++] = c;
+        p += 5;
+        continue;
+      }
+    }
+    path[len++] = *p++;
+  }
+  path[len] = '\0';
+  if (*p++ != '"') {
+    return -1;
+  }
+  if (format == CATALOG_JSONL) {
+    return sscanf(p, ",\"size\":%lld,\"mtime\":%lld", size, mtime) == 2 ? 0 : -1;
+  }
+  return sscanf(p, ",%lld,%lld", size, mtime) == 2 ? 0 : -1;
+}
+
+static int entry_path_cmp(const void *a, const void *b) {
+  return strcmp((*(catalog_entry *const *)a)->path,
+                (*(catalog_entry *const *)b)->path);
+}
+
+// longest record: 6 bytes per escaped path byte plus the fixed fields
+#define CATALOG_LINE_MAX (FILENAME_MAX * 6 + 1024)
+
+// reuse records from a previous catalog for files whose size and mtime are
+// unchanged. returns number of records reused
+static int catalog_load_previous(catalog *cat, const char *file_name,
+                                 catalog_format format) {
+  catalog_entry **sorted;
+  catalog_entry key;
+  catalog_entry *key_ptr = &key;
+  char path[FILENAME_MAX];
+  char *line;
+  int reused = 0;
+  FILE *in;
+  int i;
+
+  in = fopen(file_name, "r");
+  if (in == NULL) {
+    return 0;
+  }
+  // index current entries by path
+  sorted = malloc(cat->count * sizeof(*sorted));
+  for (i = 0; i < cat->count; i++) {
+    sorted[i] = &cat->entries[i];
+  }
+  qsort(sorted, cat->count, sizeof(*sorted), entry_path_cmp);
+
+  line = malloc(CATALOG_LINE_MAX);
+  key.path = path;
+  while (fgets(line, CATALOG_LINE_MAX, in)) {
+    catalog_entry **found;
+    long long size, mtime;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (parse_record_key(line, format, path, sizeof(path), &size, &mtime)) {
+      continue;
+    }
+    found = bsearch(&key_ptr, sorted, cat->count, sizeof(*sorted),
+                    entry_path_cmp);
+    if (found && (*found)->size == size && (*found)->mtime == mtime &&
+        !(*found)->reused) {
+      (*found)->record = strdup(line);
+      (*found)->reused = true;
+      reused++;
+    }
+  }
+  free(line);
+  free(sorted);
+  fclose(in);
+  return reused;
+}
+
+typedef struct {
+  catalog_entry *entries;
+  catalog_format format;
+} catalog_job;
+
+static void catalog_scan_fn(int index, int worker, void *arg) {
+  catalog_job *job = arg;
+  catalog_entry *entry = &job->entries[index];
+  rom_image rom;
+  (void)worker;
+
+  if (entry->reused) {
+    return;
+  }
+  if (rom_open(&rom, entry->path) < 0) {
+    WARNING("Can't read '%s'\n", entry->path);
+    return;
+  }
+  // skip anything that isn't an N64 ROM
+  if (rom.format != ROM_FORMAT_UNKNOWN && rom.size >= IPL3_END) {
+    entry->record = catalog_record(entry, &rom, job->format);
+  }
+  rom_close(&rom);
+}
+
+// catalog every ROM under dir, writing JSON lines or CSV to output_file
+// (stdout if NULL). an existing output_file is used as the previous catalog
+static int run_catalog(const char *dir, const char *output_file,
+                       catalog_format format, int threads) {
+  catalog cat;
+  catalog_job job;
+  FILE *out = stdout;
+  int reused = 0;
+  int roms = 0;
+  int i;
+  struct stat st;
+
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    ERROR("Error: '%s' is not a directory\n", dir);
+    return -1;
+  }
+  memset(&cat, 0, sizeof(cat));
+  catalog_walk(&cat, dir);
+  if (output_file) {
+    reused = catalog_load_previous(&cat, output_file, format);
+  }
+
+  crc32_init();
+  job.entries = cat.entries;
+  job.format = format;
+  parallel_for(cat.count, threads, catalog_scan_fn, &job);
+
+  if (output_file) {
+    out = fopen(output_file, "w");
+    if (out == NULL) {
+      ERROR("Error: Could not open output file '%s'\n", output_file);
+      return -1;
+    }
+  }
+  if (format == CATALOG_CSV) {
+    fprintf(out, "path,size,mtime,format,title,game_code,version,clock_rate,"
+                 "boot_address,libultra,cic,crc1,crc2,crc_ok,hash\n");
+  }
+  for (i = 0; i < cat.count; i++) {
+    if (cat.entries[i].record) {
+      fprintf(out, "%s\n", cat.entries[i].record);
+      roms++;
+    }
+    free(cat.entries[i].record);
+    free(cat.entries[i].path);
+  }
+  free(cat.entries);
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  INFO("Cataloged %d ROMs in %d files, %d unchanged\n", roms, cat.count,
+       reused);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   arg_config config;
   n64_header header;
-  unsigned char buf[64];
-  long length;
-  FILE *file;
+  rom_format format;
 
   // Initialize configuration with defaults
   config = default_config;
@@ -471,32 +942,22 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  // Open file and read first 64 bytes
-  file = fopen(config.rom_file, "rb");
-  if (!file) {
-    fprintf(stderr, "Error: Could not open file '%s'\n", config.rom_file);
-    return EXIT_FAILURE;
-  }
-
-  length = fread(buf, 1, sizeof(buf), file);
-  fclose(file);
+  g_verbosity = config.verbose;
 
-  if (length < 64) {
-    fprintf(stderr, "Error: File '%s' is too small to be an N64 ROM\n",
-            config.rom_file);
-    return EXIT_FAILURE;
+  if (config.catalog_dir) {
+    return run_catalog(config.catalog_dir, config.output_file,
+                       config.catalog_format, config.threads) == 0
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
   }
 
-  // Get ROM format
-  const char *rom_format = detect_rom_format(buf);
-
   // Read and parse header
-  if (read_header(config.rom_file, &header) != 0) {
+  if (read_header(config.rom_file, &header, &format) != 0) {
     return EXIT_FAILURE;
   }
 
   // Display header information
-  display_header(&header, rom_format);
+  display_header(&header, rom_format_name(format));
 
   return EXIT_SUCCESS;
 }
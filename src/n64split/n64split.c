@@ -1,5 +1,11 @@
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+#include <unistd.h>
+#endif
+
 #include "n64split.h"
 #include "argparse.h"
+#include "n64symbols.h"
+#include "romimage.h"
 
 // static files
 #include "n64split.collision.mtl.h"
@@ -16,8 +22,14 @@ static const arg_config default_args = {
     .large_texture_depth = 16,
     .keep_going = false,
     .merge_pseudo = false,
+    .no_cache = false,
+    .symbols_file = NULL,
+    .png_effort = PNG_EFFORT_DEFAULT,
+    .skybox_tiles = false,
 };
 
+static const char *png_effort_values[] = {"fast", "default", "max"};
+
 const char asm_header[] = "# %s disassembly and split file\n"
                           "# generated by n64split v%s - N64 ROM splitter\n"
                           "\n"
@@ -35,20 +47,6 @@ void print_spaces(FILE *fp, int count) {
   }
 }
 
-n64_rom_format n64_rom_type(unsigned char *buf, unsigned int length) {
-  const unsigned char bs[] = {0x37, 0x80, 0x40, 0x12}; // byte-swapped
-  const unsigned char be[] = {0x80, 0x37, 0x12, 0x40}; // big-endian
-  if (length >= (8 * MB)) {
-    if (!memcmp(buf, bs, sizeof(bs))) {
-      return N64_ROM_V64;
-    }
-    if (!memcmp(buf, be, sizeof(be))) {
-      return N64_ROM_Z64;
-    }
-  }
-  return N64_ROM_INVALID;
-}
-
 void gzip_decode_file(char *gzfilename, int offset, char *binfilename) {
 #define CHUNK 0x4000
   FILE *file;
@@ -472,8 +470,156 @@ void write_bin_type(split_section *sec, char *outfilename, char *start_label,
   fprintf(fasm, "%s_end:\n", start_label);
 }
 
+// account for a texture PNG written by the split
+static void count_png(split_stats *stats, const char *path,
+                      const png_stats *png) {
+  INFO("Wrote %s: %ld bytes in %.2f ms\n", path, png->bytes,
+       png->seconds * 1000.0);
+  stats->png_count++;
+  stats->png_bytes += png->bytes;
+  stats->png_seconds += png->seconds;
+}
+
+// textures already saved during the split, keyed by format, size and
+// contents so repeated textures are linked to the first PNG instead of
+// being converted again
+typedef struct {
+  uint64_t hash;
+  section_type format;
+  int depth;
+  int width;
+  int height;
+  unsigned int length;
+  unsigned char *raw; // copy of the texture bytes, to confirm matches
+  char *png;          // PNG written for it, NULL until one is
+} texture_entry;
+
+typedef struct {
+  texture_entry *entries; // open addressing, raw == NULL if empty
+  int count;
+  int size;
+} texture_cache;
+
+static int texture_entry_match(const texture_entry *entry, uint64_t hash,
+                               const texture *tex, int width, int height,
+                               const unsigned char *raw, unsigned int length) {
+  return entry->hash == hash && entry->format == tex->format &&
+         entry->depth == tex->depth && entry->width == width &&
+         entry->height == height && entry->length == length &&
+         !memcmp(entry->raw, raw, length);
+}
+
+static int texture_cache_grow(texture_cache *cache) {
+  texture_entry *old_entries = cache->entries;
+  int old_size = cache->size;
+
+  cache->size = old_size ? old_size * 2 : 256;
+  cache->entries = calloc(cache->size, sizeof(*cache->entries));
+  if (!cache->entries) {
+    return -1;
+  }
+  for (int i = 0; i < old_size; i++) {
+    if (old_entries[i].raw) {
+      unsigned int slot = old_entries[i].hash & (cache->size - 1);
+      while (cache->entries[slot].raw) {
+        slot = (slot + 1) & (cache->size - 1);
+      }
+      cache->entries[slot] = old_entries[i];
+    }
+  }
+  free(old_entries);
+  return 0;
+}
+
+// find the entry for a texture, adding an entry without a PNG if it's new
+// returns NULL if out of memory
+static texture_entry *texture_cache_get(texture_cache *cache,
+                                        const texture *tex, int width,
+                                        int height, const unsigned char *raw,
+                                        unsigned int length) {
+  int params[4] = {tex->format, tex->depth, width, height};
+  uint64_t hash = fnv1a_64(params, sizeof(params), FNV1A_64_INIT);
+  texture_entry *entry;
+  unsigned int slot;
+
+  hash = fnv1a_64(raw, length, hash);
+  // keep the table at most half full
+  if (cache->count * 2 >= cache->size && texture_cache_grow(cache)) {
+    return NULL;
+  }
+  slot = hash & (cache->size - 1);
+  while (cache->entries[slot].raw) {
+    entry = &cache->entries[slot];
+    if (texture_entry_match(entry, hash, tex, width, height, raw, length)) {
+      return entry;
+    }
+    slot = (slot + 1) & (cache->size - 1);
+  }
+  entry = &cache->entries[slot];
+  entry->raw = malloc(length ? length : 1);
+  if (!entry->raw) {
+    return NULL;
+  }
+  memcpy(entry->raw, raw, length);
+  entry->hash = hash;
+  entry->format = tex->format;
+  entry->depth = tex->depth;
+  entry->width = width;
+  entry->height = height;
+  entry->length = length;
+  entry->png = NULL;
+  cache->count++;
+  return entry;
+}
+
+static void texture_cache_free(texture_cache *cache) {
+  for (int i = 0; i < cache->size; i++) {
+    free(cache->entries[i].raw);
+    free(cache->entries[i].png);
+  }
+  free(cache->entries);
+  memset(cache, 0, sizeof(*cache));
+}
+
+// save a texture's PNG as a link to an identical texture saved earlier,
+// falling back to a copy where links aren't available
+// returns 1 if saved, 0 if the texture has to be converted
+static int texture_cache_reuse(const texture_entry *entry, split_stats *stats,
+                               const char *path) {
+  long bytes;
+
+  // the PNG may be a link from an earlier split, don't write through it
+  remove(path);
+  if (!entry || !entry->png) {
+    return 0;
+  }
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+  if (link(entry->png, path) == 0) {
+    bytes = filesize(path);
+  } else
+#endif
+  {
+    bytes = copy_file(entry->png, path);
+  }
+  if (bytes < 0) {
+    return 0;
+  }
+  INFO("Linked %s to %s\n", path, entry->png);
+  stats->dup_count++;
+  stats->dup_bytes += bytes;
+  return 1;
+}
+
+// remember the PNG written for a texture
+static void texture_cache_saved(texture_entry *entry, const char *path) {
+  if (entry) {
+    free(entry->png);
+    entry->png = strdup(path);
+  }
+}
+
 void split_file(unsigned char *data, unsigned int length, arg_config *args,
-                rom_config *config, disasm_state *state) {
+                rom_config *config, disasm_state *state, split_stats *stats) {
 
   char makefile_name[FILENAME_MAX];
   char bin_dir[FILENAME_MAX];
@@ -501,6 +647,11 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
   unsigned int prev_end = 0;
   unsigned int ptr;
   split_section *sections = config->sections;
+  // intermediate images, reused by every texture in the split
+  texture_scratch scratch = {NULL, 0};
+  texture_cache textures = {NULL, 0, 0};
+  texture_entry *tex_entry;
+  png_stats png;
 
   // create directories
   sprintf(makefile_name, "%s/Makefile.split", args->output_dir);
@@ -874,12 +1025,23 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
           case TYPE_TEX_IA: {
             sprintf(outfilename, "%s.%05X.ia%d", start_label, offset,
                     tex->depth);
-            ia *img = raw2ia(&binfilecontents[offset], w, h, tex->depth);
-            if (img) {
-              sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-              ia2png(outfilepath, img, w, h);
-              free(img);
+            sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
+            tex_entry = texture_cache_get(&textures, tex, w, h,
+                                          &binfilecontents[offset],
+                                          w * h * tex->depth / 8);
+            if (texture_cache_reuse(tex_entry, stats, outfilepath)) {
               fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+            } else {
+              ia *img =
+                  texture_scratch_reserve(&scratch, w * h * sizeof(*img));
+              if (img && raw2ia_into(img, &binfilecontents[offset], w, h,
+                                     tex->depth) == 0) {
+                if (ia2png_opts(outfilepath, img, w, h, NULL, &png)) {
+                  count_png(stats, outfilepath, &png);
+                  texture_cache_saved(tex_entry, outfilepath);
+                }
+                fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+              }
             }
             if (args->raw_texture && binfilelen > 0) {
               INFO("Saving raw texture for %s\n", start_label);
@@ -895,12 +1057,23 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
           case TYPE_TEX_I: {
             sprintf(outfilename, "%s.%05X.i%d", start_label, offset,
                     tex->depth);
-            ia *img = raw2i(&binfilecontents[offset], w, h, tex->depth);
-            if (img) {
-              sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-              ia2png(outfilepath, img, w, h);
-              free(img);
+            sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
+            tex_entry = texture_cache_get(&textures, tex, w, h,
+                                          &binfilecontents[offset],
+                                          w * h * tex->depth / 8);
+            if (texture_cache_reuse(tex_entry, stats, outfilepath)) {
               fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+            } else {
+              ia *img =
+                  texture_scratch_reserve(&scratch, w * h * sizeof(*img));
+              if (img && raw2i_into(img, &binfilecontents[offset], w, h,
+                                    tex->depth) == 0) {
+                if (ia2png_opts(outfilepath, img, w, h, NULL, &png)) {
+                  count_png(stats, outfilepath, &png);
+                  texture_cache_saved(tex_entry, outfilepath);
+                }
+                fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+              }
             }
             if (args->raw_texture && binfilelen > 0) {
               INFO("Saving raw texture for %s\n", start_label);
@@ -916,12 +1089,23 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
           case TYPE_TEX_RGBA: {
             sprintf(outfilename, "%s.%05X.rgba%d", start_label, offset,
                     tex->depth);
-            rgba *img = raw2rgba(&binfilecontents[offset], w, h, tex->depth);
-            if (img) {
-              sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-              rgba2png(outfilepath, img, w, h);
-              free(img);
+            sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
+            tex_entry = texture_cache_get(&textures, tex, w, h,
+                                          &binfilecontents[offset],
+                                          w * h * tex->depth / 8);
+            if (texture_cache_reuse(tex_entry, stats, outfilepath)) {
               fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+            } else {
+              rgba *img =
+                  texture_scratch_reserve(&scratch, w * h * sizeof(*img));
+              if (img && raw2rgba_into(img, &binfilecontents[offset], w, h,
+                                       tex->depth) == 0) {
+                if (rgba2png_opts(outfilepath, img, w, h, NULL, &png)) {
+                  count_png(stats, outfilepath, &png);
+                  texture_cache_saved(tex_entry, outfilepath);
+                }
+                fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+              }
             }
             if (args->raw_texture && binfilelen > 0) {
               INFO("Saving raw texture for %s\n", start_label);
@@ -937,34 +1121,60 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
           case TYPE_TEX_SKYBOX: {
             // read in grid of MxN 32x32 tiles and save them as M*31xN*31 image
             rgba *img;
+            rgba tile[32 * 32];
+            char tilepath[FILENAME_MAX];
             unsigned int sky_offset = offset;
             int m, n;
-            int tx, ty;
+            int tx, ty, cy;
+            sprintf(outfilename, "%s.%05X.skybox.png", start_label, offset);
+            sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
+            // a reused skybox has no tiles of its own to save
+            tex_entry = NULL;
+            if (!args->skybox_tiles) {
+              tex_entry = texture_cache_get(&textures, tex, w, h,
+                                            &binfilecontents[offset],
+                                            w * h * tex->depth / 8);
+            }
+            if (texture_cache_reuse(tex_entry, stats, outfilepath)) {
+              fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
+              break;
+            }
             m = w / 32;
             n = h / 32;
-            img = malloc(w * h * sizeof(rgba));
+            img = texture_scratch_reserve(&scratch, w * h * sizeof(rgba));
+            if (!img) {
+              exit(1);
+            }
             w -= m; // adjust for overlap
             h -= n;
             for (ty = 0; ty < n; ty++) {
               for (tx = 0; tx < m; tx++) {
-                rgba *tile =
-                    raw2rgba(&binfilecontents[sky_offset], 32, 32, tex->depth);
-                int cx, cy;
+                raw2rgba_into(tile, &binfilecontents[sky_offset], 32, 32,
+                              tex->depth);
+                // drop the overlapping last row and column of each tile
+                rgba *dst = &img[31 * (w * ty + tx)];
                 for (cy = 0; cy < 31; cy++) {
-                  for (cx = 0; cx < 31; cx++) {
-                    int out_off = 31 * w * ty + 31 * tx + w * cy + cx;
-                    int in_off = 32 * cy + cx;
-                    img[out_off] = tile[in_off];
+                  memcpy(&dst[w * cy], &tile[32 * cy], 31 * sizeof(*tile));
+                }
+                if (args->skybox_tiles) {
+                  int len = snprintf(tilepath, sizeof(tilepath),
+                                     "%s/%s.%05X.skybox.%02d.%02d.png",
+                                     texture_dir, start_label, offset, ty, tx);
+                  if (len < 0 || len >= (int)sizeof(tilepath)) {
+                    ERROR("Skybox tile path too long, skipping: %s/%s\n",
+                          texture_dir, start_label);
+                  } else if (rgba2png_opts(tilepath, tile, 32, 32, NULL,
+                                           &png)) {
+                    count_png(stats, tilepath, &png);
                   }
                 }
-                free(tile);
-                sky_offset += 32 * 32 * 2;
+                sky_offset += 32 * 32 * tex->depth / 8;
               }
             }
-            sprintf(outfilename, "%s.%05X.skybox.png", start_label, offset);
-            sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-            rgba2png(outfilepath, img, w, h);
-            free(img);
+            if (rgba2png_opts(outfilepath, img, w, h, NULL, &png)) {
+              count_png(stats, outfilepath, &png);
+              texture_cache_saved(tex_entry, outfilepath);
+            }
             fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
             break;
           }
@@ -1060,14 +1270,15 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
         INFO("Generating large texture for %s\n", start_label);
         w = 32;
         h = filesize(binfilename) / (w * (args->large_texture_depth / 8));
-        rgba *img = raw2rgba(binfilecontents, w, h, args->large_texture_depth);
-        if (img) {
+        rgba *img = texture_scratch_reserve(&scratch, w * h * sizeof(*img));
+        if (img && raw2rgba_into(img, binfilecontents, w, h,
+                                 args->large_texture_depth) == 0) {
           sprintf(outfilename, "%s.ALL.png", start_label);
           sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-          rgba2png(outfilepath, img, w, h);
-          free(img);
+          if (rgba2png_opts(outfilepath, img, w, h, NULL, &png)) {
+            count_png(stats, outfilepath, &png);
+          }
           fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-          img = NULL;
         }
       }
       // TODO: write files in correct order to avoid this
@@ -1163,6 +1374,8 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
   strbuf_free(&makeheader_mio0);
   strbuf_free(&makeheader_level);
   strbuf_free(&makeheader_music);
+  texture_scratch_free(&scratch);
+  texture_cache_free(&textures);
   fclose(fmake);
   fclose(fasm);
 
@@ -1182,6 +1395,68 @@ void split_file(unsigned char *data, unsigned int length, arg_config *args,
   generate_geo_macros(args);
 }
 
+static int address_cmp(const void *a, const void *b) {
+  unsigned int aa = *(const unsigned int *)a;
+  unsigned int bb = *(const unsigned int *)b;
+  return aa < bb ? -1 : aa > bb;
+}
+
+// add labels from an n64symbols binary symbol table, leaving addresses
+// already labelled by the config alone
+static int add_symbol_labels(disasm_state *state, const rom_config *config,
+                             const char *filename) {
+  const symtab_header *header;
+  const symtab_entry *entries;
+  const char *names;
+  unsigned char *data;
+  unsigned int *labelled;
+  long size;
+  int added = 0;
+  int l = 0;
+
+  size = read_file(filename, &data);
+  if (size < (long)sizeof(*header)) {
+    ERROR("Error reading symbol table \"%s\"\n", filename);
+    return -1;
+  }
+  header = (const symtab_header *)data;
+  if (memcmp(header->magic, SYMTAB_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SYMTAB_VERSION ||
+      (unsigned long)size < sizeof(*header) +
+                                header->count * sizeof(*entries) +
+                                header->strings_size) {
+    ERROR("Invalid symbol table \"%s\"\n", filename);
+    free(data);
+    return -1;
+  }
+  entries = (const symtab_entry *)(data + sizeof(*header));
+  names = (const char *)(entries + header->count);
+
+  // both lists sorted by address, so walk them together
+  labelled = malloc(config->label_count * sizeof(*labelled) + 1);
+  for (int i = 0; i < config->label_count; i++) {
+    labelled[i] = config->labels[i].ram_addr;
+  }
+  qsort(labelled, config->label_count, sizeof(*labelled), address_cmp);
+  for (unsigned int i = 0; i < header->count; i++) {
+    const symtab_entry *entry = &entries[i];
+    while (l < config->label_count && labelled[l] < entry->address) {
+      l++;
+    }
+    if ((l < config->label_count && labelled[l] == entry->address) ||
+        entry->name_offset >= header->strings_size) {
+      continue;
+    }
+    disasm_label_add(state, &names[entry->name_offset], entry->address);
+    added++;
+  }
+  INFO("Added %d labels from symbol table \"%s\"\n", added, filename);
+
+  free(labelled);
+  free(data);
+  return 0;
+}
+
 // Print version information
 void print_version(void) {
   printf("n64split v%s\n", N64SPLIT_VERSION);
@@ -1213,6 +1488,14 @@ int parse_arguments(int argc, char *argv[], arg_config *config) {
                     "merge related instructions in to pseudoinstructions", NULL,
                     &config->merge_pseudo, false, NULL, 0);
 
+  argparse_add_flag(parser, '\0', "no-cache", ARG_TYPE_NONE,
+                    "always disassemble instead of using OUTPUT_DIR/.cache",
+                    NULL, &config->no_cache, false, NULL, 0);
+
+  argparse_add_flag(parser, 'l', "symbols", ARG_TYPE_STRING,
+                    "add labels from an n64symbols binary symbol table",
+                    "SYMBOLS", &config->symbols_file, false, NULL, 0);
+
   argparse_add_flag(parser, 'o', "output-dir", ARG_TYPE_STRING,
                     "output directory (default: {CONFIG.basename}.split)",
                     "OUTPUT_DIR", &config->output_dir, false, NULL, 0);
@@ -1221,6 +1504,10 @@ int parse_arguments(int argc, char *argv[], arg_config *config) {
                     "output raw texture binaries", NULL, &config->raw_texture,
                     false, NULL, 0);
 
+  argparse_add_flag(parser, '\0', "skybox-tiles", ARG_TYPE_NONE,
+                    "also save each 32x32 skybox tile", NULL,
+                    &config->skybox_tiles, false, NULL, 0);
+
   argparse_add_flag(parser, 's', "scale", ARG_TYPE_FLOAT,
                     "amount to scale models by", "SCALE", &config->model_scale,
                     false, NULL, 0);
@@ -1229,6 +1516,11 @@ int parse_arguments(int argc, char *argv[], arg_config *config) {
                     "generate large texture for MIO0 blocks", NULL,
                     &config->large_texture, false, NULL, 0);
 
+  argparse_add_flag(parser, 'z', "png-effort", ARG_TYPE_ENUM,
+                    "texture PNG compression [fast, default, max] "
+                    "(default: default)",
+                    "EFFORT", &config->png_effort, false, png_effort_values, 3);
+
   argparse_add_flag(parser, 'v', "verbose", ARG_TYPE_NONE,
                     "verbose progress output", NULL, &g_verbosity, false, NULL,
                     0);
@@ -1297,7 +1589,8 @@ int main(int argc, char *argv[]) {
   unsigned int size;
   float percent;
   int i;
-  n64_rom_format rom_type;
+  rom_image rom;
+  split_stats stats = {0, 0, 0.0, 0, 0};
 
   // Initialize with defaults
   args = default_args;
@@ -1312,49 +1605,35 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  len = read_file(args.input_file, &data);
-
-  if (len <= 0) {
-    switch (len) {
+  ret_val = rom_open(&rom, args.input_file);
+  if (ret_val < 0) {
+    switch (ret_val) {
       case -1:
         ERROR("Cannot open input ROM file: %s\n", args.input_file);
         break;
-      case -2:
-        ERROR("Input ROM file is too large (>256MB): %s\n", args.input_file);
-        break;
       case -3:
         ERROR("Input ROM file is empty or invalid: %s\n", args.input_file);
         break;
-      case -4:
-        ERROR("Out of memory reading ROM file: %s\n", args.input_file);
-        break;
-      case -5:
-        ERROR("Failed to read complete ROM file: %s\n", args.input_file);
-        break;
       default:
-        ERROR("Unknown error reading ROM file: %s (code: %ld)\n", args.input_file, len);
+        ERROR("Failed to read ROM file: %s\n", args.input_file);
         break;
     }
     return 2;
   }
+  len = rom.size;
 
   // confirm valid N64 ROM
-  rom_type = n64_rom_type(data, len);
-  switch (rom_type) {
-  case N64_ROM_Z64:
-    break; // Z64 is expected format
-  case N64_ROM_V64:
-    // byte-swapped BADC format, swap to big-endian ABCD format for processing
-    INFO("Byte-swapping ROM\n");
-    swap_bytes(data, len);
-    break;
-  case N64_ROM_INVALID:
+  if (rom.format == ROM_FORMAT_UNKNOWN || len < 8 * MB) {
     ERROR("This does not appear to be a valid N64 ROM\n");
     if (!args.keep_going) {
       exit(1);
     }
-    break;
+  } else if (rom.format != ROM_FORMAT_Z64) {
+    // swap to big-endian ABCD format for processing
+    INFO("Byte-swapping %s ROM\n", rom_format_name(rom.format));
   }
+  // every section may be split, so convert everything up front
+  data = rom_range(&rom, 0, rom.size);
 
   // if no config file supplied, find the right one
   if (args.config_file == NULL || strlen(args.config_file) == 0) {
@@ -1396,9 +1675,20 @@ int main(int argc, char *argv[]) {
 
   // add config labels to disasm state labels
   state = disasm_state_init(ASM_GAS, 1);
+  if (!args.no_cache) {
+    // reuse first pass results for unchanged asm sections
+    char cache_dir[FILENAME_MAX];
+    make_dir(args.output_dir);
+    sprintf(cache_dir, "%s/.cache", args.output_dir);
+    disasm_set_cache_dir(state, cache_dir);
+  }
   for (i = 0; i < config.label_count; i++) {
     disasm_label_add(state, config.labels[i].name, config.labels[i].ram_addr);
   }
+  if (args.symbols_file &&
+      add_symbol_labels(state, &config, args.symbols_file) != 0) {
+    return 1;
+  }
 
   // first pass disassembler on each asm section
   INFO("Running first pass disassembler...\n");
@@ -1449,9 +1739,18 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (!args.no_cache) {
+    // index for disassembling any window later with mipsdisasm -i
+    char index_file[FILENAME_MAX];
+    sprintf(index_file, "%s/.cache/%s.idx", args.output_dir, config.basename);
+    disasm_index_save(state, data, len, index_file);
+  }
+
   // split the ROM
   INFO("Splitting ROM...\n");
-  split_file(data, len, &args, &config, state);
+  png_options png_opts = {(png_effort)args.png_effort, NULL};
+  png_set_default_options(&png_opts);
+  split_file(data, len, &args, &config, state, &stats);
 
   // print some stats
   printf("\nROM split statistics:\n");
@@ -1465,7 +1764,17 @@ int main(int argc, char *argv[]) {
   printf("Total decoded section size:  %X/%lX (%.4f%%) (i.e sections that are "
          "not .bin)\n",
          size, len, percent);
+  if (stats.png_count) {
+    printf("Texture PNGs written:        %d (%ld bytes, %.3f s)\n",
+           stats.png_count, stats.png_bytes, stats.png_seconds);
+  }
+  if (stats.dup_count) {
+    printf("Duplicate textures linked:   %d (%ld bytes not re-encoded)\n",
+           stats.dup_count, stats.dup_bytes);
+  }
   size = 0;
 
+  rom_close(&rom);
+
   return 0;
 }
@@ -52,13 +52,21 @@ typedef struct _arg_config {
   bool large_texture_depth;
   bool keep_going;
   bool merge_pseudo;
+  bool no_cache;
+  char *symbols_file;
+  int png_effort; // PNG write effort, a png_effort value: 0 = fast, 1 = default,
+                  // 2 = max (default PNG_EFFORT_DEFAULT)
+  bool skybox_tiles;
 } arg_config;
 
-typedef enum {
-  N64_ROM_INVALID,
-  N64_ROM_Z64,
-  N64_ROM_V64,
-} n64_rom_format;
+// totals reported after splitting
+typedef struct {
+  int png_count;      // texture PNGs written
+  long png_bytes;     // size of all texture PNGs
+  double png_seconds; // time spent encoding and writing them
+  int dup_count;      // textures linked to an identical earlier texture
+  long dup_bytes;     // size of the PNGs linked rather than written
+} split_stats;
 
 /* Collision */
 typedef struct {
@@ -82,7 +90,6 @@ extern geo_command geo_table[];
 
 /* Main */
 void print_spaces(FILE *fp, int count);
-n64_rom_format n64_rom_type(unsigned char *buf, unsigned int length);
 void gzip_decode_file(char *gzfilename, int offset, char *binfilename);
 int config_section_lookup(rom_config *config, unsigned int addr, char *label,
                           int is_end);
@@ -103,7 +110,7 @@ void write_bin_type(split_section *sec, char *outfilename, char *start_label,
                     arg_config *args, rom_config *config);
 
 void split_file(unsigned char *data, unsigned int length, arg_config *args,
-                rom_config *config, disasm_state *state);
+                rom_config *config, disasm_state *state, split_stats *stats);
 
 int parse_arguments(int argc, char *argv[], arg_config *config);
 void print_version(void);
@@ -4,12 +4,36 @@
 #include <stdbool.h>
 #include <ctype.h>
 
+#if !defined(N64SYMBOLS_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#elif !defined(N64SYMBOLS_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "argparse.h"
 #include "libn64.h"
+#include "n64symbols.h"
+#include "parallel.h"
+#include "romimage.h"
 #include "utils.h"
 
 #define N64SYMBOLS_VERSION "1.0"
 
+typedef enum {
+    ENCODING_ASCII,
+    ENCODING_SJIS,
+    ENCODING_EUC_JP,
+} string_encoding;
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_YAML,
+    FORMAT_LD,
+    FORMAT_BINARY,
+} output_format;
+
+static const char *const format_extensions[] = {"sym", "yaml", "ld", "nsym"};
+
 typedef struct {
     char *rom_file;
     char *output_file;
@@ -21,6 +45,9 @@ typedef struct {
     unsigned int base_address;
     unsigned int min_function_size;
     unsigned int max_string_length;
+    int encoding; // string_encoding
+    int threads;
+    int format; // output_format
 } arg_config;
 
 static arg_config default_config = {
@@ -34,64 +61,112 @@ static arg_config default_config = {
     0x80000000, // base_address
     16,         // min_function_size
     256,        // max_string_length
+    ENCODING_ASCII, // encoding
+    0,          // threads (0: one per CPU)
+    FORMAT_TEXT, // format
+};
+
+static const char *const symbol_type_names[SYMBOL_KIND_COUNT] = {
+    "string", "jumptable", "function",
 };
 
 typedef struct {
     unsigned int address;
     unsigned int size;
     char name[64];
-    char type[16];
+    symbol_kind kind;
 } symbol_entry;
 
+// symbols in insertion order, with an open addressing hash of their
+// addresses so each address holds only its highest priority symbol
 typedef struct {
     symbol_entry *symbols;
     int count;
     int capacity;
+    int *index; // symbol index + 1 per hash slot, 0 if empty
+    int index_size;
 } symbol_table;
 
-
-
 static symbol_table *symbol_table_create(void) {
-    symbol_table *table = malloc(sizeof(symbol_table));
-    if (!table) return NULL;
-    
-    table->capacity = 1000;
-    table->symbols = malloc(table->capacity * sizeof(symbol_entry));
-    if (!table->symbols) {
-        free(table);
-        return NULL;
-    }
-    
-    table->count = 0;
-    return table;
+    return calloc(1, sizeof(symbol_table));
+}
+
+static void symbol_table_clear(symbol_table *table) {
+    free(table->symbols);
+    free(table->index);
+    memset(table, 0, sizeof(*table));
 }
 
 static void symbol_table_free(symbol_table *table) {
     if (table) {
-        free(table->symbols);
+        symbol_table_clear(table);
         free(table);
     }
 }
 
+static inline unsigned int address_hash(unsigned int address) {
+    return (address >> 2) * 0x9E3779B1U;
+}
+
+// hash slot holding address, or the empty slot where it belongs
+static int symbol_table_slot(const symbol_table *table, unsigned int address) {
+    unsigned int mask = table->index_size - 1;
+    unsigned int slot = address_hash(address) & mask;
+    while (table->index[slot] &&
+           table->symbols[table->index[slot] - 1].address != address) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int symbol_table_grow_index(symbol_table *table) {
+    int *old_index = table->index;
+    int old_size = table->index_size;
+    
+    table->index_size = old_size ? old_size * 2 : 256;
+    table->index = calloc(table->index_size, sizeof(*table->index));
+    if (!table->index) return -1;
+    for (int i = 0; i < old_size; i++) {
+        if (old_index[i]) {
+            unsigned int address = table->symbols[old_index[i] - 1].address;
+            table->index[symbol_table_slot(table, address)] = old_index[i];
+        }
+    }
+    free(old_index);
+    return 0;
+}
+
 static int symbol_table_add(symbol_table *table, unsigned int address, 
-                           unsigned int size, const char *name, const char *type) {
-    if (table->count >= table->capacity) {
-        table->capacity *= 2;
-        symbol_entry *new_symbols = realloc(table->symbols, 
-                                          table->capacity * sizeof(symbol_entry));
-        if (!new_symbols) return -1;
-        table->symbols = new_symbols;
+                           unsigned int size, const char *name, symbol_kind kind) {
+    // keep the hash at most half full
+    if (table->count * 2 >= table->index_size && symbol_table_grow_index(table)) {
+        return -1;
+    }
+    
+    int slot = symbol_table_slot(table, address);
+    symbol_entry *entry;
+    if (table->index[slot]) {
+        // another detector claimed this address, keep the higher priority one
+        entry = &table->symbols[table->index[slot] - 1];
+        if (kind <= entry->kind) return 0;
+    } else {
+        if (table->count >= table->capacity) {
+            table->capacity = table->capacity ? table->capacity * 2 : 64;
+            symbol_entry *new_symbols = realloc(table->symbols, 
+                                              table->capacity * sizeof(symbol_entry));
+            if (!new_symbols) return -1;
+            table->symbols = new_symbols;
+        }
+        entry = &table->symbols[table->count];
+        table->count++;
+        table->index[slot] = table->count;
     }
     
-    symbol_entry *entry = &table->symbols[table->count];
     entry->address = address;
     entry->size = size;
     strncpy(entry->name, name, sizeof(entry->name) - 1);
     entry->name[sizeof(entry->name) - 1] = '\0';
-    strncpy(entry->type, type, sizeof(entry->type) - 1);
-    entry->type[sizeof(entry->type) - 1] = '\0';
-    
-    table->count++;
+    entry->kind = kind;
     return 0;
 }
 
@@ -99,269 +174,565 @@ static bool is_valid_string_char(unsigned char c) {
     return (c >= 0x20 && c <= 0x7E) || c == '\t' || c == '\n' || c == '\r';
 }
 
-static bool is_printable_string(const unsigned char *data, int length) {
-    if (length < 4) return false; // Too short to be useful
+// length of the Shift-JIS or EUC-JP character starting with a byte >= 0x80,
+// or 0 if it does not start a valid character
+static int mb_char_length(const unsigned char *data, long avail, int encoding) {
+    unsigned char c = data[0];
     
-    int printable_count = 0;
-    for (int i = 0; i < length; i++) {
-        if (is_valid_string_char(data[i])) {
-            printable_count++;
-        } else if (data[i] == 0) {
-            // Null terminator is okay at the end
-            if (i == length - 1 || i >= 3) {
-                break;
-            }
-            return false;
-        } else {
-            return false;
+    if (encoding == ENCODING_SJIS) {
+        if (c >= 0xA1 && c <= 0xDF) return 1; // half-width katakana
+        if (((c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC)) && avail >= 2) {
+            unsigned char t = data[1];
+            if ((t >= 0x40 && t <= 0x7E) || (t >= 0x80 && t <= 0xFC)) return 2;
         }
+    } else if (encoding == ENCODING_EUC_JP) {
+        if (c >= 0xA1 && c <= 0xFE && avail >= 2 &&
+            data[1] >= 0xA1 && data[1] <= 0xFE) return 2;
+        if (c == 0x8E && avail >= 2 && // half-width katakana
+            data[1] >= 0xA1 && data[1] <= 0xDF) return 2;
+        if (c == 0x8F && avail >= 3 && // JIS X 0212
+            data[1] >= 0xA1 && data[1] <= 0xFE &&
+            data[2] >= 0xA1 && data[2] <= 0xFE) return 3;
+    }
+    return 0;
+}
+
+// Vector classifiers: bit i of a mask describes byte p[i]. Byte compares are
+// signed, so bytes >= 0x80 fall outside the printable 0x20-0x7E range.
+#if !defined(N64SYMBOLS_SCALAR) && defined(__AVX2__)
+#define SCAN_WIDTH 32
+#define SCAN_ALL 0xFFFFFFFFU
+
+static inline unsigned int ascii_mask(const unsigned char *p) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)p);
+    __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(0x1F)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), c));
+    __m256i space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t')),
+                                                    _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n'))),
+                                    _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')));
+    return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(printable, space));
+}
+
+static inline unsigned int high_mask(const unsigned char *p) {
+    return (unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)p));
+}
+#elif !defined(N64SYMBOLS_SCALAR) && defined(__SSE2__)
+#define SCAN_WIDTH 16
+#define SCAN_ALL 0xFFFFU
+
+static inline unsigned int ascii_mask(const unsigned char *p) {
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(0x1F)),
+                                      _mm_cmplt_epi8(c, _mm_set1_epi8(0x7F)));
+    __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\t')),
+                                              _mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))),
+                                 _mm_cmpeq_epi8(c, _mm_set1_epi8('\r')));
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(printable, space));
+}
+
+static inline unsigned int high_mask(const unsigned char *p) {
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+}
+#endif
+
+// first offset in [pos, end) that is not a printable ASCII string character
+static long skip_ascii_run(const unsigned char *data, long pos, long end) {
+#ifdef SCAN_WIDTH
+    for (; pos + SCAN_WIDTH <= end; pos += SCAN_WIDTH) {
+        unsigned int invalid = ~ascii_mask(data + pos) & SCAN_ALL;
+        if (invalid) return pos + __builtin_ctz(invalid);
+    }
+#endif
+    while (pos < end && is_valid_string_char(data[pos])) pos++;
+    return pos;
+}
+
+// first offset in [pos, end) that may start a string: a printable ASCII
+// character, or any byte >= 0x80 for multi-byte encodings
+static long find_run_start(const unsigned char *data, long pos, long end, bool multibyte) {
+#ifdef SCAN_WIDTH
+    for (; pos + SCAN_WIDTH <= end; pos += SCAN_WIDTH) {
+        unsigned int start = ascii_mask(data + pos);
+        if (multibyte) start |= high_mask(data + pos);
+        if (start) return pos + __builtin_ctz(start);
+    }
+#endif
+    while (pos < end && !is_valid_string_char(data[pos]) &&
+           !(multibyte && data[pos] >= 0x80)) {
+        pos++;
+    }
+    return pos;
+}
+
+// end of the run of string characters starting at pos
+static long scan_run(const unsigned char *data, long pos, long end, int encoding) {
+    for (;;) {
+        pos = skip_ascii_run(data, pos, end);
+        if (encoding == ENCODING_ASCII || pos >= end) return pos;
+        int length = mb_char_length(data + pos, end - pos, encoding);
+        if (length == 0) return pos;
+        pos += length;
     }
+}
+
+// start of the longest string of at most max_length bytes ending at end,
+// on a character boundary of the run [start, end)
+static long string_start(const unsigned char *data, long start, long end,
+                         long max_length, int encoding) {
+    if (encoding == ENCODING_ASCII) return MAX(start, end - max_length);
+    while (end - start > max_length) {
+        start += data[start] < 0x80 ? 1 : mb_char_length(data + start, end - start, encoding);
+    }
+    return start;
+}
+
+// Each detector scans one chunk of the ROM and reports the symbols the chunk
+// owns. Chunks are scanned independently, so each detector restarts at a
+// point where the serial scan's state is known, and stops at the point where
+// the next chunk restarts: together the chunks find exactly the symbols of
+// one scan over the whole ROM.
+typedef struct {
+    long start; // first offset owned by this chunk
+    long end;   // first offset owned by the next chunk
+    symbol_table strings;
+    symbol_table functions;
+    symbol_table jumptables;
+} scan_chunk;
+
+#define SCAN_CHUNK_SIZE 0x100000
+
+static void add_string(unsigned char *rom_data, long offset, int length,
+                       symbol_table *table, arg_config *config) {
+    char name[128];
+    char safe_preview[32];
+    int preview_len = length > 20 ? 20 : length;
+    
+    // Create safe preview (replace non-printable chars)
+    for (int i = 0; i < preview_len; i++) {
+        unsigned char c = rom_data[offset + i];
+        safe_preview[i] = (c >= 0x20 && c <= 0x7E) ? c : '?';
+    }
+    safe_preview[preview_len] = '\0';
     
-    // Must be at least 75% printable characters
-    return (printable_count * 100 / length) >= 75;
+    snprintf(name, sizeof(name), "str_%08lX_%s%s", 
+            (unsigned long)(config->base_address + offset),
+            safe_preview,
+            length > 20 ? "..." : "");
+    
+    // Remove spaces and special chars from name
+    for (char *p = name; *p; p++) {
+        if (!isalnum(*p) && *p != '_') *p = '_';
+    }
+    
+    symbol_table_add(table, config->base_address + offset, 
+                   length + 1, name, SYMBOL_STRING);
 }
 
-static void extract_strings(unsigned char *rom_data, long rom_size, 
-                           symbol_table *table, arg_config *config) {
+// first offset in [pos, end) holding a byte that ends every run of string
+// characters in this encoding, or end
+static long find_run_break(const unsigned char *data, long pos, long end, int encoding) {
+    while (pos < end && (is_valid_string_char(data[pos]) ||
+                         (encoding != ENCODING_ASCII && data[pos] >= 0x80))) {
+        pos++;
+    }
+    return pos;
+}
+
+static void scan_strings(unsigned char *rom_data, long rom_size, 
+                        scan_chunk *chunk, arg_config *config) {
     const int min_string_length = 4;
-    
-    if (config->verbose) {
-        INFO("Scanning for strings (min length: %d, max length: %d)...\n", 
-             min_string_length, config->max_string_length);
+    const long limit = rom_size - min_string_length;
+    bool multibyte = config->encoding != ENCODING_ASCII;
+    long offset = 0;
+    long stop = rom_size;
+    
+    // The serial scan always resumes right after a run break, so restart
+    // after the first one in this chunk and stop at the first one in the next
+    if (chunk->start > 0) {
+        long sync = find_run_break(rom_data, chunk->start, rom_size, config->encoding);
+        if (sync >= chunk->end) return; // previous chunk scans through
+        offset = sync + 1;
+    }
+    if (chunk->end < rom_size) {
+        stop = find_run_break(rom_data, chunk->end, rom_size, config->encoding);
     }
     
-    for (long offset = 0; offset < rom_size - min_string_length; offset++) {
-        // Look for potential string start
-        if (!is_valid_string_char(rom_data[offset])) continue;
+    // A string is a run of string characters terminated by NUL. Runs are
+    // found in bulk; a run longer than the maximum keeps its last
+    // max_string_length bytes, and any other run that is not NUL terminated
+    // contains no string, so scanning resumes after it.
+    while (offset < MIN(limit, stop)) {
+        long start = find_run_start(rom_data, offset, MIN(limit, stop), multibyte);
+        if (start >= MIN(limit, stop)) break;
         
-        // Find end of string
-        int length = 0;
-        while (offset + length < rom_size && 
-               length < (int)config->max_string_length &&
-               rom_data[offset + length] != 0) {
-            
-            if (!is_valid_string_char(rom_data[offset + length])) {
-                break;
+        long end = scan_run(rom_data, start, rom_size, config->encoding);
+        if (end < rom_size && end > start && rom_data[end] == 0) {
+            long string = string_start(rom_data, start, end,
+                                       config->max_string_length, config->encoding);
+            if (end - string >= min_string_length) {
+                add_string(rom_data, string, end - string, &chunk->strings, config);
             }
-            length++;
         }
         
-        // Check if we found a null terminator
-        if (offset + length < rom_size && 
-            rom_data[offset + length] == 0 &&
-            length >= min_string_length &&
-            is_printable_string(rom_data + offset, length)) {
-            
-            char name[128];
-            char safe_preview[32];
-            int preview_len = length > 20 ? 20 : length;
-            
-            // Create safe preview (replace non-printable chars)
-            for (int i = 0; i < preview_len; i++) {
-                unsigned char c = rom_data[offset + i];
-                safe_preview[i] = (c >= 0x20 && c <= 0x7E) ? c : '?';
-            }
-            safe_preview[preview_len] = '\0';
-            
-            snprintf(name, sizeof(name), "str_%08lX_%s%s", 
-                    (unsigned long)(config->base_address + offset),
-                    safe_preview,
-                    length > 20 ? "..." : "");
-            
-            // Remove spaces and special chars from name
-            for (char *p = name; *p; p++) {
-                if (!isalnum(*p) && *p != '_') *p = '_';
-            }
-            
-            symbol_table_add(table, config->base_address + offset, 
-                           length + 1, name, "string");
-            
-            if (config->verbose && table->count % 100 == 0) {
-                INFO("Found %d strings so far...\n", table->count);
-            }
+        // Skip past this run and its terminator
+        offset = end + 1;
+    }
+}
+
+// primary opcodes accepted as MIPS instructions, indexed by word >> 26
+static const bool mips_opcode_table[64] = {
+    [0x00] = true, // SPECIAL (R-type instructions)
+    [0x01] = true, // REGIMM
+    [0x02] = true, // J
+    [0x03] = true, // JAL
+    [0x04] = true, // BEQ
+    [0x05] = true, // BNE
+    [0x06] = true, // BLEZ
+    [0x07] = true, // BGTZ
+    [0x08] = true, // ADDI
+    [0x09] = true, // ADDIU
+    [0x0A] = true, // SLTI
+    [0x0B] = true, // SLTIU
+    [0x0C] = true, // ANDI
+    [0x0D] = true, // ORI
+    [0x0E] = true, // XORI
+    [0x0F] = true, // LUI
+    [0x20] = true, // LB
+    [0x21] = true, // LH
+    [0x23] = true, // LW
+    [0x24] = true, // LBU
+    [0x25] = true, // LHU
+    [0x28] = true, // SB
+    [0x29] = true, // SH
+    [0x2B] = true, // SW
+};
+
+static inline bool looks_like_mips_instruction(unsigned int word) {
+    return mips_opcode_table[word >> 26];
+}
+
+#define MAX_FUNCTION_WORDS 256 // longest run scanned for a JR RA
+
+static void scan_functions(unsigned char *rom_data, long rom_size, 
+                          scan_chunk *chunk, arg_config *config) {
+    int min_words = config->min_function_size / 4;
+    // a function never spans more than MAX_FUNCTION_WORDS, so looking back
+    // that far recovers the serial scan's state at the chunk start
+    long from = MAX(0, chunk->start - (MAX_FUNCTION_WORDS - 1) * 4);
+    long start = from; // first offset that may still begin a function
+    
+    // Single pass: a function is the run of MIPS-like words ending in JR RA,
+    // limited to the last MAX_FUNCTION_WORDS words before it. Offsets earlier
+    // in the run can never reach a return, so each word is visited once.
+    for (long offset = from; offset < MIN(chunk->end, rom_size - 4); offset += 4) {
+        unsigned int inst = read_u32_be(rom_data + offset);
+        
+        if (!looks_like_mips_instruction(inst)) {
+            start = offset + 4;
+            continue;
+        }
+        
+        if (inst != 0x03E00008) { // jr $ra
+            continue;
+        }
+        
+        long func_start = MAX(start, offset - (MAX_FUNCTION_WORDS - 1) * 4);
+        int instruction_count = (offset - func_start) / 4 + 1;
+        
+        // If we found enough instructions before the return, it's likely a function
+        if (offset >= chunk->start && instruction_count >= min_words &&
+            func_start < rom_size - (long)config->min_function_size) {
+            char name[64];
+            snprintf(name, sizeof(name), "func_%08lX", (unsigned long)(config->base_address + func_start));
             
-            // Skip past this string
-            offset += length;
+            symbol_table_add(&chunk->functions, config->base_address + func_start, 
+                           offset + 4 - func_start, name, SYMBOL_FUNCTION);
         }
+        
+        // Skip past this function
+        start = offset + 4;
     }
+}
+
+#define JUMPTABLE_MIN_ENTRIES 4
+#define JUMPTABLE_MAX_ENTRIES 64
+
+static inline bool is_jumptable_entry(unsigned int addr) {
+    return addr >= 0x80000000 && addr < 0x80800000;
+}
+
+static void add_jumptable(symbol_table *table, arg_config *config,
+                          long offset, int count) {
+    char name[64];
+    snprintf(name, sizeof(name), "jtbl_%08lX", (unsigned long)(config->base_address + offset));
     
-    if (config->verbose) {
-        INFO("String extraction complete. Found %d strings.\n", table->count);
-    }
-}
-
-static bool looks_like_mips_instruction(unsigned int word) {
-    // Check for common MIPS instruction patterns
-    unsigned int opcode = (word >> 26) & 0x3F;
-    
-    // Common MIPS opcodes
-    switch (opcode) {
-        case 0x00: // SPECIAL (R-type instructions)
-        case 0x01: // REGIMM  
-        case 0x02: // J
-        case 0x03: // JAL
-        case 0x04: // BEQ
-        case 0x05: // BNE
-        case 0x06: // BLEZ
-        case 0x07: // BGTZ
-        case 0x08: // ADDI
-        case 0x09: // ADDIU
-        case 0x0A: // SLTI
-        case 0x0B: // SLTIU
-        case 0x0C: // ANDI
-        case 0x0D: // ORI
-        case 0x0E: // XORI
-        case 0x0F: // LUI
-        case 0x20: // LB
-        case 0x21: // LH
-        case 0x23: // LW
-        case 0x24: // LBU
-        case 0x25: // LHU
-        case 0x28: // SB
-        case 0x29: // SH
-        case 0x2B: // SW
-            return true;
-        default:
-            return false;
-    }
-}
-
-static void extract_functions(unsigned char *rom_data, long rom_size, 
-                             symbol_table *table, arg_config *config) {
-    if (config->verbose) {
-        INFO("Scanning for functions (min size: %d bytes)...\n", config->min_function_size);
+    symbol_table_add(table, config->base_address + offset, 
+                   count * 4, name, SYMBOL_JUMPTABLE);
+}
+
+static void scan_jumptables(unsigned char *rom_data, long rom_size, 
+                           scan_chunk *chunk, arg_config *config) {
+    const long limit = rom_size - 4;
+    long offset = 0; // word after a non-address word, or 0
+    
+    // Runs restart after every non-address word: begin after the first one in
+    // this chunk and continue through the first one in the next
+    if (chunk->start > 0) {
+        offset = chunk->start;
+        while (offset < limit && is_jumptable_entry(read_u32_be(rom_data + offset))) {
+            offset += 4;
+        }
+        if (offset >= chunk->end) return; // previous chunk scans through
+        offset += 4;
     }
     
-    int function_count = 0;
-    
-    for (long offset = 0; offset < rom_size - config->min_function_size; offset += 4) {
-        // Look for potential function start
-        unsigned int word = read_u32_be(rom_data + offset);
-        
-        if (!looks_like_mips_instruction(word)) continue;
-        
-        // Scan ahead to see if this looks like a function
-        int instruction_count = 0;
-        long scan_offset = offset;
-        bool found_return = false;
+    while (offset < limit) {
+        // Prefilter: a run of JUMPTABLE_MIN_ENTRIES addresses starting at or
+        // after offset covers one of every JUMPTABLE_MIN_ENTRIES words, so
+        // only those need reading until one is an address
+        long probe = offset + (JUMPTABLE_MIN_ENTRIES - 1) * 4;
+        if (probe >= limit) return;
+        if (!is_jumptable_entry(read_u32_be(rom_data + probe))) {
+            if (probe >= chunk->end) return; // next chunk restarts here
+            offset = probe + 4;
+            continue;
+        }
         
-        while (scan_offset < rom_size - 4 && 
-               scan_offset < offset + 1024 && // Max function scan size
-               instruction_count < 256) {
-            
-            unsigned int inst = read_u32_be(rom_data + scan_offset);
-            
-            if (!looks_like_mips_instruction(inst)) {
-                break;
-            }
-            
-            instruction_count++;
-            
-            // Check for return instruction (JR RA)
-            if ((inst & 0xFFFFFFFF) == 0x03E00008) { // jr $ra
-                found_return = true;
-                scan_offset += 4;
-                break;
-            }
-            
-            scan_offset += 4;
+        // back up to the start of the run
+        long start = probe;
+        while (start > offset && is_jumptable_entry(read_u32_be(rom_data + start - 4))) {
+            start -= 4;
         }
+        if (start > chunk->end) return;
         
-        // If we found enough instructions and a return, it's likely a function
-        if (instruction_count >= (int)(config->min_function_size / 4) && found_return) {
-            char name[64];
-            snprintf(name, sizeof(name), "func_%08lX", (unsigned long)(config->base_address + offset));
-            
-            symbol_table_add(table, config->base_address + offset, 
-                           scan_offset - offset, name, "function");
-            
-            function_count++;
-            
-            if (config->verbose && function_count % 50 == 0) {
-                INFO("Found %d functions so far...\n", function_count);
+        // a run of at least JUMPTABLE_MIN_ENTRIES becomes a table, split
+        // every JUMPTABLE_MAX_ENTRIES
+        int count = 0;
+        for (offset = start; offset < limit &&
+             is_jumptable_entry(read_u32_be(rom_data + offset)); offset += 4) {
+            if (++count == JUMPTABLE_MAX_ENTRIES) {
+                add_jumptable(&chunk->jumptables, config, start, count);
+                start = offset + 4;
+                count = 0;
             }
-            
-            // Skip past this function
-            offset = scan_offset - 4; // -4 because loop will add 4
         }
+        if (count >= JUMPTABLE_MIN_ENTRIES) {
+            add_jumptable(&chunk->jumptables, config, start, count);
+        }
+        offset += 4;
     }
-    
-    if (config->verbose) {
-        INFO("Function extraction complete. Found %d functions.\n", function_count);
+}
+
+typedef struct {
+    unsigned char *rom_data;
+    long rom_size;
+    scan_chunk *chunks;
+    arg_config *config;
+} scan_job;
+
+// fused sweep: run every enabled detector over one chunk while it is cached
+static void scan_chunk_fn(int index, int worker, void *arg) {
+    scan_job *job = arg;
+    scan_chunk *chunk = &job->chunks[index];
+    (void)worker;
+    
+    if (job->config->extract_strings) {
+        scan_strings(job->rom_data, job->rom_size, chunk, job->config);
+    }
+    if (job->config->extract_functions) {
+        scan_functions(job->rom_data, job->rom_size, chunk, job->config);
+    }
+    if (job->config->extract_jumptables) {
+        scan_jumptables(job->rom_data, job->rom_size, chunk, job->config);
+    }
+}
+
+// append src to table, both in address order
+static void symbol_table_append(symbol_table *table, const symbol_table *src) {
+    for (int i = 0; i < src->count; i++) {
+        const symbol_entry *sym = &src->symbols[i];
+        symbol_table_add(table, sym->address, sym->size, sym->name, sym->kind);
     }
 }
 
-static void extract_jumptables(unsigned char *rom_data, long rom_size, 
-                              symbol_table *table, arg_config *config) {
+static void extract_symbols(unsigned char *rom_data, long rom_size, 
+                           symbol_table *table, arg_config *config) {
+    int chunk_count = (int)((rom_size + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE);
+    scan_chunk *chunks = calloc(MAX(chunk_count, 1), sizeof(*chunks));
+    symbol_table found[3] = {{0}}; // strings, functions, jump tables
+    int next[3] = {0};
+    scan_job job;
+    
+    for (int i = 0; i < chunk_count; i++) {
+        chunks[i].start = (long)i * SCAN_CHUNK_SIZE;
+        chunks[i].end = MIN(chunks[i].start + SCAN_CHUNK_SIZE, rom_size);
+    }
+    
     if (config->verbose) {
-        INFO("Scanning for jump tables...\n");
+        INFO("Scanning %d chunks on %d threads...\n", chunk_count,
+             config->threads > 0 ? MIN(config->threads, chunk_count) : MIN(cpu_count(), chunk_count));
     }
     
-    int jumptable_count = 0;
+    job.rom_data = rom_data;
+    job.rom_size = rom_size;
+    job.chunks = chunks;
+    job.config = config;
+    parallel_for(chunk_count, config->threads, scan_chunk_fn, &job);
+    
+    // chunks cover increasing offsets, so each detector's results are
+    // already in address order once concatenated
+    for (int i = 0; i < chunk_count; i++) {
+        symbol_table_append(&found[0], &chunks[i].strings);
+        symbol_table_append(&found[1], &chunks[i].functions);
+        symbol_table_append(&found[2], &chunks[i].jumptables);
+        symbol_table_clear(&chunks[i].strings);
+        symbol_table_clear(&chunks[i].functions);
+        symbol_table_clear(&chunks[i].jumptables);
+    }
+    free(chunks);
     
-    // Look for sequences of addresses that could be jump tables
-    for (long offset = 0; offset < rom_size - 16; offset += 4) {
-        unsigned int addr1 = read_u32_be(rom_data + offset);
-        unsigned int addr2 = read_u32_be(rom_data + offset + 4);
-        unsigned int addr3 = read_u32_be(rom_data + offset + 8);
-        unsigned int addr4 = read_u32_be(rom_data + offset + 12);
-        
-        // Check if these look like N64 addresses in sequence
-        if ((addr1 >= 0x80000000 && addr1 < 0x80800000) &&
-            (addr2 >= 0x80000000 && addr2 < 0x80800000) &&
-            (addr3 >= 0x80000000 && addr3 < 0x80800000) &&
-            (addr4 >= 0x80000000 && addr4 < 0x80800000)) {
-            
-            // Count how many consecutive addresses we have
-            int count = 4;
-            long scan_offset = offset + 16;
-            
-            while (scan_offset < rom_size - 4 && count < 64) {
-                unsigned int addr = read_u32_be(rom_data + scan_offset);
-                
-                if (addr < 0x80000000 || addr >= 0x80800000) {
-                    break;
-                }
-                
-                count++;
-                scan_offset += 4;
-            }
-            
-            // If we found a reasonable number of addresses, call it a jump table
-            if (count >= 4) {
-                char name[64];
-                snprintf(name, sizeof(name), "jtbl_%08lX", (unsigned long)(config->base_address + offset));
-                
-                symbol_table_add(table, config->base_address + offset, 
-                               count * 4, name, "jumptable");
-                
-                jumptable_count++;
-                
-                if (config->verbose && jumptable_count % 10 == 0) {
-                    INFO("Found %d jump tables so far...\n", jumptable_count);
-                }
-                
-                // Skip past this jump table
-                offset = scan_offset - 4; // -4 because loop will add 4
+    if (config->verbose) {
+        if (config->extract_strings) INFO("Found %d strings.\n", found[0].count);
+        if (config->extract_functions) INFO("Found %d functions.\n", found[1].count);
+        if (config->extract_jumptables) INFO("Found %d jump tables.\n", found[2].count);
+    }
+    
+    // merge the detectors in address order; the table keeps the highest
+    // priority symbol at each address, so it stays sorted
+    for (;;) {
+        int best = -1;
+        for (int d = 0; d < 3; d++) {
+            if (next[d] < found[d].count &&
+                (best < 0 || found[d].symbols[next[d]].address <
+                             found[best].symbols[next[best]].address)) {
+                best = d;
             }
         }
+        if (best < 0) break;
+        const symbol_entry *sym = &found[best].symbols[next[best]++];
+        symbol_table_add(table, sym->address, sym->size, sym->name, sym->kind);
     }
-    
-    if (config->verbose) {
-        INFO("Jump table extraction complete. Found %d jump tables.\n", jumptable_count);
+    for (int d = 0; d < 3; d++) {
+        symbol_table_clear(&found[d]);
     }
 }
 
-static int symbol_compare(const void *a, const void *b) {
-    const symbol_entry *sa = (const symbol_entry *)a;
-    const symbol_entry *sb = (const symbol_entry *)b;
+// buffered output, symbols are formatted without printf
+typedef struct {
+    FILE *fp;
+    size_t len;
+    char data[0x10000];
+} out_buf;
+
+static void out_flush(out_buf *out) {
+    fwrite(out->data, 1, out->len, out->fp);
+    out->len = 0;
+}
+
+static void out_write(out_buf *out, const void *data, size_t len) {
+    if (out->len + len > sizeof(out->data)) {
+        out_flush(out);
+        if (len > sizeof(out->data)) {
+            fwrite(data, 1, len, out->fp);
+            return;
+        }
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+static void out_str(out_buf *out, const char *str) {
+    out_write(out, str, strlen(str));
+}
+
+// str left aligned in a field of width characters
+static void out_str_padded(out_buf *out, const char *str, size_t width) {
+    static const char spaces[] = "                ";
+    size_t len = strlen(str);
+    out_write(out, str, len);
+    if (len < width) out_write(out, spaces, MIN(width - len, sizeof(spaces) - 1));
+}
+
+static void out_hex32(out_buf *out, unsigned int value) {
+    static const char digits[] = "0123456789ABCDEF";
+    char hex[8];
+    for (int i = 7; i >= 0; i--) {
+        hex[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    out_write(out, hex, sizeof(hex));
+}
+
+static void write_text(out_buf *out, const symbol_table *table) {
+    out_str(out, "# N64 Symbol Table\n"
+                 "# Generated by n64symbols v" N64SYMBOLS_VERSION "\n"
+                 "# Format: ADDRESS SIZE TYPE NAME\n\n");
+    for (int i = 0; i < table->count; i++) {
+        const symbol_entry *sym = &table->symbols[i];
+        out_hex32(out, sym->address);
+        out_str(out, " ");
+        out_hex32(out, sym->size);
+        out_str(out, " ");
+        out_str_padded(out, symbol_type_names[sym->kind], 10);
+        out_str(out, " ");
+        out_str(out, sym->name);
+        out_str(out, "\n");
+    }
+}
+
+// n64split config labels: [START, "NAME", END]
+static void write_yaml(out_buf *out, const symbol_table *table) {
+    out_str(out, "# Generated by n64symbols v" N64SYMBOLS_VERSION "\n"
+                 "labels:\n");
+    for (int i = 0; i < table->count; i++) {
+        const symbol_entry *sym = &table->symbols[i];
+        out_str(out, "   - [0x");
+        out_hex32(out, sym->address);
+        out_str(out, ", \"");
+        out_str(out, sym->name);
+        out_str(out, "\", 0x");
+        out_hex32(out, sym->address + sym->size);
+        out_str(out, "]\n");
+    }
+}
+
+static void write_ld(out_buf *out, const symbol_table *table) {
+    out_str(out, "/* Generated by n64symbols v" N64SYMBOLS_VERSION " */\n");
+    for (int i = 0; i < table->count; i++) {
+        const symbol_entry *sym = &table->symbols[i];
+        out_str(out, sym->name);
+        out_str(out, " = 0x");
+        out_hex32(out, sym->address);
+        out_str(out, ";\n");
+    }
+}
+
+static void write_binary(out_buf *out, const symbol_table *table) {
+    symtab_header header;
+    uint32_t name_offset = 0;
     
-    if (sa->address < sb->address) return -1;
-    if (sa->address > sb->address) return 1;
-    return 0;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMTAB_MAGIC, sizeof(header.magic));
+    header.version = SYMTAB_VERSION;
+    header.count = table->count;
+    for (int i = 0; i < table->count; i++) {
+        header.strings_size += strlen(table->symbols[i].name) + 1;
+    }
+    out_write(out, &header, sizeof(header));
+    for (int i = 0; i < table->count; i++) {
+        const symbol_entry *sym = &table->symbols[i];
+        symtab_entry entry = {sym->address, sym->size, name_offset, sym->kind};
+        out_write(out, &entry, sizeof(entry));
+        name_offset += strlen(sym->name) + 1;
+    }
+    for (int i = 0; i < table->count; i++) {
+        out_write(out, table->symbols[i].name, strlen(table->symbols[i].name) + 1);
+    }
 }
 
-static void write_symbol_table(symbol_table *table, const char *filename, bool verbose) {
+// stream the table, which extract_symbols() leaves in address order
+static void write_symbol_table(symbol_table *table, const char *filename,
+                               int format, bool verbose) {
     if (table->count == 0) {
         if (verbose) {
             INFO("No symbols found, not creating output file.\n");
@@ -369,28 +740,25 @@ static void write_symbol_table(symbol_table *table, const char *filename, bool v
         return;
     }
     
-    // Sort symbols by address
-    qsort(table->symbols, table->count, sizeof(symbol_entry), symbol_compare);
-    
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
+    out_buf *out = malloc(sizeof(*out));
+    out->fp = fopen(filename, format == FORMAT_BINARY ? "wb" : "w");
+    if (!out->fp) {
         ERROR("Failed to create output file: %s\n", filename);
+        free(out);
         return;
     }
+    out->len = 0;
     
-    // Write header
-    fprintf(fp, "# N64 Symbol Table\n");
-    fprintf(fp, "# Generated by n64symbols v" N64SYMBOLS_VERSION "\n");
-    fprintf(fp, "# Format: ADDRESS SIZE TYPE NAME\n\n");
-    
-    // Write symbols
-    for (int i = 0; i < table->count; i++) {
-        symbol_entry *sym = &table->symbols[i];
-        fprintf(fp, "%08X %08X %-10s %s\n", 
-                sym->address, sym->size, sym->type, sym->name);
+    switch (format) {
+        case FORMAT_TEXT: write_text(out, table); break;
+        case FORMAT_YAML: write_yaml(out, table); break;
+        case FORMAT_LD: write_ld(out, table); break;
+        case FORMAT_BINARY: write_binary(out, table); break;
     }
     
-    fclose(fp);
+    out_flush(out);
+    fclose(out->fp);
+    free(out);
     
     if (verbose) {
         INFO("Symbol table written to: %s\n", filename);
@@ -401,6 +769,8 @@ static void write_symbol_table(symbol_table *table, const char *filename, bool v
 static int parse_arguments(int argc, char *argv[], arg_config *config) {
     arg_parser *parser;
     int result;
+    const char *encoding_values[] = {"ascii", "sjis", "euc-jp"};
+    const char *format_values[] = {"text", "yaml", "ld", "binary"};
 
     // Initialize the argument parser
     parser = argparse_init("n64symbols", N64SYMBOLS_VERSION, "N64 ROM symbol table generator");
@@ -437,6 +807,18 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
                       "maximum string length (default: 256)", "LEN",
                       &config->max_string_length, false, NULL, 0);
 
+    argparse_add_flag(parser, 'e', "encoding", ARG_TYPE_ENUM,
+                      "string encoding [ascii, sjis, euc-jp] (default: ascii)", "ENC",
+                      &config->encoding, false, encoding_values, 3);
+
+    argparse_add_flag(parser, 'F', "format", ARG_TYPE_ENUM,
+                      "output format [text, yaml, ld, binary] (default: text)", "FORMAT",
+                      &config->format, false, format_values, 4);
+
+    argparse_add_flag(parser, 't', "threads", ARG_TYPE_INT,
+                      "number of scanning threads (default: one per CPU)", "N",
+                      &config->threads, false, NULL, 0);
+
     // Add positional arguments
     argparse_add_positional(parser, "ROM", "N64 ROM file to analyze",
                             ARG_TYPE_STRING, &config->rom_file, true);
@@ -455,8 +837,7 @@ static int parse_arguments(int argc, char *argv[], arg_config *config) {
 
 int main(int argc, char *argv[]) {
     arg_config config = default_config;
-    unsigned char *rom_data;
-    long rom_size;
+    rom_image rom;
     symbol_table *table;
     char default_output[512];
     
@@ -466,7 +847,8 @@ int main(int argc, char *argv[]) {
     
     // Set default output filename if not provided
     if (!config.output_file) {
-        snprintf(default_output, sizeof(default_output), "%s.sym", config.rom_file);
+        snprintf(default_output, sizeof(default_output), "%s.%s", config.rom_file,
+                 format_extensions[config.format]);
         config.output_file = default_output;
     }
     
@@ -494,36 +876,29 @@ int main(int argc, char *argv[]) {
         if (config.extract_strings) INFO("  - Strings (max length: %d)\n", config.max_string_length);
     }
     
-    // Read ROM file
-    rom_size = read_file(config.rom_file, &rom_data);
-    if (rom_size < 0) {
+    // Map ROM file, scanned in big-endian order whatever the dump format
+    if (rom_open(&rom, config.rom_file) < 0) {
         ERROR("Error reading ROM file \"%s\"\n", config.rom_file);
         return EXIT_FAILURE;
     }
+    if (config.verbose && rom.format != ROM_FORMAT_Z64) {
+        INFO("ROM format: %s\n", rom_format_name(rom.format));
+    }
     
     // Create symbol table
     table = symbol_table_create();
     if (!table) {
         ERROR("Failed to create symbol table\n");
-        free(rom_data);
+        rom_close(&rom);
         return EXIT_FAILURE;
     }
     
     // Extract symbols based on configuration
-    if (config.extract_strings) {
-        extract_strings(rom_data, rom_size, table, &config);
-    }
-    
-    if (config.extract_functions) {
-        extract_functions(rom_data, rom_size, table, &config);
-    }
-    
-    if (config.extract_jumptables) {
-        extract_jumptables(rom_data, rom_size, table, &config);
-    }
+    // convert everything before the scan threads share the image
+    extract_symbols(rom_range(&rom, 0, rom.size), rom.size, table, &config);
     
     // Write output file
-    write_symbol_table(table, config.output_file, config.verbose);
+    write_symbol_table(table, config.output_file, config.format, config.verbose);
     
     if (config.verbose) {
         INFO("Symbol extraction complete.\n");
@@ -531,7 +906,7 @@ int main(int argc, char *argv[]) {
     
     // Cleanup
     symbol_table_free(table);
-    free(rom_data);
+    rom_close(&rom);
     
     return EXIT_SUCCESS;
 }
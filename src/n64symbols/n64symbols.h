@@ -0,0 +1,34 @@
+#ifndef N64SYMBOLS_H_
+#define N64SYMBOLS_H_
+
+#include <stdint.h>
+
+// symbol detectors, in increasing priority when two claim the same address
+typedef enum {
+  SYMBOL_STRING,
+  SYMBOL_JUMPTABLE,
+  SYMBOL_FUNCTION,
+  SYMBOL_KIND_COUNT,
+} symbol_kind;
+
+// binary symbol table written by n64symbols --format binary, in host byte
+// order so it can be used in place: symtab_header, symtab_entry records
+// sorted by address, then the NUL terminated names
+#define SYMTAB_MAGIC "NSYM"
+#define SYMTAB_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;        // symtab_entry records
+  uint32_t strings_size; // bytes of names following the records
+} symtab_header;
+
+typedef struct {
+  uint32_t address;
+  uint32_t size;
+  uint32_t name_offset; // offset of name in the string table
+  uint32_t kind;        // symbol_kind
+} symtab_entry;
+
+#endif // N64SYMBOLS_H_
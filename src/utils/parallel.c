@@ -0,0 +1,88 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+#include "utils.h"
+
+typedef struct {
+  atomic_int next;
+  int count;
+  parallel_fn fn;
+  void *arg;
+} parallel_job;
+
+typedef struct {
+  parallel_job *job;
+  int worker;
+} parallel_worker;
+
+int cpu_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return MAX((int)info.dwNumberOfProcessors, 1);
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#endif
+}
+
+static void *parallel_thread(void *arg) {
+  parallel_worker *w = arg;
+  parallel_job *job = w->job;
+  int index;
+  while ((index = atomic_fetch_add(&job->next, 1)) < job->count) {
+    job->fn(index, w->worker, job->arg);
+  }
+  return NULL;
+}
+
+void parallel_for(int count, int thread_count, parallel_fn fn, void *arg) {
+  parallel_job job;
+  pthread_t *threads;
+  parallel_worker *workers;
+  int started;
+
+  if (thread_count < 1) {
+    thread_count = cpu_count();
+  }
+  thread_count = MIN(thread_count, count);
+  if (thread_count <= 1) {
+    for (int i = 0; i < count; i++) {
+      fn(i, 0, arg);
+    }
+    return;
+  }
+
+  atomic_init(&job.next, 0);
+  job.count = count;
+  job.fn = fn;
+  job.arg = arg;
+  threads = malloc(thread_count * sizeof(*threads));
+  workers = malloc(thread_count * sizeof(*workers));
+  // worker 0 is the calling thread
+  for (started = 1; started < thread_count; started++) {
+    workers[started].job = &job;
+    workers[started].worker = started;
+    if (pthread_create(&threads[started], NULL, parallel_thread,
+                       &workers[started]) != 0) {
+      WARNING("Could only start %d worker threads\n", started);
+      break;
+    }
+  }
+  workers[0].job = &job;
+  workers[0].worker = 0;
+  parallel_thread(&workers[0]);
+  for (int i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(workers);
+  free(threads);
+}
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+// number of online processors, at least 1
+int cpu_count(void);
+
+// work item callback
+// index: item in [0, count)
+// worker: calling worker in [0, thread_count), for per-thread state
+// arg: user argument passed to parallel_for()
+typedef void (*parallel_fn)(int index, int worker, void *arg);
+
+// call fn for every index in [0, count) spread over thread_count worker
+// threads. items are handed out in increasing order; returns once all are
+// done. thread_count < 1 uses cpu_count(), 1 runs inline without threads
+void parallel_for(int count, int thread_count, parallel_fn fn, void *arg);
+
+#endif // PARALLEL_H_
@@ -0,0 +1,184 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "romimage.h"
+
+rom_format rom_detect_format(const unsigned char *buf, size_t length) {
+  static const unsigned char z64_magic[] = {0x80, 0x37, 0x12, 0x40}; // ABCD
+  static const unsigned char v64_magic[] = {0x37, 0x80, 0x40, 0x12}; // BADC
+  static const unsigned char n64_magic[] = {0x40, 0x12, 0x37, 0x80}; // DCBA
+
+  if (length < sizeof(z64_magic)) {
+    return ROM_FORMAT_UNKNOWN;
+  }
+  if (!memcmp(buf, z64_magic, sizeof(z64_magic))) {
+    return ROM_FORMAT_Z64;
+  } else if (!memcmp(buf, v64_magic, sizeof(v64_magic))) {
+    return ROM_FORMAT_V64;
+  } else if (!memcmp(buf, n64_magic, sizeof(n64_magic))) {
+    return ROM_FORMAT_N64;
+  }
+  return ROM_FORMAT_UNKNOWN;
+}
+
+const char *rom_format_name(rom_format format) {
+  switch (format) {
+  case ROM_FORMAT_Z64:
+    return "Z64 (big-endian/ABCD)";
+  case ROM_FORMAT_V64:
+    return "V64 (byte-swapped/BADC)";
+  case ROM_FORMAT_N64:
+    return "N64 (little-endian/DCBA)";
+  default:
+    return "Unknown format";
+  }
+}
+
+// swap bytes within each halfword, BADC -> ABCD
+static void swap_page_v64(unsigned char *data, size_t length) {
+  size_t i;
+  uint32_t w;
+  for (i = 0; i + 4 <= length; i += 4) {
+    memcpy(&w, data + i, 4);
+    w = ((w & 0x00FF00FFu) << 8) | ((w >> 8) & 0x00FF00FFu);
+    memcpy(data + i, &w, 4);
+  }
+  if (i + 2 <= length) {
+    unsigned char tmp = data[i];
+    data[i] = data[i + 1];
+    data[i + 1] = tmp;
+  }
+}
+
+// reverse bytes within each word, DCBA -> ABCD
+static void swap_page_n64(unsigned char *data, size_t length) {
+  size_t i;
+  uint32_t w;
+  for (i = 0; i + 4 <= length; i += 4) {
+    memcpy(&w, data + i, 4);
+    w = (w >> 24) | ((w >> 8) & 0x0000FF00u) | ((w << 8) & 0x00FF0000u) |
+        (w << 24);
+    memcpy(data + i, &w, 4);
+  }
+}
+
+void rom_swap_range(rom_image *rom, size_t offset, size_t length) {
+  size_t first = offset / ROM_PAGE_SIZE;
+  size_t last = (offset + (length ? length : 1) - 1) / ROM_PAGE_SIZE;
+  size_t page;
+
+  for (page = first; page <= last && rom->pending; page++) {
+    size_t start = page * ROM_PAGE_SIZE;
+    size_t page_len;
+    if (rom->swapped[page] || start >= rom->size) {
+      continue;
+    }
+    page_len = rom->size - start;
+    if (page_len > ROM_PAGE_SIZE) {
+      page_len = ROM_PAGE_SIZE;
+    }
+    if (rom->format == ROM_FORMAT_V64) {
+      swap_page_v64(rom->data + start, page_len);
+    } else {
+      swap_page_n64(rom->data + start, page_len);
+    }
+    rom->swapped[page] = 1;
+    rom->pending--;
+  }
+}
+
+// fallback for platforms or files that can't be mapped
+static int rom_read(rom_image *rom, int fd) {
+  size_t done = 0;
+  rom->data = malloc(rom->size);
+  if (rom->data == NULL) {
+    return -2;
+  }
+  while (done < rom->size) {
+    long bytes = read(fd, rom->data + done, rom->size - done);
+    if (bytes <= 0) {
+      free(rom->data);
+      rom->data = NULL;
+      return -2;
+    }
+    done += bytes;
+  }
+  rom->mapped = 0;
+  return 0;
+}
+
+int rom_open(rom_image *rom, const char *file_name) {
+  struct stat st;
+  int fd;
+  int ret = 0;
+
+  memset(rom, 0, sizeof(*rom));
+  rom->format = ROM_FORMAT_UNKNOWN;
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+  fd = open(file_name, O_RDONLY | O_BINARY);
+#else
+  fd = open(file_name, O_RDONLY);
+#endif
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size <= 0) {
+    close(fd);
+    return -3;
+  }
+  rom->size = st.st_size;
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+  ret = rom_read(rom, fd);
+#else
+  // private mapping: pages are only copied when swapped or written to
+  rom->data = mmap(NULL, rom->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (rom->data == MAP_FAILED) {
+    rom->data = NULL;
+    ret = rom_read(rom, fd);
+  } else {
+    rom->mapped = 1;
+  }
+#endif
+  close(fd);
+  if (ret < 0) {
+    return ret;
+  }
+
+  rom->format = rom_detect_format(rom->data, rom->size);
+  if (rom->format == ROM_FORMAT_V64 || rom->format == ROM_FORMAT_N64) {
+    rom->pending = (rom->size + ROM_PAGE_SIZE - 1) / ROM_PAGE_SIZE;
+    rom->swapped = calloc(rom->pending, 1);
+    if (rom->swapped == NULL) {
+      rom_close(rom);
+      return -2;
+    }
+  }
+  return 0;
+}
+
+void rom_close(rom_image *rom) {
+  if (rom->mapped) {
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+    munmap(rom->data, rom->size);
+#endif
+  } else {
+    free(rom->data);
+  }
+  free(rom->swapped);
+  memset(rom, 0, sizeof(*rom));
+}
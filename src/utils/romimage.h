@@ -0,0 +1,87 @@
+#ifndef ROMIMAGE_H_
+#define ROMIMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// byte order of a ROM dump, detected from the first word of the header
+typedef enum {
+  ROM_FORMAT_Z64,     // big-endian (ABCD), native N64 order
+  ROM_FORMAT_V64,     // byte-swapped (BADC)
+  ROM_FORMAT_N64,     // little-endian (DCBA)
+  ROM_FORMAT_UNKNOWN, // not an N64 ROM, contents are used as is
+} rom_format;
+
+// granularity of lazy byte-order conversion
+#define ROM_PAGE_SIZE 0x10000
+
+// read-only view of a ROM file. the file is memory mapped copy-on-write where
+// supported, so opening is cheap and callers may modify the contents without
+// touching the file. v64 and n64 dumps are converted to big-endian a page at
+// a time the first time a range is requested through rom_range().
+typedef struct {
+  unsigned char *data; // file contents, only requested ranges are big-endian
+  size_t size;         // file size in bytes
+  rom_format format;   // byte order of the file on disk
+  // private
+  unsigned char *swapped; // per page flag, set once converted
+  size_t pending;         // pages not yet converted
+  int mapped;             // data is mapped rather than allocated
+} rom_image;
+
+// detect byte order from the start of a ROM
+// buf: start of ROM
+// length: bytes available in buf
+// returns ROM_FORMAT_UNKNOWN if too short or not a recognized header
+rom_format rom_detect_format(const unsigned char *buf, size_t length);
+
+// human readable name of a byte order, e.g. "Z64 (big-endian/ABCD)"
+const char *rom_format_name(rom_format format);
+
+// open and map a ROM file, detecting its byte order
+// rom: image to fill in
+// file_name: ROM file to open
+// returns 0 on success, -1 if the file can't be opened, -2 if it can't be
+// mapped or read, -3 if it is empty
+int rom_open(rom_image *rom, const char *file_name);
+
+// unmap or free an image opened with rom_open()
+void rom_close(rom_image *rom);
+
+// convert the pages covering [offset, offset + length) to big-endian
+// called through rom_range(), only needed directly for v64/n64 images
+void rom_swap_range(rom_image *rom, size_t offset, size_t length);
+
+// big-endian view of a range of the ROM. conversion is not thread safe:
+// request the whole ROM before sharing a v64/n64 image between threads
+// returns pointer into rom->data or NULL if the range is out of bounds
+static inline unsigned char *rom_range(rom_image *rom, size_t offset,
+                                       size_t length) {
+  if (offset > rom->size || length > rom->size - offset) {
+    return NULL;
+  }
+  if (rom->pending) {
+    rom_swap_range(rom, offset, length);
+  }
+  return rom->data + offset;
+}
+
+// big-endian accessors, out of bounds reads return 0
+static inline uint8_t rom_u8(rom_image *rom, size_t offset) {
+  const unsigned char *p = rom_range(rom, offset, 1);
+  return p ? p[0] : 0;
+}
+
+static inline uint16_t rom_u16(rom_image *rom, size_t offset) {
+  const unsigned char *p = rom_range(rom, offset, 2);
+  return p ? (uint16_t)((p[0] << 8) | p[1]) : 0;
+}
+
+static inline uint32_t rom_u32(rom_image *rom, size_t offset) {
+  const unsigned char *p = rom_range(rom, offset, 4);
+  return p ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                 ((uint32_t)p[2] << 8) | (uint32_t)p[3]
+           : 0;
+}
+
+#endif // ROMIMAGE_H_
@@ -38,6 +38,15 @@ float read_f32_be(unsigned char *buf) {
   return ret.f;
 }
 
+uint64_t fnv1a_64(const void *buf, size_t length, uint64_t hash) {
+  const unsigned char *bytes = buf;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
 int is_power2(unsigned int val) {
   while (((val & 1) == 0) && (val > 1)) {
     val >>= 1;
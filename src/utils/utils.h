@@ -2,6 +2,8 @@
 #define UTILS_H_
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 // defines
@@ -117,6 +119,14 @@ int read_s16_be(unsigned char *buf);
 // convert four bytes in big-endian to float
 float read_f32_be(unsigned char *buf);
 
+// 64-bit FNV-1a hash of a buffer
+// buf: buffer to hash
+// length: length of buffer
+// hash: running hash value, FNV1A_64_INIT to start a new hash
+// returns updated hash value
+#define FNV1A_64_INIT 0xCBF29CE484222325ULL
+uint64_t fnv1a_64(const void *buf, size_t length, uint64_t hash);
+
 // determine if value is power of 2
 // returns 1 if val is power of 2, 0 otherwise
 int is_power2(unsigned int val);
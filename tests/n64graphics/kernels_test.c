@@ -0,0 +1,362 @@
+// kernels_test: compare the n64graphics raw <-> RGBA/IA/I converters with
+// the per-pixel loops they replaced
+//
+// Build once per kernel set (scalar, SSE2, AVX2). Every build must match the
+// reference loops below exactly:
+// - decoding every 16-bit value (16/32-bit formats) or byte value (8-bit and
+//   smaller formats)
+// - encoding every intensity/alpha pair and every red/green pair
+// - decoding then encoding every value back to itself
+// - every pixel count from 0 to MAX_TAIL, so every vector tail and partial
+//   byte is hit, with output buffers pre-filled to catch stray writes
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "n64graphics.h"
+
+#define MAX_TAIL 300
+#define GUARD 64 // bytes past the output that must stay untouched
+#define FILL 0xA5
+
+// reference conversions: n64graphics before the per-format kernels
+#define SCALE_5_8(VAL_) (((VAL_) * 0xFF) / 0x1F)
+#define SCALE_8_5(VAL_) ((((VAL_) + 4) * 0x1F) / 0xFF)
+#define SCALE_4_8(VAL_) ((VAL_) * 0x11)
+#define SCALE_8_4(VAL_) ((VAL_) / 0x11)
+#define SCALE_3_8(VAL_) ((VAL_) * 0x24)
+#define SCALE_8_3(VAL_) ((VAL_) / 0x24)
+
+static void ref_raw2rgba(rgba *img, const uint8_t *raw, int count, int depth) {
+  if (depth == 16) {
+    for (int i = 0; i < count; i++) {
+      img[i].red = SCALE_5_8((raw[i * 2] & 0xF8) >> 3);
+      img[i].green = SCALE_5_8(((raw[i * 2] & 0x07) << 2) |
+                               ((raw[i * 2 + 1] & 0xC0) >> 6));
+      img[i].blue = SCALE_5_8((raw[i * 2 + 1] & 0x3E) >> 1);
+      img[i].alpha = (raw[i * 2 + 1] & 0x01) ? 0xFF : 0x00;
+    }
+  } else {
+    for (int i = 0; i < count; i++) {
+      img[i].red = raw[i * 4];
+      img[i].green = raw[i * 4 + 1];
+      img[i].blue = raw[i * 4 + 2];
+      img[i].alpha = raw[i * 4 + 3];
+    }
+  }
+}
+
+static void ref_raw2ia(ia *img, const uint8_t *raw, int count, int depth) {
+  for (int i = 0; i < count; i++) {
+    uint8_t bits;
+    switch (depth) {
+    case 16:
+      img[i].intensity = raw[i * 2];
+      img[i].alpha = raw[i * 2 + 1];
+      break;
+    case 8:
+      img[i].intensity = SCALE_4_8((raw[i] & 0xF0) >> 4);
+      img[i].alpha = SCALE_4_8(raw[i] & 0x0F);
+      break;
+    case 4:
+      bits = i % 2 ? raw[i / 2] & 0xF : raw[i / 2] >> 4;
+      img[i].intensity = SCALE_3_8((bits >> 1) & 0x07);
+      img[i].alpha = (bits & 0x01) ? 0xFF : 0x00;
+      break;
+    case 1:
+      bits = (raw[i / 8] & (1 << (7 - (i % 8)))) ? 0xFF : 0x00;
+      img[i].intensity = bits;
+      img[i].alpha = bits;
+      break;
+    }
+  }
+}
+
+static void ref_raw2i(ia *img, const uint8_t *raw, int count, int depth) {
+  for (int i = 0; i < count; i++) {
+    if (depth == 8) {
+      img[i].intensity = raw[i];
+    } else {
+      uint8_t bits = i % 2 ? raw[i / 2] & 0xF : raw[i / 2] >> 4;
+      img[i].intensity = SCALE_4_8(bits);
+    }
+    img[i].alpha = 0xFF;
+  }
+}
+
+static void ref_rgba2raw(uint8_t *raw, const rgba *img, int count, int depth) {
+  for (int i = 0; i < count; i++) {
+    if (depth == 16) {
+      uint8_t r = SCALE_8_5(img[i].red);
+      uint8_t g = SCALE_8_5(img[i].green);
+      uint8_t b = SCALE_8_5(img[i].blue);
+      uint8_t a = img[i].alpha ? 0x1 : 0x0;
+      raw[i * 2] = (r << 3) | (g >> 2);
+      raw[i * 2 + 1] = ((g & 0x3) << 6) | (b << 1) | a;
+    } else {
+      raw[i * 4] = img[i].red;
+      raw[i * 4 + 1] = img[i].green;
+      raw[i * 4 + 2] = img[i].blue;
+      raw[i * 4 + 3] = img[i].alpha;
+    }
+  }
+}
+
+static void ref_ia2raw(uint8_t *raw, const ia *img, int count, int depth) {
+  for (int i = 0; i < count; i++) {
+    uint8_t val, alpha, old, bit;
+    switch (depth) {
+    case 16:
+      raw[i * 2] = img[i].intensity;
+      raw[i * 2 + 1] = img[i].alpha;
+      break;
+    case 8:
+      raw[i] = (SCALE_8_4(img[i].intensity) << 4) | SCALE_8_4(img[i].alpha);
+      break;
+    case 4:
+      val = SCALE_8_3(img[i].intensity);
+      alpha = img[i].alpha ? 0x01 : 0x00;
+      old = raw[i / 2];
+      if (i % 2) {
+        raw[i / 2] = (old & 0xF0) | (val << 1) | alpha;
+      } else {
+        raw[i / 2] = (old & 0x0F) | (((val << 1) | alpha) << 4);
+      }
+      break;
+    case 1:
+      bit = 1 << (7 - (i % 8));
+      raw[i / 8] = img[i].intensity ? raw[i / 8] | bit : raw[i / 8] & ~bit;
+      break;
+    }
+  }
+}
+
+static void ref_i2raw(uint8_t *raw, const ia *img, int count, int depth) {
+  for (int i = 0; i < count; i++) {
+    if (depth == 8) {
+      raw[i] = img[i].intensity;
+    } else {
+      uint8_t val = SCALE_8_4(img[i].intensity);
+      uint8_t old = raw[i / 2];
+      raw[i / 2] = i % 2 ? (old & 0xF0) | val : (old & 0x0F) | (val << 4);
+    }
+  }
+}
+
+enum { KIND_RGBA, KIND_IA, KIND_I };
+
+typedef struct {
+  const char *name;
+  int kind;
+  int depth;
+} format;
+
+static const format formats[] = {
+    {"rgba16", KIND_RGBA, 16}, {"rgba32", KIND_RGBA, 32},
+    {"ia16", KIND_IA, 16},     {"ia8", KIND_IA, 8},
+    {"ia4", KIND_IA, 4},       {"ia1", KIND_IA, 1},
+    {"i8", KIND_I, 8},         {"i4", KIND_I, 4},
+};
+
+static int failures;
+
+static size_t pixel_size(const format *f) {
+  return f->kind == KIND_RGBA ? sizeof(rgba) : sizeof(ia);
+}
+
+static size_t raw_size(const format *f, int count) {
+  return ((size_t)count * f->depth + 7) / 8;
+}
+
+static void decode(const format *f, void *img, const uint8_t *raw, int count) {
+  switch (f->kind) {
+  case KIND_RGBA:
+    raw2rgba_into(img, raw, count, 1, f->depth);
+    break;
+  case KIND_IA:
+    raw2ia_into(img, raw, count, 1, f->depth);
+    break;
+  case KIND_I:
+    raw2i_into(img, raw, count, 1, f->depth);
+    break;
+  }
+}
+
+static void ref_decode(const format *f, void *img, const uint8_t *raw,
+                       int count) {
+  switch (f->kind) {
+  case KIND_RGBA:
+    ref_raw2rgba(img, raw, count, f->depth);
+    break;
+  case KIND_IA:
+    ref_raw2ia(img, raw, count, f->depth);
+    break;
+  case KIND_I:
+    ref_raw2i(img, raw, count, f->depth);
+    break;
+  }
+}
+
+static void encode(const format *f, uint8_t *raw, const void *img, int count) {
+  switch (f->kind) {
+  case KIND_RGBA:
+    rgba2raw(raw, img, count, 1, f->depth);
+    break;
+  case KIND_IA:
+    ia2raw(raw, img, count, 1, f->depth);
+    break;
+  case KIND_I:
+    i2raw(raw, img, count, 1, f->depth);
+    break;
+  }
+}
+
+static void ref_encode(const format *f, uint8_t *raw, const void *img,
+                       int count) {
+  switch (f->kind) {
+  case KIND_RGBA:
+    ref_rgba2raw(raw, img, count, f->depth);
+    break;
+  case KIND_IA:
+    ref_ia2raw(raw, img, count, f->depth);
+    break;
+  case KIND_I:
+    ref_i2raw(raw, img, count, f->depth);
+    break;
+  }
+}
+
+static void compare(const format *f, const char *test, int count,
+                    const uint8_t *expected, const uint8_t *actual,
+                    size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (expected[i] != actual[i]) {
+      printf("FAIL: %s %s, %d pixels: byte %zu is %02X, expected %02X\n",
+             f->name, test, count, i, actual[i], expected[i]);
+      failures++;
+      return;
+    }
+  }
+}
+
+static void *alloc_filled(size_t size) {
+  void *buf = malloc(size + GUARD);
+  if (buf == NULL) {
+    fprintf(stderr, "Error allocating %zu bytes\n", size + GUARD);
+    exit(EXIT_FAILURE);
+  }
+  memset(buf, FILL, size + GUARD);
+  return buf;
+}
+
+// decode raw with both implementations and compare, returns the result
+static void *check_decode(const format *f, const char *test,
+                          const uint8_t *raw, int count) {
+  size_t size = count * pixel_size(f);
+  uint8_t *expected = alloc_filled(size);
+  uint8_t *actual = alloc_filled(size);
+  ref_decode(f, expected, raw, count);
+  decode(f, actual, raw, count);
+  compare(f, test, count, expected, actual, size + GUARD);
+  free(expected);
+  return actual;
+}
+
+// encode img with both implementations over the same starting bytes
+static void check_encode(const format *f, const char *test, const void *img,
+                         int count, const uint8_t *initial) {
+  size_t size = raw_size(f, count);
+  uint8_t *expected = alloc_filled(size);
+  uint8_t *actual = alloc_filled(size);
+  if (initial) {
+    memcpy(expected, initial, size);
+    memcpy(actual, initial, size);
+  }
+  ref_encode(f, expected, img, count);
+  encode(f, actual, img, count);
+  compare(f, test, count, expected, actual, size + GUARD);
+  free(expected);
+  free(actual);
+}
+
+// every 16-bit value for 16/32-bit formats, every byte value otherwise,
+// then encode the pixels back
+static void test_all_values(const format *f) {
+  int bytes = f->depth >= 16 ? 0x20000 : 0x100;
+  int count = bytes * 8 / f->depth;
+  uint8_t *raw = malloc(bytes);
+  uint8_t *back;
+  void *img;
+
+  for (int i = 0; i < bytes; i++) {
+    raw[i] = f->depth >= 16 ? (i % 2 ? i / 2 : i / 2 >> 8) : i;
+  }
+  img = check_decode(f, "decode all values", raw, count);
+  back = alloc_filled(bytes);
+  encode(f, back, img, count);
+  compare(f, "round trip", count, raw, back, bytes);
+  free(back);
+  free(img);
+  free(raw);
+}
+
+// every red/green or intensity/alpha pair, with blue and alpha following
+static void test_all_pairs(const format *f) {
+  int count = 0x10000;
+  void *img = malloc(count * pixel_size(f));
+
+  for (int p = 0; p < count; p++) {
+    if (f->kind == KIND_RGBA) {
+      rgba *px = &((rgba *)img)[p];
+      px->red = p & 0xFF;
+      px->green = p >> 8;
+      px->blue = (p * 7) >> 5;
+      px->alpha = p % 3 ? (p * 13) & 0xFF : 0;
+    } else {
+      ia *px = &((ia *)img)[p];
+      px->intensity = p & 0xFF;
+      px->alpha = p >> 8;
+    }
+  }
+  check_encode(f, "encode all pairs", img, count, NULL);
+  free(img);
+}
+
+// random data at every length, to reach each vector tail and partial byte
+static void test_tails(const format *f) {
+  uint8_t *raw = malloc(raw_size(f, MAX_TAIL) + GUARD);
+  uint8_t *initial = malloc(raw_size(f, MAX_TAIL) + GUARD);
+  uint8_t *img = malloc(MAX_TAIL * pixel_size(f));
+
+  srand(f->depth * 31 + f->kind);
+  for (int count = 0; count <= MAX_TAIL; count++) {
+    for (size_t i = 0; i < raw_size(f, count); i++) {
+      raw[i] = rand();
+      initial[i] = rand();
+    }
+    for (size_t i = 0; i < count * pixel_size(f); i++) {
+      img[i] = rand() % 4 ? rand() : 0;
+    }
+    free(check_decode(f, "decode tail", raw, count));
+    check_encode(f, "encode tail", img, count, initial);
+  }
+  free(img);
+  free(initial);
+  free(raw);
+}
+
+int main(void) {
+  for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+    test_all_values(&formats[i]);
+    test_all_pairs(&formats[i]);
+    test_tails(&formats[i]);
+  }
+  if (failures) {
+    printf("n64graphics kernels: %d failures\n", failures);
+    return 1;
+  }
+  printf("n64graphics kernels: all passed\n");
+  return 0;
+}
@@ -0,0 +1,287 @@
+// strings_fixture: write n64symbols string scan fixtures and the strings
+// each one should produce
+//
+// usage: strings_fixture DIR
+//
+// DIR/ENC-K.bin are 2 MB + 7 byte images for ENC in ascii, sjis and euc-jp,
+// packed with strings, multi-byte characters, invalid sequences and binary
+// data. Image K also places a character or terminator across each 1 MB scan
+// chunk edge at a different alignment, so every chunk hand-off is exercised.
+//
+// DIR/ENC-K.maxM.txt lists "ADDRESS SIZE" of every string n64symbols should
+// find with --max-str M. ASCII images use the per-offset scanner n64symbols
+// had before its runs were found in bulk. The old scanner only knew ASCII, so
+// Shift-JIS and EUC-JP images use a serial scan of the run rules instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_SIZE (0x200000 + 7)
+#define CHUNK_SIZE 0x100000 // SCAN_CHUNK_SIZE in n64symbols.c
+#define BASE_ADDRESS 0x80000000UL
+#define MIN_STRING_LENGTH 4
+#define SHIFTS 3
+#define SLACK 4096 // room for the last segment to run past the image
+
+enum { ENC_ASCII, ENC_SJIS, ENC_EUC_JP, ENC_COUNT };
+
+static const char *const enc_names[ENC_COUNT] = {"ascii", "sjis", "euc-jp"};
+static const unsigned int max_lengths[] = {256, 7};
+
+static unsigned int rng_state;
+
+static unsigned int rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static unsigned int rng_range(unsigned int lo, unsigned int hi) {
+  return lo + rng() % (hi - lo + 1);
+}
+
+static int is_valid_string_char(unsigned char c) {
+  return (c >= 0x20 && c <= 0x7E) || c == '\t' || c == '\n' || c == '\r';
+}
+
+// length of the character at p, or 0 if it does not start a valid one
+static int char_length(const unsigned char *p, long avail, int enc) {
+  unsigned char c = p[0];
+  if (is_valid_string_char(c)) {
+    return 1;
+  }
+  if (enc == ENC_SJIS) {
+    if (c >= 0xA1 && c <= 0xDF) {
+      return 1;
+    }
+    if (((c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC)) && avail >= 2 &&
+        ((p[1] >= 0x40 && p[1] <= 0x7E) || (p[1] >= 0x80 && p[1] <= 0xFC))) {
+      return 2;
+    }
+  } else if (enc == ENC_EUC_JP) {
+    if (c >= 0xA1 && c <= 0xFE && avail >= 2 && p[1] >= 0xA1 && p[1] <= 0xFE) {
+      return 2;
+    }
+    if (c == 0x8E && avail >= 2 && p[1] >= 0xA1 && p[1] <= 0xDF) {
+      return 2;
+    }
+    if (c == 0x8F && avail >= 3 && p[1] >= 0xA1 && p[1] <= 0xFE &&
+        p[2] >= 0xA1 && p[2] <= 0xFE) {
+      return 3;
+    }
+  }
+  return 0;
+}
+
+// append one character, or now and then an invalid sequence, at out
+static int put_char(unsigned char *out, int enc) {
+  unsigned int r = rng() % 100;
+  if (enc == ENC_ASCII || r < 40) {
+    static const char ascii[] = "abcdefghijklmnopqrstuvwxyz ABCXYZ0123.%\t\n\r";
+    out[0] = ascii[rng() % (sizeof(ascii) - 1)];
+    return 1;
+  }
+  if (r >= 96) { // lone lead byte, bad trail byte, or a byte no encoding uses
+    static const unsigned char bad[] = {0x80, 0xA0, 0xFD, 0xFF, 0x8E, 0x8F, 0x81};
+    out[0] = bad[rng() % sizeof(bad)];
+    out[1] = rng() % 2 ? 0x7F : 0x1F;
+    return 2;
+  }
+  if (enc == ENC_SJIS) {
+    if (r < 55) {
+      out[0] = rng_range(0xA1, 0xDF);
+      return 1;
+    }
+    out[0] = rng() % 2 ? rng_range(0x81, 0x9F) : rng_range(0xE0, 0xFC);
+    out[1] = rng() % 2 ? rng_range(0x40, 0x7E) : rng_range(0x80, 0xFC);
+    return 2;
+  }
+  if (r < 55) {
+    out[0] = 0x8E;
+    out[1] = rng_range(0xA1, 0xDF);
+    return 2;
+  }
+  if (r < 70) {
+    out[0] = 0x8F;
+    out[1] = rng_range(0xA1, 0xFE);
+    out[2] = rng_range(0xA1, 0xFE);
+    return 3;
+  }
+  out[0] = rng_range(0xA1, 0xFE);
+  out[1] = rng_range(0xA1, 0xFE);
+  return 2;
+}
+
+// string across edge, with a character whose first byte lands shift bytes
+// before it
+static void put_edge(unsigned char *data, long edge, int shift, int enc) {
+  unsigned char *p = data + edge - 8;
+  memcpy(p, "\0Edge", 5);
+  p += 5;
+  while (p < data + edge - 1 - shift) {
+    *p++ = 'x';
+  }
+  switch (enc) {
+  case ENC_ASCII:
+    *p++ = 'y';
+    break;
+  case ENC_SJIS:
+    *p++ = 0x82;
+    *p++ = 0xA0 + shift;
+    break;
+  case ENC_EUC_JP:
+    *p++ = 0x8F;
+    *p++ = 0xB0;
+    *p++ = 0xC0 + shift;
+    break;
+  }
+  memcpy(p, "tail", 4);
+  p += 4;
+  if (shift == 0) {
+    *p = '\0';
+  } else if (shift == 1) {
+    *p = 0x01;
+  } else {
+    // a byte no encoding uses ends the run without breaking it, so the
+    // string after it still belongs to the chunk before the edge
+    memcpy(p, "\xFFnext", 6);
+  }
+}
+
+static void make_image(unsigned char *data, int enc, int shift) {
+  long pos = 0;
+  rng_state = 0x9E3779B1u * (enc * SHIFTS + shift + 1);
+  memset(data, 0, IMAGE_SIZE + SLACK);
+  while (pos < IMAGE_SIZE) {
+    unsigned int r = rng() % 10;
+    if (r < 6) { // string, usually terminated
+      unsigned int length = rng() % 8 ? rng_range(1, 40) : rng_range(200, 600);
+      for (unsigned int i = 0; i < length && pos < IMAGE_SIZE; i++) {
+        pos += put_char(data + pos, enc);
+      }
+      data[pos++] = rng() % 4 ? '\0' : (unsigned char)rng();
+    } else if (r < 9) { // binary data
+      for (unsigned int n = rng_range(1, 64); n > 0; n--) {
+        data[pos++] = rng() % 3 ? (unsigned char)rng() : 0;
+      }
+    } else { // padding
+      for (unsigned int n = rng_range(1, 32); n > 0; n--) {
+        data[pos++] = 0;
+      }
+    }
+  }
+  for (long edge = CHUNK_SIZE; edge < IMAGE_SIZE; edge += CHUNK_SIZE) {
+    put_edge(data, edge, shift, enc);
+  }
+  // unterminated run cut off by the end of the image, ending on a lead byte
+  data[IMAGE_SIZE - 1] = enc == ENC_ASCII ? 'z' : 0x8F;
+}
+
+static void print_string(FILE *out, long offset, long length) {
+  fprintf(out, "%08lX %08lX\n", BASE_ADDRESS + offset, length + 1);
+}
+
+// n64symbols string scan before runs were found in bulk, ASCII only
+static void old_scan(FILE *out, const unsigned char *data, long size,
+                     unsigned int max_length) {
+  for (long offset = 0; offset < size - MIN_STRING_LENGTH; offset++) {
+    if (!is_valid_string_char(data[offset])) {
+      continue;
+    }
+    int length = 0;
+    while (offset + length < size && length < (int)max_length &&
+           data[offset + length] != 0) {
+      if (!is_valid_string_char(data[offset + length])) {
+        break;
+      }
+      length++;
+    }
+    if (offset + length < size && data[offset + length] == 0 &&
+        length >= MIN_STRING_LENGTH) {
+      print_string(out, offset, length);
+      offset += length;
+    }
+  }
+}
+
+// serial scan of whole runs: a NUL terminated run keeps its last max_length
+// bytes, cut on a character boundary, and scanning resumes after the run
+static void run_scan(FILE *out, const unsigned char *data, long size,
+                     unsigned int max_length, int enc) {
+  long offset = 0;
+  while (offset < size - MIN_STRING_LENGTH) {
+    if (!is_valid_string_char(data[offset]) && data[offset] < 0x80) {
+      offset++;
+      continue;
+    }
+    long start = offset, end = offset;
+    int length;
+    while (end < size && (length = char_length(data + end, size - end, enc))) {
+      end += length;
+    }
+    if (end < size && end > start && data[end] == 0) {
+      while (end - start > (long)max_length) {
+        start += char_length(data + start, end - start, enc);
+      }
+      if (end - start >= MIN_STRING_LENGTH) {
+        print_string(out, start, end - start);
+      }
+    }
+    offset = end + 1;
+  }
+}
+
+static int write_file(const char *path, const void *data, size_t size) {
+  FILE *out = fopen(path, "wb");
+  if (out == NULL) {
+    return -1;
+  }
+  size_t written = fwrite(data, 1, size, out);
+  return fclose(out) == 0 && written == size ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned char *data;
+  char path[1024];
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: strings_fixture DIR\n");
+    return 1;
+  }
+  data = malloc(IMAGE_SIZE + SLACK);
+  if (data == NULL) {
+    fprintf(stderr, "Error allocating %d bytes\n", IMAGE_SIZE + SLACK);
+    return 1;
+  }
+  for (int enc = 0; enc < ENC_COUNT; enc++) {
+    for (int shift = 0; shift < SHIFTS; shift++) {
+      make_image(data, enc, shift);
+      snprintf(path, sizeof(path), "%s/%s-%d.bin", argv[1], enc_names[enc],
+               shift);
+      if (write_file(path, data, IMAGE_SIZE) < 0) {
+        fprintf(stderr, "Error writing \"%s\"\n", path);
+        return 1;
+      }
+      for (size_t m = 0; m < sizeof(max_lengths) / sizeof(*max_lengths); m++) {
+        FILE *out;
+        snprintf(path, sizeof(path), "%s/%s-%d.max%u.txt", argv[1],
+                 enc_names[enc], shift, max_lengths[m]);
+        out = fopen(path, "w");
+        if (out == NULL) {
+          fprintf(stderr, "Error writing \"%s\"\n", path);
+          return 1;
+        }
+        if (enc == ENC_ASCII) {
+          old_scan(out, data, IMAGE_SIZE, max_lengths[m]);
+        } else {
+          run_scan(out, data, IMAGE_SIZE, max_lengths[m], enc);
+        }
+        fclose(out);
+      }
+    }
+  }
+  free(data);
+  return 0;
+}
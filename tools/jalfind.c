@@ -1,5 +1,9 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "romimage.h"
 
 #define JALFIND_VERSION "0.1"
 
@@ -9,43 +13,29 @@
 
 static void print_usage(void) {
   fprintf(stderr,
-          "jalfind <FILE> <ADDRESS> [ADDRESS...]\n"
+          "jalfind [-x] [-o INDEX] [-b BATCH] <FILE> [ADDRESS...]\n"
+          "jalfind -i INDEX [-b BATCH] [ADDRESS...]\n"
           "\n"
           "jalfind v" JALFIND_VERSION
           ": search for MIPS JAL, LUI/ADDIU, and direct references in a file\n"
           "\n"
+          "Optional arguments:\n"
+          " -x         build a cross-reference index of FILE in one pass and\n"
+          "            query it instead of rescanning FILE for every ADDRESS\n"
+          " -o INDEX   save the cross-reference index to INDEX (implies -x)\n"
+          " -i INDEX   query a saved cross-reference index instead of FILE\n"
+          " -b BATCH   read addresses from BATCH, one per line, '-' for stdin\n"
+          "            (implies -x)\n"
+          "\n"
+          "The index holds direct words only for KSEG0/KSEG1 addresses\n"
+          "(0x80000000-0xBFFFFFFF). Other addresses are scanned for in FILE;\n"
+          "with -i their direct words are not reported.\n"
+          "\n"
           "Arguments:\n"
           " FILE       input ROM file\n"
           " ADDRESS    address to find references to (assumes hex)\n");
 }
 
-int read_file(const char *file_name, unsigned char **data) {
-  FILE *in;
-  unsigned char *in_buf = NULL;
-  size_t file_size;
-  size_t bytes_read;
-
-  in = fopen(file_name, "rb");
-  if (in == NULL) {
-    return -1;
-  }
-
-  // determine file size
-  fseek(in, 0, SEEK_END);
-  file_size = ftell(in);
-  fseek(in, 0, SEEK_SET);
-  // allocate buffer and read entire file in
-  in_buf = malloc(file_size);
-  bytes_read = fread(in_buf, 1, file_size, in);
-  if (bytes_read != file_size) {
-    return -2;
-  }
-
-  fclose(in);
-  *data = in_buf;
-  return (int)bytes_read;
-}
-
 #define OPCODE_MASK 0xFC000000
 #define OPCODE_ADDIU 0x24000000
 #define OPCODE_JAL 0x0C000000
@@ -108,27 +98,365 @@ void find_reference(unsigned char *data, int len, unsigned int addr) {
   }
 }
 
+// cross-reference index: every JAL target, LUI/ADDIU and LUI/ORI resolved
+// address, and KSEG0/KSEG1 pointer word in a ROM, built in one linear pass.
+// layout, in host byte order so it can be used in place:
+// xref_header, then xref records sorted by address and offset
+#define XREF_MAGIC "JXR1"
+#define XREF_VERSION 1
+#define PAIR_WINDOW 32 // instructions searched for the %lo of a LUI
+
+enum xref_kind { XREF_DIRECT, XREF_JAL, XREF_ADDIU, XREF_ORI };
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;    // xref records
+  uint32_t rom_size; // size of the indexed ROM
+} xref_header;
+
+typedef struct {
+  uint32_t addr;      // referenced address
+  uint32_t offset;    // ROM offset of the reference (LUI for pairs)
+  uint32_t word;      // instruction or data word at offset
+  uint32_t lo_offset; // ROM offset of ADDIU/ORI for pairs
+  uint32_t lo_word;
+  uint32_t kind; // enum xref_kind
+} xref;
+
+typedef struct {
+  rom_image file; // mapped index, unused when built in memory
+  xref *refs;
+  unsigned int count;
+  unsigned int allocation;
+} xref_index;
+
+static void xref_add(xref_index *index, const xref *ref) {
+  if (index->count >= index->allocation) {
+    index->allocation = index->allocation ? index->allocation * 2 : 4096;
+    index->refs = realloc(index->refs, index->allocation * sizeof(*index->refs));
+  }
+  index->refs[index->count++] = *ref;
+}
+
+static int xref_cmp(const void *a, const void *b) {
+  const xref *xa = a;
+  const xref *xb = b;
+  if (xa->addr != xb->addr) {
+    return xa->addr < xb->addr ? -1 : 1;
+  }
+  if (xa->offset != xb->offset) {
+    return xa->offset < xb->offset ? -1 : 1;
+  }
+  return 0;
+}
+
+static int is_pointer(unsigned int word) {
+  return word >= 0x80000000 && word < 0xC0000000;
+}
+
+// single pass over data: LUIs are remembered per destination register until
+// the first ADDIU/ORI that uses them or PAIR_WINDOW instructions pass
+static void xref_build(xref_index *index, const unsigned char *data, int len) {
+  int lui_offset[32];
+  int i;
+
+  memset(index, 0, sizeof(*index));
+  for (i = 0; i < 32; i++) {
+    lui_offset[i] = -1;
+  }
+  for (i = 0; i + 4 <= len; i += 4) {
+    unsigned int ival = read_u32_be(&data[i]);
+    unsigned int opcode = ival & OPCODE_MASK;
+    xref ref;
+
+    memset(&ref, 0, sizeof(ref));
+    ref.offset = i;
+    ref.word = ival;
+    if (is_pointer(ival)) {
+      ref.addr = ival;
+      ref.kind = XREF_DIRECT;
+      xref_add(index, &ref);
+    } else if (opcode == OPCODE_JAL) {
+      ref.addr = 0x80000000 | ((ival & 0x03FFFFFF) << 2);
+      ref.kind = XREF_JAL;
+      xref_add(index, &ref);
+    } else if (opcode == OPCODE_LUI) {
+      lui_offset[(ival & RT_MASK) >> 16] = i;
+    } else if (opcode == OPCODE_ADDIU || opcode == OPCODE_ORI) {
+      unsigned int rs = (ival & RS_MASK) >> 21;
+      int lui = lui_offset[rs];
+      if (lui >= 0 && i - lui < PAIR_WINDOW * 4) {
+        unsigned int hi = read_u32_be(&data[lui]) << 16;
+        ref.offset = lui;
+        ref.word = read_u32_be(&data[lui]);
+        ref.lo_offset = i;
+        ref.lo_word = ival;
+        if (opcode == OPCODE_ADDIU) {
+          ref.addr = hi + (int16_t)(ival & IMM_MASK);
+          ref.kind = XREF_ADDIU;
+        } else {
+          ref.addr = hi | (ival & IMM_MASK);
+          ref.kind = XREF_ORI;
+        }
+        xref_add(index, &ref);
+        lui_offset[rs] = -1;
+      }
+    }
+  }
+  qsort(index->refs, index->count, sizeof(*index->refs), xref_cmp);
+}
+
+static int xref_save(const xref_index *index, const char *file_name,
+                     int rom_size) {
+  xref_header header;
+  FILE *out;
+  size_t written;
+
+  out = fopen(file_name, "wb");
+  if (out == NULL) {
+    return -1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, XREF_MAGIC, sizeof(header.magic));
+  header.version = XREF_VERSION;
+  header.count = index->count;
+  header.rom_size = rom_size;
+  written = fwrite(&header, sizeof(header), 1, out);
+  written += fwrite(index->refs, sizeof(*index->refs), index->count, out);
+  fclose(out);
+  return written == 1 + index->count ? 0 : -1;
+}
+
+// load a saved index, records are used in place
+static int xref_load(xref_index *index, const char *file_name) {
+  const xref_header *header;
+
+  memset(index, 0, sizeof(*index));
+  if (rom_open(&index->file, file_name) < 0) {
+    return -1;
+  }
+  header = (const xref_header *)rom_range(&index->file, 0, sizeof(*header));
+  if (header == NULL ||
+      memcmp(header->magic, XREF_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != XREF_VERSION ||
+      index->file.size < sizeof(*header) + header->count * sizeof(xref)) {
+    return -2;
+  }
+  index->refs = (xref *)(index->file.data + sizeof(*header));
+  index->count = header->count;
+  return 0;
+}
+
+// first record referencing addr or later
+static unsigned int xref_lower_bound(const xref_index *index,
+                                     unsigned int addr) {
+  unsigned int lo = 0, hi = index->count;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (index->refs[mid].addr < addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void xref_print(const xref *ref, unsigned int addr) {
+  unsigned int lui_rt = (ref->word & RT_MASK) >> 16;
+  unsigned int lo_rs = (ref->lo_word & RS_MASK) >> 21;
+  unsigned int lo_rt = (ref->lo_word & RT_MASK) >> 16;
+  switch (ref->kind) {
+  case XREF_DIRECT:
+    printf("%06X: %08X\n", ref->offset, ref->word);
+    break;
+  case XREF_JAL:
+    printf("%06X: %08X JAL 0x%08X\n", ref->offset, ref->word, addr);
+    break;
+  case XREF_ADDIU:
+  case XREF_ORI:
+    printf("%06X: %08X LUI   %s, 0x%04X     // %%hi(0x%08X)\n"
+           "%06X: %08X %-5s %s, %s, 0x%04X // %%lo(0x%08X)\n",
+           ref->offset, ref->word, regs[lui_rt], ref->word & IMM_MASK, addr,
+           ref->lo_offset, ref->lo_word,
+           ref->kind == XREF_ADDIU ? "ADDIU" : "ORI", regs[lo_rt],
+           regs[lo_rs], ref->lo_word & IMM_MASK, addr);
+    break;
+  }
+}
+
+// JAL records are keyed by their KSEG0 target, so a JAL to addr is found
+// under jal_addr and everything else under addr itself. both runs are
+// sorted by offset, merge them to print in ROM order like find_reference()
+// direct words are only indexed for KSEG0/KSEG1, other addresses are
+// scanned for in data when the ROM is loaded
+static void xref_query(const xref_index *index, unsigned char *data, int len,
+                       unsigned int addr) {
+  unsigned int jal = OPCODE_JAL | ((0x0FFFFFFF & addr) >> 2);
+  unsigned int jal_addr = 0x80000000 | (addr & 0x0FFFFFFC);
+  unsigned int a, b;
+
+  if (!is_pointer(addr) && data != NULL) {
+    find_reference(data, len, addr);
+    return;
+  }
+  printf("--> Looking for %08X/%08X\n", addr, jal);
+  if (!is_pointer(addr)) {
+    fprintf(stderr, "Direct references to %08X are not in the index\n", addr);
+  }
+  a = xref_lower_bound(index, addr);
+  b = jal_addr == addr ? index->count : xref_lower_bound(index, jal_addr);
+  for (;;) {
+    const xref *ra, *rb;
+    while (b < index->count && index->refs[b].addr == jal_addr &&
+           index->refs[b].kind != XREF_JAL) {
+      b++;
+    }
+    ra = a < index->count && index->refs[a].addr == addr ? &index->refs[a]
+                                                          : NULL;
+    rb = b < index->count && index->refs[b].addr == jal_addr ? &index->refs[b]
+                                                              : NULL;
+    if (ra == NULL && rb == NULL) {
+      break;
+    }
+    if (rb == NULL || (ra != NULL && ra->offset < rb->offset)) {
+      xref_print(ra, addr);
+      a++;
+    } else {
+      xref_print(rb, addr);
+      b++;
+    }
+  }
+}
+
+// query every address in batch file, one hex address per line
+static int query_batch(const xref_index *index, unsigned char *data, int len,
+                       const char *file_name) {
+  char line[256];
+  FILE *in;
+
+  in = strcmp(file_name, "-") == 0 ? stdin : fopen(file_name, "r");
+  if (in == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), in)) {
+    char *start = line + strspn(line, " \t");
+    char *end;
+    unsigned int addr;
+    start[strcspn(start, "\r\n")] = '\0';
+    if (*start == '#' || *start == '\0') {
+      continue;
+    }
+    addr = strtoul(start, &end, 16);
+    if (end == start) {
+      fprintf(stderr, "Skipping invalid address \"%s\"\n", start);
+      continue;
+    }
+    xref_query(index, data, len, addr);
+  }
+  if (in != stdin) {
+    fclose(in);
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
-  unsigned char *data;
-  char *fname;
+  xref_index index;
+  rom_image rom;
+  unsigned char *data = NULL;
+  char *fname = NULL;
+  char *index_in = NULL;
+  char *index_out = NULL;
+  char *batch = NULL;
+  int use_index = 0;
+  int first_addr = argc;
   unsigned int addr;
-  int len;
+  int len = 0;
   int i;
 
-  if (argc < 3) {
+  for (i = 1; i < argc && first_addr == argc; i++) {
+    if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0') {
+      switch (argv[i][1]) {
+      case 'x':
+        use_index = 1;
+        break;
+      case 'o':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        index_out = argv[i];
+        use_index = 1;
+        break;
+      case 'i':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        index_in = argv[i];
+        use_index = 1;
+        break;
+      case 'b':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        batch = argv[i];
+        use_index = 1;
+        break;
+      default:
+        print_usage();
+        return 1;
+      }
+    } else if (fname == NULL && index_in == NULL) {
+      fname = argv[i];
+    } else {
+      first_addr = i;
+    }
+  }
+
+  if ((fname == NULL && index_in == NULL) ||
+      (first_addr == argc && batch == NULL && index_out == NULL)) {
     print_usage();
     return 1;
   }
 
-  fname = argv[1];
-  len = read_file(fname, &data);
-  if (len > 0) {
-    for (i = 2; i < argc; i++) {
-      addr = strtoul(argv[i], NULL, 16);
-      find_reference(data, len, addr);
+  if (index_in) {
+    int ret = xref_load(&index, index_in);
+    if (ret < 0) {
+      fprintf(stderr, "Error %s index \"%s\"\n",
+              ret == -1 ? "opening/reading" : "validating", index_in);
+      return 1;
     }
   } else {
-    fprintf(stderr, "Error opening/reading \"%s\"\n", fname);
+    if (rom_open(&rom, fname) < 0) {
+      fprintf(stderr, "Error opening/reading \"%s\"\n", fname);
+      return 1;
+    }
+    // v64/n64 dumps are searched in big-endian order
+    data = rom_range(&rom, 0, rom.size);
+    len = rom.size;
+    if (use_index) {
+      xref_build(&index, data, len);
+    }
+  }
+
+  if (index_out && xref_save(&index, index_out, len) < 0) {
+    fprintf(stderr, "Error writing index \"%s\"\n", index_out);
+    return 1;
+  }
+
+  for (i = first_addr; i < argc; i++) {
+    addr = strtoul(argv[i], NULL, 16);
+    if (use_index) {
+      xref_query(&index, data, len, addr);
+    } else {
+      find_reference(data, len, addr);
+    }
+  }
+  if (batch && query_batch(&index, data, len, batch) < 0) {
+    fprintf(stderr, "Error opening/reading \"%s\"\n", batch);
     return 1;
   }
 
@@ -1,10 +1,14 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <capstone/capstone.h>
 
+#include "../utils/config.h"
+#include "../utils/parallel.h"
+#include "../utils/romimage.h"
 #include "../utils/utils.h"
 
 typedef struct {
@@ -1791,7 +1795,21 @@ static void add_offset(instruction *ins, uint32_t offset) {
   ins->count++;
 }
 
-static void fill_table(instruction *ins_table, unsigned char *data, long size) {
+// opcode id of every word in the new ROM, for O(1) candidate checks
+#define OPCODE_NONE 0xFFFF // word outside the disassembled sections
+
+typedef struct {
+  uint16_t *ids;
+  unsigned int count;
+} opcode_map;
+
+static unsigned int opcode_at(const opcode_map *map, unsigned int offset) {
+  unsigned int idx = offset / 4;
+  return idx < map->count ? map->ids[idx] : OPCODE_NONE;
+}
+
+static void fill_table(instruction *ins_table, opcode_map *map,
+                       unsigned char *data, long size) {
 #define BLOCK_SIZE 0x1000
   csh handle;
   cs_insn *insn;
@@ -1807,6 +1825,14 @@ static void fill_table(instruction *ins_table, unsigned char *data, long size) {
   }
   cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
 
+  assert(MIPS_INS_ENDING < OPCODE_NONE);
+  map->count = size / 4;
+  map->ids = malloc(map->count * sizeof(*map->ids));
+  assert(map->ids);
+  for (i = 0; i < (int)map->count; i++) {
+    map->ids[i] = OPCODE_NONE;
+  }
+
   for (s = 0; s < DIM(sections); s++) {
     int length = sections[s].end - sections[s].start;
     int blocks = (length + (BLOCK_SIZE - 1)) / BLOCK_SIZE;
@@ -1820,6 +1846,7 @@ static void fill_table(instruction *ins_table, unsigned char *data, long size) {
       for (i = 0; i < icount; i++) {
         unsigned int op = (unsigned int)insn[i].id;
         add_offset(&ins_table[op], start + i * 4);
+        map->ids[(start + i * 4) / 4] = op;
       }
       cs_free(insn, icount);
     }
@@ -1827,16 +1854,6 @@ static void fill_table(instruction *ins_table, unsigned char *data, long size) {
   cs_close(&handle);
 }
 
-static int in_list(unsigned int offset, instruction *insn) {
-  unsigned i;
-  for (i = 0; i < insn->count; i++) {
-    if (insn->offsets[i] == offset) {
-      return 1;
-    }
-  }
-  return 0;
-}
-
 static unsigned int rom_to_ram(unsigned int rom) {
   const unsigned int mapping[] = {
       // SM64 (J)
@@ -1860,83 +1877,771 @@ static unsigned int rom_to_ram(unsigned int rom) {
   return 0x0;
 }
 
-static void find_matches(instruction *ins_table, unsigned char *srcdata) {
-  csh handle;
+// opcode ids of one source procedure
+typedef struct {
+  uint16_t *ids;
+  unsigned int count;
+} proc_ids;
+
+// decoded source procedures, cached so re-runs skip capstone entirely.
+// layout: decode_header, then per procedure a uint32_t count and its ids
+#define DECODE_MAGIC "MSPC"
+#define DECODE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t key; // hash of proc_table ranges and source bytes
+  uint32_t proc_count;
+  uint32_t reserved;
+} decode_header;
+
+typedef struct {
+  const unsigned char *srcdata;
+  proc_ids *procs;
+  csh *handles; // one per worker
+} decode_job;
+
+// match results of one procedure, merged in proc_table order
+typedef struct {
+  uint32_t *exact; // offsets of complete matches, in candidate order
+  unsigned int exact_count;
+  unsigned int best_matched;
+  uint32_t best_offset;
+} proc_result;
+
+typedef struct {
+  const instruction *ins_table;
+  const opcode_map *map;
+  const proc_ids *procs;
+  proc_result *results;
+} match_job;
+
+static uint64_t decode_key(const unsigned char *srcdata) {
+  uint64_t hash = FNV1A_64_INIT;
+  unsigned int params[3];
+  unsigned j;
+  params[0] = DECODE_VERSION;
+  params[1] = cs_version(NULL, NULL);
+  params[2] = DIM(proc_table);
+  hash = fnv1a_64(params, sizeof(params), hash);
+  for (j = 0; j < DIM(proc_table); j++) {
+    const procedure *p = &proc_table[j];
+    params[0] = p->rom_start;
+    params[1] = p->rom_end;
+    hash = fnv1a_64(params, 2 * sizeof(params[0]), hash);
+    hash = fnv1a_64(&srcdata[p->rom_start], p->rom_end - p->rom_start, hash);
+  }
+  return hash;
+}
+
+// load cached procedure ids, returns 1 on success, 0 if missing or stale
+static int decode_load(proc_ids *procs, const char *filename, uint64_t key) {
+  unsigned char *data;
+  const decode_header *header;
+  long size, offset;
+  unsigned j;
+
+  if (filesize(filename) < (long)sizeof(*header)) {
+    return 0;
+  }
+  size = read_file(filename, &data);
+  if (size < (long)sizeof(*header)) {
+    return 0;
+  }
+  header = (const decode_header *)data;
+  if (memcmp(header->magic, DECODE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != DECODE_VERSION || header->key != key ||
+      header->proc_count != DIM(proc_table)) {
+    INFO("Ignoring stale decode cache \"%s\"\n", filename);
+    free(data);
+    return 0;
+  }
+  offset = sizeof(*header);
+  for (j = 0; j < DIM(proc_table); j++) {
+    uint32_t count;
+    if (offset + (long)sizeof(count) > size) {
+      break;
+    }
+    memcpy(&count, &data[offset], sizeof(count));
+    offset += sizeof(count);
+    if (offset + (long)(count * sizeof(*procs[j].ids)) > size) {
+      break;
+    }
+    procs[j].count = count;
+    procs[j].ids = malloc(count * sizeof(*procs[j].ids) + 1);
+    memcpy(procs[j].ids, &data[offset], count * sizeof(*procs[j].ids));
+    offset += count * sizeof(*procs[j].ids);
+  }
+  free(data);
+  if (j < DIM(proc_table)) {
+    WARNING("Truncated decode cache \"%s\"\n", filename);
+    while (j-- > 0) {
+      free(procs[j].ids);
+      procs[j].ids = NULL;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+static void decode_save(const proc_ids *procs, const char *filename,
+                        uint64_t key) {
+  decode_header header;
+  FILE *out;
+  unsigned j;
+
+  out = fopen(filename, "wb");
+  if (out == NULL) {
+    WARNING("Error opening decode cache \"%s\"\n", filename);
+    return;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DECODE_MAGIC, sizeof(header.magic));
+  header.version = DECODE_VERSION;
+  header.key = key;
+  header.proc_count = DIM(proc_table);
+  fwrite(&header, sizeof(header), 1, out);
+  for (j = 0; j < DIM(proc_table); j++) {
+    uint32_t count = procs[j].count;
+    fwrite(&count, sizeof(count), 1, out);
+    fwrite(procs[j].ids, sizeof(*procs[j].ids), count, out);
+  }
+  fclose(out);
+}
+
+static void decode_proc(int index, int worker, void *arg) {
+  decode_job *job = arg;
+  const procedure *p = &proc_table[index];
+  proc_ids *proc = &job->procs[index];
   cs_insn *insn;
-  unsigned int op;
-  unsigned j, o;
-  int i;
   int count;
-  unsigned best_matched;
-  uint32_t best_offset;
+  int i;
 
-  // open capstone disassembler
-  if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN, &handle) !=
-      CS_ERR_OK) {
-    ERROR("Error initializing disassembler\n");
-    exit(EXIT_FAILURE);
+  count = cs_disasm(job->handles[worker], &job->srcdata[p->rom_start],
+                    p->rom_end - p->rom_start, 0x80000000, 0, &insn);
+  proc->count = MAX(count, 0);
+  proc->ids = malloc(proc->count * sizeof(*proc->ids) + 1);
+  for (i = 0; i < count; i++) {
+    proc->ids[i] = (uint16_t)insn[i].id;
   }
-  cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+  cs_free(insn, count);
+}
+
+// decode every source procedure into opcode ids, one capstone handle per
+// worker, reusing cache_file when its key matches
+static void decode_procs(proc_ids *procs, const unsigned char *srcdata,
+                         const char *cache_file, int thread_count) {
+  decode_job job;
+  uint64_t key = 0;
+  int i;
+
+  if (cache_file) {
+    key = decode_key(srcdata);
+    if (decode_load(procs, cache_file, key)) {
+      INFO("Loaded decoded procedures from \"%s\"\n", cache_file);
+      return;
+    }
+  }
+
+  job.srcdata = srcdata;
+  job.procs = procs;
+  job.handles = malloc(thread_count * sizeof(*job.handles));
+  for (i = 0; i < thread_count; i++) {
+    if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN,
+                &job.handles[i]) != CS_ERR_OK) {
+      ERROR("Error initializing disassembler\n");
+      exit(EXIT_FAILURE);
+    }
+    cs_option(job.handles[i], CS_OPT_SKIPDATA, CS_OPT_ON);
+  }
+  parallel_for(DIM(proc_table), thread_count, decode_proc, &job);
+  for (i = 0; i < thread_count; i++) {
+    cs_close(&job.handles[i]);
+  }
+  free(job.handles);
+
+  if (cache_file) {
+    decode_save(procs, cache_file, key);
+  }
+}
+
+static void match_proc(int index, int worker, void *arg) {
+  match_job *job = arg;
+  const proc_ids *proc = &job->procs[index];
+  proc_result *result = &job->results[index];
+  const instruction *candidates;
+  unsigned int exact_alloc = 0;
+  unsigned o, i;
+
+  (void)worker;
+  memset(result, 0, sizeof(*result));
+  if (proc->count == 0) {
+    return;
+  }
+  candidates = &job->ins_table[proc->ids[0]];
+  for (o = 0; o < candidates->count; o++) {
+    unsigned newoffset = candidates->offsets[o];
+    unsigned matched = 0;
+    for (i = 0; i < proc->count; i++) {
+      if (opcode_at(job->map, newoffset + i * 4) != proc->ids[i]) {
+        matched = i * 4;
+        break;
+      }
+    }
+    if (matched == 0) {
+      if (result->exact_count >= exact_alloc) {
+        exact_alloc = exact_alloc ? exact_alloc * 2 : 4;
+        result->exact =
+            realloc(result->exact, exact_alloc * sizeof(*result->exact));
+      }
+      result->exact[result->exact_count++] = newoffset;
+    } else if (matched > result->best_matched) {
+      result->best_matched = matched;
+      result->best_offset = newoffset;
+    }
+  }
+}
+
+// match every source procedure against the new ROM on thread_count workers,
+// then print results in proc_table order. partial matches are reported when
+// more than threshold percent of the procedure matches
+static void find_matches(instruction *ins_table, const opcode_map *map,
+                         unsigned char *srcdata, const char *cache_file,
+                         int thread_count, int threshold) {
+  proc_ids *procs;
+  proc_result *results;
+  match_job job;
+  unsigned j, o;
+
+  procs = calloc(DIM(proc_table), sizeof(*procs));
+  results = calloc(DIM(proc_table), sizeof(*results));
+  decode_procs(procs, srcdata, cache_file, thread_count);
+
+  job.ins_table = ins_table;
+  job.map = map;
+  job.procs = procs;
+  job.results = results;
+  parallel_for(DIM(proc_table), thread_count, match_proc, &job);
 
   for (j = 0; j < DIM(proc_table); j++) {
     const procedure *p = &proc_table[j];
-    ERROR("%2.1f%%: Looking for %s\n",
-          (float)j * 100.0f / (float)DIM(proc_table), p->name);
+    const proc_result *result = &results[j];
     unsigned int p_length = p->rom_end - p->rom_start;
-    count = cs_disasm(handle, &srcdata[p->rom_start], p_length, 0x80000000, 0,
-                      &insn);
-    op = (unsigned int)insn[0].id;
-    best_offset = 0x0;
-    best_matched = 0;
-    for (o = 0; o < ins_table[op].count; o++) {
-      unsigned newoffset = ins_table[op].offsets[o];
-      unsigned matched = 0;
-      for (i = 0; i < count; i++) {
-        if (!in_list(newoffset + i * 4, &ins_table[insn[i].id])) {
-          matched = i * 4;
+    DEBUG("%2.1f%%: Looking for %s\n",
+          (float)j * 100.0f / (float)DIM(proc_table), p->name);
+    for (o = 0; o < result->exact_count; o++) {
+      printf("   (0x%X, \"%s\"),\n", rom_to_ram(result->exact[o]), p->name);
+    }
+    if (result->best_offset != 0x0) {
+      if (result->best_matched * 100 > p_length * threshold) {
+        printf("   (0x%X, \"%s\"), // best: %d/%d\n",
+               rom_to_ram(result->best_offset), p->name, result->best_matched,
+               p_length);
+      }
+    }
+    free(result->exact);
+    free(procs[j].ids);
+  }
+  free(results);
+  free(procs);
+}
+
+// signature database: masked instruction words of every labelled procedure
+// in a source ROM. layout, in host byte order so it can be used in place:
+// sigdb_header, entries sorted by prefix hash, masked words, label names
+#define SIGDB_MAGIC "MSIG"
+#define SIGDB_VERSION 1
+#define SIG_WINDOW 8 // words hashed to find candidates, also minimum length
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t word_count;
+  uint32_t strings_size;
+  uint32_t window;
+} sigdb_header;
+
+typedef struct {
+  uint64_t prefix_hash; // rolling hash of first SIG_WINDOW masked words
+  uint32_t word_offset; // index of first masked word
+  uint32_t word_count;
+  uint32_t name_offset; // string table offset of label name
+  uint32_t ram_addr;    // address in the source ROM
+} sigdb_entry;
+
+typedef struct {
+  unsigned char *data; // backing buffer holding the whole database
+  long size;
+  const sigdb_header *header;
+  const sigdb_entry *entries;
+  const uint32_t *words;
+  const char *strings;
+} sigdb;
+
+#define ROLL_BASE 0x100000001B3ULL
+
+// wildcard the parts of an instruction that change when code moves: jump
+// targets, LUI/ORI immediates, and ADDIU/load/store offsets not off of $sp
+static uint32_t mask_word(uint32_t word) {
+  unsigned int opcode = word >> 26;
+  unsigned int rs = (word >> 21) & 0x1F;
+  switch (opcode) {
+  case 0x02: // J
+  case 0x03: // JAL
+    return word & 0xFC000000;
+  case 0x0D: // ORI
+  case 0x0F: // LUI
+    return word & 0xFFFF0000;
+  case 0x09: // ADDIU
+    return rs == 29 ? word : word & 0xFFFF0000;
+  default:
+    // loads and stores, including COP1
+    if (opcode >= 0x20 && rs != 29) {
+      return word & 0xFFFF0000;
+    }
+    return word;
+  }
+}
+
+static uint64_t window_hash(const uint32_t *words) {
+  uint64_t hash = 0;
+  for (int i = 0; i < SIG_WINDOW; i++) {
+    hash = hash * ROLL_BASE + words[i];
+  }
+  return hash;
+}
+
+// masked big-endian words of ROM [start, end)
+static uint32_t *mask_range(const unsigned char *data, unsigned int start,
+                            unsigned int end) {
+  unsigned int count = (end - start) / 4;
+  uint32_t *words = malloc(MAX(count, 1) * sizeof(*words));
+  for (unsigned int i = 0; i < count; i++) {
+    words[i] = mask_word(read_u32_be(&data[start + 4 * i]));
+  }
+  return words;
+}
+
+static int label_ram_cmp(const void *a, const void *b) {
+  const label *la = a;
+  const label *lb = b;
+  if (la->ram_addr != lb->ram_addr) {
+    return la->ram_addr < lb->ram_addr ? -1 : 1;
+  }
+  return 0;
+}
+
+static int entry_hash_cmp(const void *a, const void *b) {
+  const sigdb_entry *ea = a;
+  const sigdb_entry *eb = b;
+  if (ea->prefix_hash != eb->prefix_hash) {
+    return ea->prefix_hash < eb->prefix_hash ? -1 : 1;
+  }
+  return ea->ram_addr < eb->ram_addr ? -1 : ea->ram_addr > eb->ram_addr;
+}
+
+// point sigdb fields into its buffer, returns 0 if the buffer is valid
+static int sigdb_map(sigdb *db) {
+  const sigdb_header *h = (const sigdb_header *)db->data;
+  size_t size;
+  if (db->size < (long)sizeof(*h) ||
+      memcmp(h->magic, SIGDB_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != SIGDB_VERSION || h->window != SIG_WINDOW) {
+    return -1;
+  }
+  size = sizeof(*h) + h->entry_count * sizeof(sigdb_entry) +
+         h->word_count * sizeof(uint32_t) + h->strings_size;
+  if (size != (size_t)db->size) {
+    return -1;
+  }
+  db->header = h;
+  db->entries = (const sigdb_entry *)(db->data + sizeof(*h));
+  db->words = (const uint32_t *)(db->entries + h->entry_count);
+  db->strings = (const char *)(db->words + h->word_count);
+  return 0;
+}
+
+// grow *array to hold at least needed elements, doubling the allocation
+static void grow_array(void **array, size_t *alloc, size_t needed,
+                       size_t elem_size) {
+  size_t new_alloc = *alloc;
+  void *grown;
+  if (needed <= *alloc) {
+    return;
+  }
+  while (new_alloc < needed) {
+    new_alloc = new_alloc ? 2 * new_alloc : 256;
+  }
+  grown = realloc(*array, new_alloc * elem_size);
+  if (grown == NULL) {
+    ERROR("Error allocating %zu bytes\n", new_alloc * elem_size);
+    exit(EXIT_FAILURE);
+  }
+  *array = grown;
+  *alloc = new_alloc;
+}
+
+// build signatures from every label inside the asm sections of a config
+static void sigdb_extract(sigdb *db, const rom_config *config,
+                          const unsigned char *data, long size) {
+  sigdb_entry *entries = NULL;
+  uint32_t *words = NULL;
+  char *strings = NULL;
+  size_t entry_count = 0, word_count = 0, strings_size = 0;
+  size_t entry_alloc = 0, word_alloc = 0, strings_alloc = 0;
+  label *labels;
+
+  // procedures run from each label to the next one
+  labels = malloc(MAX(config->label_count, 1) * sizeof(*labels));
+  memcpy(labels, config->labels, config->label_count * sizeof(*labels));
+  qsort(labels, config->label_count, sizeof(*labels), label_ram_cmp);
+
+  for (int s = 0; s < config->section_count; s++) {
+    const split_section *sec = &config->sections[s];
+    unsigned int sec_end;
+    if (sec->type != TYPE_ASM || sec->end > (unsigned int)size) {
+      continue;
+    }
+    sec_end = sec->vaddr + (sec->end - sec->start);
+    for (int l = 0; l < config->label_count; l++) {
+      unsigned int ram = labels[l].ram_addr;
+      unsigned int ram_end = sec_end;
+      unsigned int count;
+      uint32_t *masked;
+      if (ram < sec->vaddr || ram >= sec_end || (ram & 3) ||
+          (l > 0 && labels[l - 1].ram_addr == ram)) {
+        continue;
+      }
+      if (l + 1 < config->label_count) {
+        ram_end = MIN(ram_end, labels[l + 1].ram_addr);
+      }
+      masked = mask_range(data, sec->start + (ram - sec->vaddr),
+                          sec->start + (ram_end - sec->vaddr));
+      // trim anything after the last return and its delay slot
+      count = (ram_end - ram) / 4;
+      for (unsigned int i = count; i >= 2; i--) {
+        if (masked[i - 2] == 0x03E00008) { // jr $ra
+          count = i;
           break;
         }
       }
-      if (matched == 0) {
-        printf("   (0x%X, \"%s\"),\n", rom_to_ram(newoffset), p->name);
-        matched = count * 4;
-      } else {
-        if (matched > best_matched) {
-          best_matched = matched;
-          best_offset = newoffset;
-        }
+      if (count >= SIG_WINDOW) {
+        size_t name_len = strlen(labels[l].name) + 1;
+        grow_array((void **)&entries, &entry_alloc, entry_count + 1,
+                   sizeof(*entries));
+        grow_array((void **)&words, &word_alloc, word_count + count,
+                   sizeof(*words));
+        grow_array((void **)&strings, &strings_alloc, strings_size + name_len,
+                   1);
+        entries[entry_count].prefix_hash = window_hash(masked);
+        entries[entry_count].word_offset = word_count;
+        entries[entry_count].word_count = count;
+        entries[entry_count].name_offset = strings_size;
+        entries[entry_count].ram_addr = ram;
+        memcpy(&words[word_count], masked, count * sizeof(*words));
+        memcpy(&strings[strings_size], labels[l].name, name_len);
+        entry_count++;
+        word_count += count;
+        strings_size += name_len;
       }
+      free(masked);
+    }
+  }
+  free(labels);
+  qsort(entries, entry_count, sizeof(*entries), entry_hash_cmp);
+
+  // flatten in to a single buffer
+  sigdb_header header = {0};
+  memcpy(header.magic, SIGDB_MAGIC, sizeof(header.magic));
+  header.version = SIGDB_VERSION;
+  header.entry_count = entry_count;
+  header.word_count = word_count;
+  header.strings_size = strings_size;
+  header.window = SIG_WINDOW;
+  db->size = sizeof(header) + entry_count * sizeof(*entries) +
+             word_count * sizeof(*words) + strings_size;
+  db->data = malloc(db->size);
+  unsigned char *dst = db->data;
+  memcpy(dst, &header, sizeof(header));
+  dst += sizeof(header);
+  memcpy(dst, entries, entry_count * sizeof(*entries));
+  dst += entry_count * sizeof(*entries);
+  memcpy(dst, words, word_count * sizeof(*words));
+  dst += word_count * sizeof(*words);
+  memcpy(dst, strings, strings_size);
+  free(entries);
+  free(words);
+  free(strings);
+  sigdb_map(db);
+  INFO("Extracted %u signatures (%u words)\n", db->header->entry_count,
+       db->header->word_count);
+}
+
+typedef struct {
+  unsigned int entry;
+  unsigned int vaddr;
+} sig_match;
+
+static int match_vaddr_cmp(const void *a, const void *b) {
+  const sig_match *ma = a;
+  const sig_match *mb = b;
+  if (ma->vaddr != mb->vaddr) {
+    return ma->vaddr < mb->vaddr ? -1 : 1;
+  }
+  return ma->entry < mb->entry ? -1 : ma->entry > mb->entry;
+}
+
+// find all signatures in the asm sections of a target ROM in one pass each
+// and print the unambiguous ones as config labels
+static void sigdb_match(const sigdb *db, const rom_config *config,
+                        const unsigned char *data, long size) {
+  const sigdb_header *h = db->header;
+  sig_match *matches = NULL;
+  size_t match_count = 0, match_alloc = 0;
+  unsigned int *hits = calloc(MAX(h->entry_count, 1), sizeof(*hits));
+  uint64_t base_pow = 1;
+
+  // ROLL_BASE^(SIG_WINDOW-1), to remove the oldest word from the hash
+  for (int i = 1; i < SIG_WINDOW; i++) {
+    base_pow *= ROLL_BASE;
+  }
+
+  for (int s = 0; s < config->section_count; s++) {
+    const split_section *sec = &config->sections[s];
+    unsigned int count;
+    uint32_t *masked;
+    uint64_t hash;
+    if (sec->type != TYPE_ASM || sec->end > (unsigned int)size) {
+      continue;
     }
-    if (best_offset != 0x0) {
-      if (best_matched > (p_length * 3) / 4) {
-        printf("   (0x%X, \"%s\"), // best: %d/%d\n", rom_to_ram(best_offset),
-               p->name, best_matched, p_length);
+    count = (sec->end - sec->start) / 4;
+    if (count < SIG_WINDOW) {
+      continue;
+    }
+    masked = mask_range(data, sec->start, sec->end);
+    hash = window_hash(masked);
+    for (unsigned int i = 0; i + SIG_WINDOW <= count; i++) {
+      if (i > 0) {
+        hash = (hash - masked[i - 1] * base_pow) * ROLL_BASE +
+               masked[i + SIG_WINDOW - 1];
+      }
+      // binary search first entry with this prefix hash
+      unsigned int lo = 0, hi = h->entry_count;
+      while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (db->entries[mid].prefix_hash < hash) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      for (; lo < h->entry_count && db->entries[lo].prefix_hash == hash;
+           lo++) {
+        const sigdb_entry *e = &db->entries[lo];
+        if (i + e->word_count > count ||
+            memcmp(&masked[i], &db->words[e->word_offset],
+                   e->word_count * sizeof(*masked)) != 0) {
+          continue;
+        }
+        grow_array((void **)&matches, &match_alloc, match_count + 1,
+                   sizeof(*matches));
+        matches[match_count].entry = lo;
+        matches[match_count].vaddr = sec->vaddr + 4 * i;
+        match_count++;
+        hits[lo]++;
       }
     }
-    cs_free(insn, count);
+    free(masked);
   }
-  cs_close(&handle);
+
+  // keep signatures found exactly once at an address no other one matched
+  qsort(matches, match_count, sizeof(*matches), match_vaddr_cmp);
+  unsigned int ported = 0, ambiguous = 0;
+  printf("labels:\n");
+  for (size_t m = 0; m < match_count; m++) {
+    const sigdb_entry *e = &db->entries[matches[m].entry];
+    int shared = (m > 0 && matches[m - 1].vaddr == matches[m].vaddr) ||
+                 (m + 1 < match_count &&
+                  matches[m + 1].vaddr == matches[m].vaddr);
+    if (hits[matches[m].entry] == 1 && !shared) {
+      printf("   - [0x%08X, \"%s\"]\n", matches[m].vaddr,
+             &db->strings[e->name_offset]);
+      ported++;
+    } else {
+      ambiguous++;
+    }
+  }
+  printf("# ported %u of %u signatures, skipped %u ambiguous candidates\n",
+         ported, h->entry_count, ambiguous);
+  free(hits);
+  free(matches);
+}
+
+static void sigdb_save(const sigdb *db, const char *filename) {
+  if (write_file(filename, db->data, db->size) != db->size) {
+    ERROR("Error writing signature database '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void sigdb_load(sigdb *db, const char *filename) {
+  db->size = read_file(filename, &db->data);
+  if (db->size <= 0 || sigdb_map(db) != 0) {
+    ERROR("Error: '%s' is not a version %d signature database\n", filename,
+          SIGDB_VERSION);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// map a ROM, returns its contents in big-endian order
+static unsigned char *read_rom(const char *filename, rom_image *rom) {
+  if (rom_open(rom, filename) < 0) {
+    ERROR("Error reading ROM '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  return rom_range(rom, 0, rom->size);
+}
+
+static void read_config(const char *filename, rom_config *config) {
+  if (config_parse_file(filename, config) != 0) {
+    ERROR("Error reading config file '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void print_usage(void) {
+  ERROR("usage: matchsigs [-j THREADS] [-t PERCENT] [-c CACHE] SOURCE NEW\n"
+        "       matchsigs extract CONFIG ROM SIGDB\n"
+        "       matchsigs match SIGDB CONFIG ROM\n"
+        "       matchsigs port SRC_CONFIG SRC_ROM DST_CONFIG DST_ROM\n"
+        "\n"
+        "Options:\n"
+        " -j THREADS  number of matching threads (default: CPU count)\n"
+        " -t PERCENT  report partial matches above PERCENT (default: 75)\n"
+        " -c CACHE    cache decoded source procedures in file CACHE\n"
+        " -v          verbose progress output\n");
+}
+
+// signature database commands, returns exit code
+static int sigdb_command(int argc, char *argv[]) {
+  rom_config src_config, dst_config;
+  rom_image src_rom, dst_rom;
+  unsigned char *src_data, *dst_data;
+  sigdb db;
+
+  if (strcmp(argv[1], "extract") == 0 && argc == 5) {
+    read_config(argv[2], &src_config);
+    src_data = read_rom(argv[3], &src_rom);
+    sigdb_extract(&db, &src_config, src_data, src_rom.size);
+    sigdb_save(&db, argv[4]);
+    rom_close(&src_rom);
+    config_free(&src_config);
+  } else if (strcmp(argv[1], "match") == 0 && argc == 5) {
+    sigdb_load(&db, argv[2]);
+    read_config(argv[3], &dst_config);
+    dst_data = read_rom(argv[4], &dst_rom);
+    sigdb_match(&db, &dst_config, dst_data, dst_rom.size);
+    rom_close(&dst_rom);
+    config_free(&dst_config);
+  } else if (strcmp(argv[1], "port") == 0 && argc == 6) {
+    read_config(argv[2], &src_config);
+    src_data = read_rom(argv[3], &src_rom);
+    read_config(argv[4], &dst_config);
+    dst_data = read_rom(argv[5], &dst_rom);
+    sigdb_extract(&db, &src_config, src_data, src_rom.size);
+    sigdb_match(&db, &dst_config, dst_data, dst_rom.size);
+    rom_close(&src_rom);
+    rom_close(&dst_rom);
+    config_free(&src_config);
+    config_free(&dst_config);
+  } else {
+    print_usage();
+    return 1;
+  }
+  free(db.data);
+  return 0;
 }
 
 int main(int argc, char *argv[]) {
-  char *srcfile;
-  char *newfile;
+  char *srcfile = NULL;
+  char *newfile = NULL;
+  char *cache_file = NULL;
+  int thread_count = 0;
+  int threshold = 75;
   long srcsize, newsize;
+  rom_image srcrom, newrom;
   unsigned char *srcdata;
   unsigned char *newdata;
   instruction *ins_table;
+  opcode_map map;
+  int i;
 
-  if (argc < 3) {
-    ERROR("usage: matchsigs source new\n");
-    return 1;
+  if (argc >= 2 && (strcmp(argv[1], "extract") == 0 ||
+                    strcmp(argv[1], "match") == 0 ||
+                    strcmp(argv[1], "port") == 0)) {
+    return sigdb_command(argc, argv);
   }
 
-  srcfile = argv[1];
-  newfile = argv[2];
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      switch (argv[i][1]) {
+      case 'j':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        thread_count = strtol(argv[i], NULL, 0);
+        break;
+      case 't':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        threshold = strtol(argv[i], NULL, 0);
+        if (threshold < 0 || threshold > 100) {
+          print_usage();
+          return 1;
+        }
+        break;
+      case 'c':
+        if (++i >= argc) {
+          print_usage();
+          return 1;
+        }
+        cache_file = argv[i];
+        break;
+      case 'v':
+        g_verbosity = 1;
+        break;
+      default:
+        print_usage();
+        return 1;
+      }
+    } else if (srcfile == NULL) {
+      srcfile = argv[i];
+    } else if (newfile == NULL) {
+      newfile = argv[i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (newfile == NULL) {
+    print_usage();
+    return 1;
+  }
+  if (thread_count < 1) {
+    thread_count = cpu_count();
+  }
 
   INFO("Reading input files...\n");
-  srcsize = read_file(srcfile, &srcdata);
-  newsize = read_file(newfile, &newdata);
+  srcdata = read_rom(srcfile, &srcrom);
+  newdata = read_rom(newfile, &newrom);
+  srcsize = srcrom.size;
+  newsize = newrom.size;
 
   if (srcsize >= 8 * MB) {
     long size = MIPS_INS_ENDING * sizeof(*ins_table);
@@ -1945,14 +2650,18 @@ int main(int argc, char *argv[]) {
     ins_table = calloc(MIPS_INS_ENDING, sizeof(*ins_table));
     assert(ins_table);
     INFO("Filling instruction table...\n");
-    fill_table(ins_table, newdata, newsize);
+    fill_table(ins_table, &map, newdata, newsize);
 
-    INFO("Finding matches...\n");
-    find_matches(ins_table, srcdata);
+    INFO("Finding matches on %d threads...\n", thread_count);
+    find_matches(ins_table, &map, srcdata, cache_file, thread_count,
+                 threshold);
+    free(map.ids);
     free(ins_table);
   } else {
     ERROR("srcsize: %ld, newsize: %ld\n", srcsize, newsize);
   }
+  rom_close(&srcrom);
+  rom_close(&newrom);
 
   return 0;
 }
@@ -1,12 +1,50 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "../src/mio0/libmio0.h"
+#include "../src/n64graphics/n64graphics.h"
 #include "../src/utils/config.h"
+#include "../src/utils/parallel.h"
+#include "../src/utils/romimage.h"
 #include "../src/utils/utils.h"
 
-#define DEFAULT_CONFIG "../configs/sm64.u.config"
+#define MONTAGE_VERSION "0.2"
+
+// sheet layout: up to SHEET_COLUMNS cells per row, each a TILE_SIZE square
+// with TILE_BORDER around it and LABEL_LINES lines of text below. textures
+// larger than the tile are scaled down, smaller ones are centered
+#define SHEET_COLUMNS 10
+#define TILE_SIZE 64
+#define TILE_BORDER 2
+#define LABEL_LINES 3
+#define LABEL_COLOR 0x33
+
+// 3x5 bitmap font, drawn FONT_SCALE times larger with a pixel of spacing
+#define GLYPH_W 3
+#define GLYPH_H 5
+#define FONT_SCALE 2
+#define CHAR_W ((GLYPH_W + 1) * FONT_SCALE)
+#define LINE_H ((GLYPH_H + 1) * FONT_SCALE)
+
+#define CELL_W (TILE_SIZE + 2 * TILE_BORDER)
+#define CELL_H (CELL_W + LABEL_LINES * LINE_H)
+
+typedef struct {
+  char *config_file;
+  char *rom_file;
+  char *output_dir;
+  int threads;
+} arg_config;
+
+// default configuration
+static const arg_config default_args = {
+    NULL,       // config file
+    NULL,       // ROM file
+    "montages", // output directory
+    0,          // threads, one per CPU
+};
 
 typedef struct {
   unsigned int rom;
@@ -120,76 +158,383 @@ static unsigned int map(unsigned int rom) {
   return 0;
 }
 
-int main() {
-  rom_config config;
-  FILE *out;
-  int i;
-  unsigned int w, h;
-  unsigned int offset;
+// rows top to bottom, bit 2 is the leftmost column
+static const char font_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZx";
+static const unsigned char font[][GLYPH_H] = {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 3, 1, 7},
+    {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 2, 2},
+    {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, {2, 5, 7, 5, 5}, {6, 5, 6, 5, 6},
+    {3, 4, 4, 4, 3}, {6, 5, 5, 5, 6}, {7, 4, 6, 4, 7}, {7, 4, 6, 4, 4},
+    {3, 4, 5, 5, 3}, {5, 5, 7, 5, 5}, {7, 2, 2, 2, 7}, {1, 1, 1, 5, 2},
+    {5, 5, 6, 5, 5}, {4, 4, 4, 4, 7}, {5, 7, 7, 5, 5}, {6, 5, 5, 5, 5},
+    {2, 5, 5, 5, 2}, {6, 5, 6, 4, 4}, {2, 5, 5, 6, 3}, {6, 5, 6, 5, 5},
+    {3, 4, 2, 1, 6}, {7, 2, 2, 2, 2}, {5, 5, 5, 5, 7}, {5, 5, 5, 5, 2},
+    {5, 5, 7, 7, 5}, {5, 5, 2, 5, 5}, {5, 5, 2, 2, 2}, {7, 1, 2, 4, 7},
+    {0, 5, 2, 5, 0},
+};
 
-  // load defaults and parse arguments
-  out = stdout;
+// per worker buffers, reused across sheets
+typedef struct {
+  texture_scratch block; // decompressed MIO0 block
+  texture_scratch image; // one texture as RGBA
+  texture_scratch ia;    // IA/I texture before expanding to RGBA
+  texture_scratch sheet; // the contact sheet
+} worker_buffers;
 
-  // parse config file
-  INFO("Parsing config file '%s'\n", DEFAULT_CONFIG);
-  if (config_parse_file(DEFAULT_CONFIG, &config)) {
-    ERROR("Error parsing config file '%s'\n", DEFAULT_CONFIG);
+typedef struct {
+  const arg_config *args;
+  const rom_config *config;
+  const unsigned char *rom;
+  size_t rom_size;
+  const int *sheets;       // config section of each sheet
+  int sheet_count;
+  worker_buffers *buffers; // one per worker
+  int *failed;             // per sheet, set if it couldn't be written
+  double *seconds;         // per sheet, time taken
+} montage_job;
+
+static void print_usage(void) {
+  ERROR("Usage: montage [-o OUTPUT_DIR] [-t THREADS] [-v] CONFIG ROM\n"
+        "\n"
+        "montage v" MONTAGE_VERSION ": N64 texture contact sheet generator\n"
+        "\n"
+        "Optional arguments:\n"
+        " -o OUTPUT_DIR  directory for sheets and index.html (default: "
+        "\"%s\")\n"
+        " -t THREADS     number of worker threads (default: one per CPU)\n"
+        " -v             verbose progress output\n"
+        "\n"
+        "File arguments:\n"
+        " CONFIG         ROM configuration file\n"
+        " ROM            ROM to read textures from\n",
+        default_args.output_dir);
+  exit(1);
+}
+
+// parse command line arguments
+static void parse_arguments(int argc, char *argv[], arg_config *config) {
+  int i;
+  int file_count = 0;
+  if (argc < 3) {
+    print_usage();
+  }
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      switch (argv[i][1]) {
+      case 'o':
+        if (++i >= argc) {
+          print_usage();
+        }
+        config->output_dir = argv[i];
+        break;
+      case 't':
+        if (++i >= argc) {
+          print_usage();
+        }
+        config->threads = strtol(argv[i], NULL, 0);
+        break;
+      case 'v':
+        g_verbosity = 1;
+        break;
+      default:
+        print_usage();
+        break;
+      }
+    } else {
+      switch (file_count) {
+      case 0:
+        config->config_file = argv[i];
+        break;
+      case 1:
+        config->rom_file = argv[i];
+        break;
+      default:
+        print_usage();
+        break;
+      }
+      file_count++;
+    }
+  }
+  if (file_count != 2) {
+    print_usage();
+  }
+}
+
+static int is_texture(section_type type) {
+  switch (type) {
+  case TYPE_TEX_CI:
+  case TYPE_TEX_I:
+  case TYPE_TEX_IA:
+  case TYPE_TEX_RGBA:
+  case TYPE_TEX_SKYBOX:
     return 1;
+  default:
+    return 0;
   }
+}
 
-  fprintf(out, "mkdir -p montages\n\n");
+static void section_label(char *label, const split_section *sec) {
+  if (sec->label[0] == '\0') {
+    sprintf(label, "L%06X", sec->start);
+  } else {
+    strcpy(label, sec->label);
+  }
+}
 
-  for (i = 0; i < config.section_count; i++) {
-    split_section *sec = &config.sections[i];
-    if (sec->type == TYPE_MIO0) {
-      if (sec->children && sec->child_count > 0) {
-        int t;
-        fprintf(out, "montage \\\n");
-        for (t = 0; t < sec->child_count; t++) {
-          char name[256];
-          char format[8];
-          texture *tex = &sec->children[t].tex;
-          w = tex->width;
-          h = tex->height;
-          offset = tex->offset;
-          switch (tex->format) {
-          case TYPE_TEX_IA:
-            sprintf(name, "%s.0x%05X.ia%d.png", sec->label, offset, tex->depth);
-            sprintf(format, "ia%d", tex->depth);
-            break;
-          case TYPE_TEX_RGBA:
-            sprintf(name, "%s.0x%05X.png", sec->label, offset);
-            sprintf(format, "rgba");
-            break;
-          case TYPE_TEX_SKYBOX:
-            sprintf(name, "%s.0x%05X.skybox.png", sec->label, offset);
-            sprintf(format, "sky");
-            break;
-          default:
-            continue;
+static void draw_text(rgba *sheet, int sheet_w, int x, int y, int max_w,
+                      const char *text) {
+  for (; *text && max_w >= GLYPH_W * FONT_SCALE; text++) {
+    const char *c = strchr(font_chars, *text);
+    if (!c && *text >= 'a' && *text <= 'z') {
+      c = strchr(font_chars, *text - 'a' + 'A');
+    }
+    if (c) {
+      const unsigned char *glyph = font[c - font_chars];
+      for (int gy = 0; gy < GLYPH_H * FONT_SCALE; gy++) {
+        for (int gx = 0; gx < GLYPH_W * FONT_SCALE; gx++) {
+          if (glyph[gy / FONT_SCALE] & (4 >> (gx / FONT_SCALE))) {
+            rgba *px = &sheet[(y + gy) * sheet_w + x + gx];
+            px->red = px->green = px->blue = LABEL_COLOR;
+            px->alpha = 0xFF;
           }
-          fprintf(out,
-                  "        -label '%05X\\n%s\\n%dx%d' "
-                  "../sm64.split/textures/%s \\\n",
-                  offset, format, w, h, name);
         }
-        int x = MIN(10, sec->child_count);
-        int y = MAX(1, (sec->child_count + 9) / 10);
-        fprintf(out,
-                "        -tile %dx%d -background none -geometry '64x64+2+2>' "
-                "montages/%s.png\n\n",
-                x, y, sec->label);
-        fprintf(out, "pngcrush -ow montages/%s.png\n\n", sec->label);
       }
     }
+    x += CHAR_W;
+    max_w -= CHAR_W;
+  }
+}
+
+// copy an image into its cell, shrinking it to fit the tile
+static void draw_tile(rgba *sheet, int sheet_w, int x, int y, const rgba *img,
+                      int w, int h) {
+  int longest = MAX(w, h);
+  int dw = w, dh = h;
+  if (longest > TILE_SIZE) {
+    dw = MAX(1, w * TILE_SIZE / longest);
+    dh = MAX(1, h * TILE_SIZE / longest);
+  }
+  x += (TILE_SIZE - dw) / 2;
+  y += (TILE_SIZE - dh) / 2;
+  for (int ty = 0; ty < dh; ty++) {
+    const rgba *src = &img[(ty * h / dh) * w];
+    rgba *dst = &sheet[(y + ty) * sheet_w + x];
+    if (dw == w) {
+      memcpy(dst, src, w * sizeof(*dst));
+    } else {
+      for (int tx = 0; tx < dw; tx++) {
+        dst[tx] = src[tx * w / dw];
+      }
+    }
+  }
+}
+
+// decode a texture from a block to RGBA, returns image or NULL
+// w, h: texture size in, image size out
+static rgba *decode_texture(worker_buffers *buf, const texture *tex,
+                            const unsigned char *block, unsigned int block_len,
+                            int *w, int *h) {
+  unsigned int len = (*w) * (*h) * tex->depth / 8;
+  rgba *img;
+  ia *ia_img = NULL;
+  int ret;
+
+  if (tex->offset > block_len || len > block_len - tex->offset) {
+    return NULL;
+  }
+  img = texture_scratch_reserve(&buf->image, (*w) * (*h) * sizeof(*img));
+  if (!img) {
+    return NULL;
+  }
+  const unsigned char *raw = &block[tex->offset];
+  switch (tex->format) {
+  case TYPE_TEX_RGBA:
+    ret = raw2rgba_into(img, raw, *w, *h, tex->depth);
+    break;
+  case TYPE_TEX_CI: {
+    // RGBA16 palette indexed by CI8, expand CI4 to match
+    const unsigned char *indices = raw;
+    unsigned char *ci8;
+    int count = (*w) * (*h);
+    int used = 0;
+    if (tex->depth == 4) {
+      ci8 = texture_scratch_reserve(&buf->ia, count);
+      if (!ci8) {
+        return NULL;
+      }
+      for (int i = 0; i < count; i++) {
+        ci8[i] = (raw[i / 2] >> ((i & 1) ? 0 : 4)) & 0xF;
+      }
+      indices = ci8;
+    } else if (tex->depth != 8) {
+      return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+      used = MAX(used, indices[i] + 1);
+    }
+    if (tex->palette > block_len ||
+        (unsigned int)used * 2 > block_len - tex->palette) {
+      return NULL;
+    }
+    ret = rawci2rgba_into(img, indices, &block[tex->palette], *w, *h, 16);
+    break;
+  }
+  case TYPE_TEX_IA:
+  case TYPE_TEX_I:
+    ia_img = texture_scratch_reserve(&buf->ia, (*w) * (*h) * sizeof(*ia_img));
+    if (!ia_img) {
+      return NULL;
+    }
+    if (tex->format == TYPE_TEX_IA) {
+      ret = raw2ia_into(ia_img, raw, *w, *h, tex->depth);
+    } else {
+      ret = raw2i_into(ia_img, raw, *w, *h, tex->depth);
+    }
+    for (int i = 0; ret == 0 && i < (*w) * (*h); i++) {
+      img[i].red = img[i].green = img[i].blue = ia_img[i].intensity;
+      img[i].alpha = ia_img[i].alpha;
+    }
+    break;
+  case TYPE_TEX_SKYBOX: {
+    // grid of 32x32 tiles overlapping by a pixel, as n64split saves them
+    int m = *w / 32;
+    int n = *h / 32;
+    int sky_w = *w - m;
+    rgba tile[32 * 32];
+    ret = 0;
+    for (int ty = 0; ty < n && ret == 0; ty++) {
+      for (int tx = 0; tx < m && ret == 0; tx++) {
+        ret = raw2rgba_into(tile, raw, 32, 32, tex->depth);
+        for (int cy = 0; cy < 31; cy++) {
+          memcpy(&img[(31 * ty + cy) * sky_w + 31 * tx], &tile[32 * cy],
+                 31 * sizeof(*tile));
+        }
+        raw += 32 * 32 * tex->depth / 8;
+      }
+    }
+    *w = sky_w;
+    *h -= n;
+    break;
+  }
+  default:
+    return NULL;
   }
+  return ret == 0 ? img : NULL;
+}
 
-  fprintf(out, "cat << EOF > index.html\n");
+static const char *format_name(char *name, const texture *tex) {
+  switch (tex->format) {
+  case TYPE_TEX_CI:
+    sprintf(name, "CI%d", tex->depth);
+    break;
+  case TYPE_TEX_I:
+    sprintf(name, "I%d", tex->depth);
+    break;
+  case TYPE_TEX_IA:
+    sprintf(name, "IA%d", tex->depth);
+    break;
+  case TYPE_TEX_RGBA:
+    sprintf(name, "RGBA%d", tex->depth);
+    break;
+  default:
+    strcpy(name, "SKY");
+    break;
+  }
+  return name;
+}
+
+// render and write the contact sheet for one MIO0 section
+static int write_sheet(const montage_job *job, worker_buffers *buf,
+                       const split_section *sec) {
+  char label[512];
+  char path[FILENAME_MAX];
+  char text[3][32];
+  mio0_header_t head;
+  unsigned char *block;
+  rgba *sheet;
+  int tex_count = 0;
+  int cell = 0;
+  int t;
+
+  section_label(label, sec);
+  if (sec->start > job->rom_size || sec->end > job->rom_size ||
+      !mio0_decode_header(&job->rom[sec->start], &head)) {
+    ERROR("Section %s at %X is not a MIO0 block\n", label, sec->start);
+    return -1;
+  }
+  block = texture_scratch_reserve(&buf->block, head.dest_size);
+  if (!block || mio0_decode(&job->rom[sec->start], block, NULL) < 0) {
+    ERROR("Error decoding MIO0 block %s at %X\n", label, sec->start);
+    return -1;
+  }
+
+  for (t = 0; t < sec->child_count; t++) {
+    tex_count += is_texture(sec->children[t].tex.format);
+  }
+  int columns = MIN(SHEET_COLUMNS, tex_count);
+  int rows = (tex_count + SHEET_COLUMNS - 1) / SHEET_COLUMNS;
+  int sheet_w = columns * CELL_W;
+  int sheet_h = rows * CELL_H;
+  sheet = texture_scratch_reserve(&buf->sheet,
+                                  (size_t)sheet_w * sheet_h * sizeof(*sheet));
+  if (!sheet) {
+    ERROR("Error allocating %dx%d sheet for %s\n", sheet_w, sheet_h, label);
+    return -1;
+  }
+  memset(sheet, 0, (size_t)sheet_w * sheet_h * sizeof(*sheet));
+
+  for (t = 0; t < sec->child_count; t++) {
+    const texture *tex = &sec->children[t].tex;
+    int w = tex->width;
+    int h = tex->height;
+    if (!is_texture(tex->format)) {
+      continue;
+    }
+    int x = (cell % SHEET_COLUMNS) * CELL_W;
+    int y = (cell / SHEET_COLUMNS) * CELL_H;
+    rgba *img = decode_texture(buf, tex, block, head.dest_size, &w, &h);
+    if (img) {
+      draw_tile(sheet, sheet_w, x + TILE_BORDER, y + TILE_BORDER, img, w, h);
+    } else {
+      ERROR("Skipping texture %s.%05X: outside block or invalid depth\n",
+            label, tex->offset);
+    }
+    sprintf(text[0], "%05X", tex->offset);
+    format_name(text[1], tex);
+    sprintf(text[2], "%dx%d", tex->width, tex->height);
+    for (int l = 0; l < LABEL_LINES; l++) {
+      draw_text(sheet, sheet_w, x + TILE_BORDER, y + CELL_W + l * LINE_H,
+                TILE_SIZE, text[l]);
+    }
+    cell++;
+  }
+
+  sprintf(path, "%s/%s.png", job->args->output_dir, label);
+  INFO("Writing %d textures to %s\n", tex_count, path);
+  if (!rgba2png_opts(path, sheet, sheet_w, sheet_h, NULL, NULL)) {
+    ERROR("Error writing \"%s\"\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_index(const montage_job *job) {
+  char path[FILENAME_MAX];
+  char label[512];
+  FILE *out;
+  int i;
+
+  sprintf(path, "%s/index.html", job->args->output_dir);
+  out = fopen(path, "w");
+  if (out == NULL) {
+    ERROR("Error opening \"%s\"\n", path);
+    return -1;
+  }
   fprintf(out,
           "<html>\n"
           "<head>\n"
           "<title>%s Textures</title></head>\n",
-          config.name);
+          job->config->name);
   fprintf(out, "<style type=\"text/css\">\n"
                "table {border-spacing: 0; }\n"
                "table {\n"
@@ -254,22 +599,129 @@ int main() {
   fprintf(out, "<table>\n");
   fprintf(out, "<tr><th>ROM MIO0</th><th>Extended ROM</th><th>Textures and "
                "offset in block</th></tr>\n");
-  for (i = 0; i < config.section_count; i++) {
-    split_section *sec = &config.sections[i];
-    if (sec->type == TYPE_MIO0) {
-      if (sec->children && sec->child_count > 0) {
-        fprintf(out,
-                "<tr><td>%X</td><td>%X</td><td><img "
-                "src=\"montages/%s.png\"></td></tr>\n",
-                sec->start, map(sec->start), sec->label);
-      }
+  for (i = 0; i < job->sheet_count; i++) {
+    const split_section *sec = &job->config->sections[job->sheets[i]];
+    unsigned int ext = map(sec->start);
+    section_label(label, sec);
+    fprintf(out, "<tr><td>%X</td><td>", sec->start);
+    if (ext) {
+      fprintf(out, "%X", ext);
     }
+    fprintf(out, "</td><td><img src=\"%s.png\"></td></tr>\n", label);
   }
   fprintf(out, "</table>\n");
   fprintf(out, "</center>\n");
   fprintf(out, "</body>\n");
   fprintf(out, "</html>\n");
-  fprintf(out, "EOF\n");
-
+  fclose(out);
   return 0;
 }
+
+static double elapsed(const struct timespec *start) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// item 0 writes index.html, item i + 1 the sheet for job->sheets[i]
+static void montage_fn(int index, int worker, void *arg) {
+  montage_job *job = arg;
+  struct timespec start;
+  int ret;
+
+  timespec_get(&start, TIME_UTC);
+  if (index == 0) {
+    ret = write_index(job);
+  } else {
+    ret = write_sheet(job, &job->buffers[worker],
+                      &job->config->sections[job->sheets[index - 1]]);
+  }
+  job->failed[index] = ret != 0;
+  job->seconds[index] = elapsed(&start);
+}
+
+int main(int argc, char *argv[]) {
+  arg_config args;
+  rom_config config;
+  rom_image rom;
+  montage_job job;
+  struct timespec start;
+  int threads;
+  int failures = 0;
+  int i;
+
+  // load defaults and parse arguments
+  args = default_args;
+  parse_arguments(argc, argv, &args);
+  timespec_get(&start, TIME_UTC);
+
+  // parse config file
+  INFO("Parsing config file '%s'\n", args.config_file);
+  if (config_parse_file(args.config_file, &config)) {
+    ERROR("Error parsing config file '%s'\n", args.config_file);
+    return 1;
+  }
+
+  if (rom_open(&rom, args.rom_file) != 0) {
+    ERROR("Error opening ROM \"%s\"\n", args.rom_file);
+    return 1;
+  }
+  // convert the whole ROM up front so workers can share it
+  rom_range(&rom, 0, rom.size);
+
+  // one sheet per MIO0 block with textures
+  int *sheets = malloc(config.section_count * sizeof(*sheets));
+  int sheet_count = 0;
+  for (i = 0; i < config.section_count; i++) {
+    const split_section *sec = &config.sections[i];
+    if (sec->type == TYPE_MIO0 && sec->children) {
+      for (int t = 0; t < sec->child_count; t++) {
+        if (is_texture(sec->children[t].tex.format)) {
+          sheets[sheet_count++] = i;
+          break;
+        }
+      }
+    }
+  }
+
+  make_dir(args.output_dir);
+  threads = args.threads > 0 ? args.threads : cpu_count();
+  job.args = &args;
+  job.config = &config;
+  job.rom = rom.data;
+  job.rom_size = rom.size;
+  job.sheets = sheets;
+  job.sheet_count = sheet_count;
+  job.buffers = calloc(threads, sizeof(*job.buffers));
+  job.failed = calloc(sheet_count + 1, sizeof(*job.failed));
+  job.seconds = calloc(sheet_count + 1, sizeof(*job.seconds));
+  if (!sheets || !job.buffers || !job.failed || !job.seconds) {
+    ERROR("Error allocating sheet state\n");
+    return 1;
+  }
+  parallel_for(sheet_count + 1, threads, montage_fn, &job);
+
+  double busy = 0.0;
+  for (i = 0; i <= sheet_count; i++) {
+    failures += job.failed[i];
+    busy += job.seconds[i];
+  }
+  INFO("Wrote %d sheets to %s in %.3f s (%.3f s over %d threads)\n",
+       sheet_count - failures, args.output_dir, elapsed(&start), busy,
+       threads);
+
+  for (i = 0; i < threads; i++) {
+    texture_scratch_free(&job.buffers[i].block);
+    texture_scratch_free(&job.buffers[i].image);
+    texture_scratch_free(&job.buffers[i].ia);
+    texture_scratch_free(&job.buffers[i].sheet);
+  }
+  free(job.buffers);
+  free(job.failed);
+  free(job.seconds);
+  free(sheets);
+  rom_close(&rom);
+  config_free(&config);
+
+  return failures ? 1 : 0;
+}
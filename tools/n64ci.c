@@ -7,8 +7,6 @@
 
 #define N64CI_VERSION "0.1"
 
-#define SCALE_8_5(VAL_) (((VAL_) * 0x1F) / 0xFF)
-
 typedef struct {
   char pal_filename[FILENAME_MAX];
   unsigned pal_entries;
@@ -16,19 +14,6 @@ typedef struct {
   unsigned input_count;
 } arg_config;
 
-typedef struct {
-  rgba *data;
-  unsigned char *ci;
-  int width;
-  int height;
-} image_t;
-
-typedef struct {
-  unsigned short data[256];
-  unsigned max; // max number of entries
-  unsigned used;
-} palette_t;
-
 // default configuration
 static const arg_config default_args = {
     "palette.bin", // output palette filename
@@ -37,42 +22,6 @@ static const arg_config default_args = {
     0              // count of input files
 };
 
-// find index of palette color
-// return -1 if not found
-static int pal_find_color(palette_t *pal, unsigned short col) {
-  unsigned i;
-  for (i = 0; i < pal->used; i++) {
-    if (pal->data[i] == col) {
-      return i;
-    }
-  }
-  return -1;
-}
-
-// find color in palette, or add if not there
-// returns palette index entered or -1 if palette full
-static int pal_add_color(palette_t *pal, rgba *col) {
-  unsigned short rgba16;
-  char r, g, b, a;
-  int idx;
-  r = SCALE_8_5(col->red);
-  g = SCALE_8_5(col->green);
-  b = SCALE_8_5(col->blue);
-  a = col->alpha ? 0x1 : 0x0;
-  rgba16 = (((r << 3) | (g >> 2)) << 8) | ((g & 0x3) << 6) | (b << 1) | a;
-  idx = pal_find_color(pal, rgba16);
-  if (idx < 0) {
-    if (pal->used == pal->max) {
-      ERROR("Error: trying to use more than %d\n", pal->max);
-    } else {
-      idx = pal->used;
-      pal->data[pal->used] = rgba16;
-      pal->used++;
-    }
-  }
-  return idx;
-}
-
 static void print_usage(void) {
   ERROR("Usage: n64ci [-e PAL_ENTIRES] [-p PAL_FILE] [-v] [PNG images]\n"
         "\n"
@@ -136,67 +85,67 @@ int main(int argc, char *argv[]) {
   char bin_filename[FILENAME_MAX];
   unsigned char *palette_bin;
   arg_config config;
-  palette_t palette;
-  image_t *images;
+  rgba **images;
+  uint8_t **ci;
+  int *widths;
+  int *heights;
   unsigned pal_length;
+  int pal_used = 0;
   unsigned i;
-  int x, y;
 
   config = default_args;
   parse_arguments(argc, argv, &config);
   INFO("Arguments: \"%s\" %d %d\n", config.pal_filename, config.pal_entries,
        config.input_count);
+  if (config.pal_entries < 1 || config.pal_entries > 256) {
+    ERROR("Error: palette entries must be 1-256\n");
+    exit(1);
+  }
 
   images = malloc(sizeof(*images) * config.input_count);
+  ci = malloc(sizeof(*ci) * config.input_count);
+  widths = malloc(sizeof(*widths) * config.input_count);
+  heights = malloc(sizeof(*heights) * config.input_count);
 
   // load all images
   for (i = 0; i < config.input_count; i++) {
-    images[i].data = pngfile2rgba(config.input_files[i], &images[i].width,
-                                  &images[i].height);
+    images[i] = png2rgba(config.input_files[i], &widths[i], &heights[i]);
+    if (!images[i]) {
+      exit(1);
+    }
+    ci[i] = malloc(widths[i] * heights[i]);
   }
 
-  // assign colors to palette
-  palette.max = config.pal_entries;
-  palette.used = 0;
-  for (i = 0; i < config.input_count; i++) {
-    images[i].ci =
-        malloc(sizeof(*images[i].ci) * images[i].width * images[i].height);
-    for (x = 0; x < images[i].width; x++) {
-      for (y = 0; y < images[i].height; y++) {
-        unsigned img_idx = y * images[i].width + x;
-        int pal_idx = pal_add_color(&palette, &images[i].data[img_idx]);
-        if (pal_idx < 0) {
-          ERROR("Error adding color @ (%d, %d): %d (used: %u)\n", x, y, pal_idx,
-                palette.used);
-          exit(1);
-        } else {
-          images[i].ci[img_idx] = (unsigned char)pal_idx;
-        }
-      }
-    }
+  // build one palette for all images, quantizing if they use too many colors
+  palette_bin = malloc(config.pal_entries * 2);
+  if (rgba2rawci_shared(ci, palette_bin, &pal_used, config.pal_entries,
+                        (const rgba *const *)images, widths, heights,
+                        config.input_count, 8) < 0) {
+    exit(1);
   }
 
   // output bin files
   for (i = 0; i < config.input_count; i++) {
     generate_filename(config.input_files[i], bin_filename, "bin");
-    write_file(bin_filename, images[i].ci, images[i].width * images[i].height);
+    write_file(bin_filename, ci[i], widths[i] * heights[i]);
+    free(ci[i]);
+    free(images[i]);
   }
 
   // output palette file
   pal_length = config.pal_entries * 2;
   // unused entries set to 0xFFFF
-  palette_bin = malloc(pal_length);
-  memset(palette_bin, 0xFF, pal_length);
-  for (i = 0; i < palette.used; i++) {
-    write_u16_be(&palette_bin[i * 2], palette.data[i]);
-  }
+  memset(&palette_bin[pal_used * 2], 0xFF, pal_length - pal_used * 2);
   write_file(config.pal_filename, palette_bin, pal_length);
 
-  ERROR("Used: %d\n", palette.used);
+  ERROR("Used: %d\n", pal_used);
 
   free(config.input_files);
   free(palette_bin);
   free(images);
+  free(ci);
+  free(widths);
+  free(heights);
 
   return 0;
 }